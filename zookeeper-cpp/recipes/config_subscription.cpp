@@ -0,0 +1,247 @@
+#include "config_subscription.h"
+#include <zookeeper-cpp/zookeeper_error.hpp>
+#include <zookeeper-cpp/zookeeper_ext.hpp>
+#include <zookeeper-cpp/zookeeper_log.hpp>
+#include <algorithm>
+#include <cstring>
+
+using std::experimental::post;
+using namespace zookeeper;
+
+ConfigWatcher::ConfigWatcher(const std::string& zookeeper_servers,
+                             const std::string& path,
+                             bool subtree,
+                             ChangeHandler on_change)
+: zookeeper_servers_(zookeeper_servers),
+  path_(path),
+  subtree_(subtree),
+  on_change_(std::move(on_change)),
+  executor_(std::experimental::system_executor()) {
+  // a refresh posted by an early connected event must see zk_
+  std::lock_guard<std::mutex> lock(mutex_);
+  zk_ = std::make_unique<ZooKeeper>(zookeeper_servers_, this);
+}
+
+ConfigWatcher::~ConfigWatcher() {
+  // queued reloads are skipped, on_change_ isn't called any more
+  tasks_.Close();
+  std::lock_guard<std::mutex> lock(mutex_);
+  zk_.reset();
+}
+
+void ConfigWatcher::ResetZooKeeperClient() {
+  zk_ = std::make_unique<ZooKeeper>(zookeeper_servers_, this);
+  loaded_ = false;
+}
+
+void ConfigWatcher::RefreshLater() {
+  post(executor_, tasks_.Wrap([this](){ this->Refresh(); }));
+}
+
+void ConfigWatcher::Refresh() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!zk_) return;
+
+  if (zk_->is_expired()) {
+    ResetZooKeeperClient();
+    return;
+  }
+
+  if (!zk_->is_connected()) {
+    return;
+  }
+
+  try {
+    Reload();
+  } catch (std::exception& e) {
+    Log(LOG_LEVEL_WARN, "config_subscription", "reload config {} failed, {}", path_, e.what());
+  }
+}
+
+void ConfigWatcher::ReloadLater(void (ConfigWatcher::*reload)()) {
+  post(executor_, tasks_.Wrap([this, reload](){
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!zk_ || !loaded_) return;
+    try {
+      (this->*reload)();
+    } catch (std::exception& e) {
+      // loaded again on the next connection
+      Log(LOG_LEVEL_WARN, "config_subscription", "reload config {} failed, {}", path_, e.what());
+    }
+  }));
+}
+
+void ConfigWatcher::Reload() {
+  // watch for creation if the node doesn't exist yet
+  if (!zk_->Exists(path_, true, &node_stat_)) {
+    return;
+  }
+
+  auto node = PipelinedGet(*zk_, {path_}, true)[0];
+  if (node.code == ZNONODE) {
+    // deleted in between, watch is set by Exists
+    return;
+  }
+  if (node.code != ZOK) {
+    throw ZooException(node.code);
+  }
+  data_.value = std::move(node.value);
+  node_stat_ = node.stat;
+
+  data_.children.clear();
+  child_mzxids_.clear();
+  if (subtree_) {
+    // published once with the node, below
+    FetchChildren();
+  }
+
+  loaded_ = true;
+  Publish();
+}
+
+void ConfigWatcher::ReloadNode() {
+  auto node = PipelinedGet(*zk_, {path_}, true)[0];
+  if (node.code == ZNONODE) {
+    // keep the last config, reloaded once created again
+    zk_->Exists(path_, true);
+    loaded_ = false;
+    return;
+  }
+  if (node.code != ZOK) {
+    throw ZooException(node.code);
+  }
+
+  data_.value = std::move(node.value);
+  node_stat_ = node.stat;
+  Publish();
+}
+
+void ConfigWatcher::ReloadChildren() {
+  FetchChildren();
+  Publish();
+}
+
+void ConfigWatcher::FetchChildren() {
+  auto children = zk_->GetChildren(path_, true);
+  std::sort(std::begin(children), std::end(children));
+
+  // pzxid of the node covers removed children
+  zk_->Exists(path_, false, &node_stat_);
+
+  std::map<std::string, std::string> values;
+  std::map<std::string, int64_t> mzxids;
+  std::vector<std::string> fetch_names;
+  std::vector<std::string> fetch_paths;
+  for (auto& child : children) {
+    auto it = data_.children.find(child);
+    if (it != data_.children.end()) {
+      values[child] = std::move(it->second);
+      mzxids[child] = child_mzxids_[child];
+    } else {
+      fetch_names.push_back(child);
+      fetch_paths.push_back(path_ + '/' + child);
+    }
+  }
+
+  auto results = PipelinedGet(*zk_, fetch_paths, true);
+  for (size_t i = 0; i < results.size(); ++i) {
+    if (results[i].code == ZNONODE) {
+      // removed after listing, the child watch fires again
+      continue;
+    }
+    if (results[i].code != ZOK) {
+      throw ZooException(results[i].code);
+    }
+    values[fetch_names[i]] = std::move(results[i].value);
+    mzxids[fetch_names[i]] = results[i].stat.mzxid;
+  }
+
+  data_.children = std::move(values);
+  child_mzxids_ = std::move(mzxids);
+}
+
+void ConfigWatcher::ReloadChild(const std::string& name) {
+  auto it = data_.children.find(name);
+  if (it == data_.children.end()) {
+    // new children are loaded by the child watch
+    return;
+  }
+
+  auto child = PipelinedGet(*zk_, {path_ + '/' + name}, true)[0];
+  if (child.code == ZNONODE) {
+    return;
+  }
+  if (child.code != ZOK) {
+    throw ZooException(child.code);
+  }
+
+  it->second = std::move(child.value);
+  child_mzxids_[name] = child.stat.mzxid;
+  Publish();
+}
+
+void ConfigWatcher::Publish() {
+  data_.version = node_stat_.version;
+  data_.mzxid = node_stat_.mzxid;
+  if (subtree_) {
+    data_.mzxid = std::max(data_.mzxid, node_stat_.pzxid);
+    for (auto& child : child_mzxids_) {
+      data_.mzxid = std::max(data_.mzxid, child.second);
+    }
+  }
+
+  on_change_(data_);
+}
+
+void ConfigWatcher::OnChanged(const char* path) {
+  if (path == path_) {
+    ReloadLater(&ConfigWatcher::ReloadNode);
+    return;
+  }
+
+  if (subtree_
+      && strncmp(path, path_.c_str(), path_.size()) == 0
+      && path[path_.size()] == '/') {
+    std::string name(path + path_.size() + 1);
+    post(executor_, tasks_.Wrap([this, name](){
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!zk_ || !loaded_) return;
+      try {
+        ReloadChild(name);
+      } catch (std::exception& e) {
+        Log(LOG_LEVEL_WARN, "config_subscription", "reload config {} failed, {}", name, e.what());
+      }
+    }));
+  }
+}
+
+void ConfigWatcher::OnChildChanged(const char* path) {
+  if (subtree_ && path == path_) {
+    ReloadLater(&ConfigWatcher::ReloadChildren);
+  }
+}
+
+void ConfigWatcher::OnCreated(const char* path) {
+  if (path == path_) {
+    RefreshLater();
+  }
+}
+
+void ConfigWatcher::OnConnected() {
+  RefreshLater();
+}
+
+void ConfigWatcher::OnSessionExpired() {
+  RefreshLater();
+}
+
+void ConfigWatcher::OnDeleted(const char* path) {
+  // the delete used up the watches, ReloadNode watches for the node's
+  // creation and keeps the last config meanwhile
+  if (path == path_) {
+    ReloadLater(&ConfigWatcher::ReloadNode);
+  }
+}
+
+void ConfigWatcher::OnConnecting() {}
+void ConfigWatcher::OnNotWatching(const char* path) {}
@@ -0,0 +1,169 @@
+#pragma once
+
+#include "task_guard.h"
+#include <zookeeper-cpp/zookeeper.hpp>
+#include <zookeeper-cpp/zookeeper_log.hpp>
+#include <experimental/executor>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+
+namespace zookeeper {
+
+// raw content of a watched config node
+struct ConfigData {
+  std::string value;
+  // child name => data, filled only when the subtree is watched
+  std::map<std::string, std::string> children;
+  // largest mzxid of the node and its children; for a subtree it also
+  // covers the pzxid of the node, so removing a child changes it
+  int64_t mzxid = 0;
+  // data version of the node
+  int32_t version = 0;
+};
+
+// Watch the data of |path|, and with |subtree| also its children and their
+// data, calling |on_change| with the full content after each change. Only
+// nodes reported changed by a watch are fetched again.
+class ConfigWatcher : public zookeeper::ZooWatcher {
+public:
+  typedef std::function<void(const ConfigData&)> ChangeHandler;
+
+  ConfigWatcher(const std::string& zookeeper_servers,
+                const std::string& path,
+                bool subtree,
+                ChangeHandler on_change);
+
+  ~ConfigWatcher();
+
+private:
+  // ZooWatcher callbacks
+  void OnConnected() override;
+  void OnConnecting() override;
+  void OnSessionExpired() override;
+
+  void OnCreated(const char* path) override;
+  void OnDeleted(const char* path) override;
+  void OnChanged(const char* path) override;
+  void OnChildChanged(const char* path) override;
+  void OnNotWatching(const char* path) override;
+
+private:
+  void Refresh();
+  void RefreshLater();
+
+  void ReloadLater(void (ConfigWatcher::*reload)());
+
+  void Reload();
+  void ReloadNode();
+  void ReloadChildren();
+  void FetchChildren();
+  void ReloadChild(const std::string& name);
+
+  void Publish();
+
+private:
+  const std::string zookeeper_servers_;
+  const std::string path_;
+  const bool subtree_;
+  const ChangeHandler on_change_;
+
+  // guards zk_ and the fetched content
+  std::mutex mutex_;
+
+  std::unique_ptr<zookeeper::ZooKeeper> zk_;
+  void ResetZooKeeperClient();
+
+  std::experimental::executor executor_;
+  // every task posted to executor_ is wrapped by it
+  TaskGuard tasks_;
+
+  bool loaded_ = false;
+  ConfigData data_;
+  NodeStat node_stat_ = NodeStat();
+  std::map<std::string, int64_t> child_mzxids_;
+};
+
+// an immutable config object with the version it was parsed from
+template <typename T>
+struct VersionedConfig {
+  VersionedConfig(T v, int64_t z, int32_t ver)
+  : value(std::move(v)), mzxid(z), version(ver) {
+  }
+
+  const T value;
+  const int64_t mzxid;
+  const int32_t version;
+};
+
+// Keep a parsed T of a config node, or subtree, up to date.
+//
+// The content is parsed once per change on the zookeeper event path and
+// published by swapping a shared pointer, so Get() from any thread is a
+// pointer load without locks; the object it returns stays valid for as
+// long as the caller holds it.
+template <typename T>
+class ConfigSubscription {
+public:
+  typedef std::function<T(const ConfigData&)> Parser;
+
+  ConfigSubscription(const std::string& zookeeper_servers,
+                     const std::string& path,
+                     Parser parser,
+                     bool subtree = false)
+  : parser_(std::move(parser)),
+    watcher_(zookeeper_servers, path, subtree,
+             [this](const ConfigData& data) { this->OnChange(data); }) {
+  }
+
+  // null before the config is loaded for the first time
+  std::shared_ptr<const VersionedConfig<T>> Get() const {
+    return std::atomic_load(&current_);
+  }
+
+  // wait until the config is loaded, returns null on timeout
+  std::shared_ptr<const VersionedConfig<T>> Wait(std::chrono::milliseconds timeout) {
+    std::unique_lock<std::mutex> lock(wait_mutex_);
+    loaded_.wait_for(lock, timeout, [this]{ return this->Get() != nullptr; });
+    return Get();
+  }
+
+  uint64_t parse_errors() const {
+    return parse_errors_;
+  }
+
+private:
+  void OnChange(const ConfigData& data) {
+    std::shared_ptr<const VersionedConfig<T>> config;
+    try {
+      config = std::make_shared<const VersionedConfig<T>>(
+          parser_(data), data.mzxid, data.version);
+    } catch (std::exception& e) {
+      // keep serving the previous config
+      Log(LOG_LEVEL_ERROR, "config_subscription", "parse config failed, {}", e.what());
+      ++parse_errors_;
+      return;
+    }
+
+    std::atomic_store(&current_, config);
+
+    std::lock_guard<std::mutex> lock(wait_mutex_);
+    loaded_.notify_all();
+  }
+
+  const Parser parser_;
+
+  std::shared_ptr<const VersionedConfig<T>> current_;
+  std::atomic<uint64_t> parse_errors_{0};
+
+  std::mutex wait_mutex_;
+  std::condition_variable loaded_;
+
+  // declared last, callbacks may arrive as soon as it's constructed
+  ConfigWatcher watcher_;
+};
+
+} // namespace zookeeper
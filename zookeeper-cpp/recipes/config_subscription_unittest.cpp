@@ -0,0 +1,132 @@
+#include <gtest/gtest.h>
+#include "config_subscription.h"
+#include "fault_proxy.h"
+#include <zookeeper-cpp/zookeeper_unittest_helper.hpp>
+#include <mutex>
+#include <vector>
+
+using namespace testing;
+using namespace zookeeper;
+
+TEST(ConfigSubscription, FollowNodeChanges) {
+  ZooKeeper zk("127.0.0.1:2181");
+  WaitForConnected(zk);
+  zk.Create("/test_config", "1");
+
+  ConfigSubscription<int> config("127.0.0.1:2181", "/test_config",
+                                 [](const ConfigData& data) {
+    return std::stoi(data.value);
+  });
+
+  auto first = config.Wait(std::chrono::seconds(5));
+  ASSERT_TRUE(first != nullptr);
+  EXPECT_EQ(first->value, 1);
+  EXPECT_EQ(first->version, 0);
+
+  zk.Set("/test_config", "2");
+  sleep(1);
+
+  auto second = config.Get();
+  EXPECT_EQ(second->value, 2);
+  EXPECT_EQ(second->version, 1);
+  EXPECT_GT(second->mzxid, first->mzxid);
+
+  // unparsable value keeps the last config
+  zk.Set("/test_config", "abc");
+  sleep(1);
+  EXPECT_EQ(config.Get()->value, 2);
+  EXPECT_EQ(config.parse_errors(), 1u);
+
+  zk.Delete("/test_config");
+}
+
+TEST(ConfigSubscription, FollowNodeRecreated) {
+  ZooKeeper zk("127.0.0.1:2181");
+  WaitForConnected(zk);
+  zk.Create("/test_config", "1");
+
+  ConfigSubscription<int> config("127.0.0.1:2181", "/test_config",
+                                 [](const ConfigData& data) {
+    return std::stoi(data.value);
+  });
+  ASSERT_TRUE(config.Wait(std::chrono::seconds(5)) != nullptr);
+
+  // the last config is kept while the node is gone
+  zk.Delete("/test_config");
+  sleep(1);
+  EXPECT_EQ(config.Get()->value, 1);
+
+  zk.Create("/test_config", "2");
+  sleep(1);
+  EXPECT_EQ(config.Get()->value, 2);
+
+  // watched again after the re-create
+  zk.Set("/test_config", "3");
+  sleep(1);
+  EXPECT_EQ(config.Get()->value, 3);
+
+  zk.Delete("/test_config");
+}
+
+TEST(ConfigSubscription, FollowSubtreeChanges) {
+  ZooKeeper zk("127.0.0.1:2181");
+  WaitForConnected(zk);
+  zk.Create("/test_config");
+  zk.Create("/test_config/a", "1");
+
+  typedef std::map<std::string, std::string> Values;
+  ConfigSubscription<Values> config("127.0.0.1:2181", "/test_config",
+                                    [](const ConfigData& data) {
+    return data.children;
+  }, true);
+
+  ASSERT_TRUE(config.Wait(std::chrono::seconds(5)) != nullptr);
+  EXPECT_EQ(config.Get()->value, Values({{"a", "1"}}));
+
+  zk.Create("/test_config/b", "2");
+  sleep(1);
+  EXPECT_EQ(config.Get()->value, Values({{"a", "1"}, {"b", "2"}}));
+
+  zk.Set("/test_config/a", "3");
+  sleep(1);
+  EXPECT_EQ(config.Get()->value, Values({{"a", "3"}, {"b", "2"}}));
+
+  auto before_delete = config.Get();
+  zk.Delete("/test_config/b");
+  sleep(1);
+  EXPECT_EQ(config.Get()->value, Values({{"a", "3"}}));
+  EXPECT_GT(config.Get()->mzxid, before_delete->mzxid);
+
+  zk.Delete("/test_config/a");
+  zk.Delete("/test_config");
+}
+
+TEST(ConfigSubscription, ReconnectPublishesOnce) {
+  ZooKeeper zk("127.0.0.1:2181");
+  WaitForConnected(zk);
+  zk.Create("/test_config");
+  zk.Create("/test_config/a", "1");
+
+  std::mutex mutex;
+  std::vector<int64_t> published;
+  FaultProxy proxy;
+  ConfigWatcher watcher(proxy.address(), "/test_config", true,
+                        [&](const ConfigData& data) {
+    std::lock_guard<std::mutex> lock(mutex);
+    published.push_back(data.mzxid);
+  });
+  sleep(1);
+
+  // the reload after reconnecting publishes the subtree once, not once
+  // for the children and again for the node
+  proxy.Disconnect();
+  sleep(2);
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    ASSERT_GE(published.size(), 1u);
+    EXPECT_LE(published.size(), 2u);
+  }
+
+  zk.Delete("/test_config/a");
+  zk.Delete("/test_config");
+}
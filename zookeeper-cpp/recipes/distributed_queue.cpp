@@ -0,0 +1,235 @@
+#include "distributed_queue.h"
+#include <zookeeper-cpp/zookeeper_ext.hpp>
+#include <zookeeper-cpp/zookeeper_trace.hpp>
+#include <algorithm>
+#include <cassert>
+#include <condition_variable>
+#include <exception>
+
+using namespace zookeeper;
+
+// largest window, in batches, a contended consumer claims a batch from
+static const size_t MAX_CLAIM_SPREAD = 16;
+
+DistributedQueue::DistributedQueue(const std::string& zookeeper_servers,
+                                   const std::string& queue_path)
+: zookeeper_servers_(zookeeper_servers),
+  queue_path_(queue_path),
+  rng_(std::random_device{}()) {
+  zk_ = std::make_unique<ZooKeeper>(zookeeper_servers_, this);
+}
+
+DistributedQueue::~DistributedQueue() {
+}
+
+void DistributedQueue::ResetZooKeeperClient() {
+  zk_ = std::make_unique<ZooKeeper>(zookeeper_servers_, this);
+  listing_.clear();
+  listing_head_ = 0;
+  listing_changed_ = true;
+  listing_stale_ = false;
+  queue_path_created_ = false;
+}
+
+void DistributedQueue::EnsureSession() {
+  if (zk_->is_expired()) {
+    ResetZooKeeperClient();
+  }
+
+  if (!queue_path_created_) {
+    RecursiveCreate(*zk_, queue_path_);
+    queue_path_created_ = true;
+  }
+}
+
+void DistributedQueue::Enqueue(const std::string& item) {
+  Enqueue(std::vector<std::string>{item});
+}
+
+void DistributedQueue::Enqueue(const std::vector<std::string>& items) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  EnsureSession();
+
+  auto item_prefix = queue_path_ + "/item-";
+
+  MultiOps ops;
+  for (size_t begin = 0; begin < items.size(); begin += max_enqueue_batch_) {
+    auto end = std::min(items.size(), begin + max_enqueue_batch_);
+
+    ops.clear();
+    for (auto i = begin; i < end; ++i) {
+      ops.Create(item_prefix, items[i], ZOO_SEQUENCE);
+    }
+
+    zk_->Multi(ops);
+    enqueued_ += end - begin;
+  }
+}
+
+std::vector<std::string> DistributedQueue::Dequeue(size_t max_items) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  ScopedSpan span("Dequeue", queue_path_);
+  EnsureSession();
+
+  std::vector<std::string> items;
+  while (items.size() < max_items) {
+    if (listing_head_ == listing_.size() || listing_stale_) {
+      // nothing new if the watch didn't fire since the last listing
+      if (!listing_changed_) {
+        if (listing_head_ == listing_.size()) break;
+      } else {
+        RefreshListing();
+        if (listing_.empty()) break;
+      }
+    }
+
+    auto claimed = ClaimItems(max_items - items.size());
+    for (auto& item : claimed) {
+      items.push_back(std::move(item));
+    }
+  }
+
+  dequeued_ += items.size();
+  return items;
+}
+
+void DistributedQueue::RefreshListing() {
+  // reset before fetching, so changes after the listing are noticed
+  listing_changed_ = false;
+
+  listing_ = zk_->GetChildren(queue_path_, true);
+  std::sort(std::begin(listing_), std::end(listing_));
+  listing_head_ = 0;
+  listing_stale_ = false;
+
+  ++listings_;
+}
+
+namespace {
+
+struct ClaimState {
+  std::mutex mutex;
+  std::condition_variable done;
+  size_t pending = 0;
+
+  std::vector<int> get_codes;
+  std::vector<int> delete_codes;
+  std::vector<std::string> values;
+};
+
+}
+
+std::vector<std::string> DistributedQueue::ClaimItems(size_t max_items) {
+  auto remaining = listing_.size() - listing_head_;
+  auto count = std::min(max_items, remaining);
+
+  // Consumers sharing a listing would all go for the same head items.
+  // Once we lose items to others, claim a batch at a random offset within
+  // a window of several batches instead, and move it to the head.
+  auto window = std::min(remaining, count * spread_);
+  if (window > count) {
+    std::uniform_int_distribution<size_t> offsets(0, window - count);
+    auto offset = offsets(rng_);
+    auto head = listing_.begin() + listing_head_;
+    std::rotate(head, head + offset, head + offset + count);
+  }
+
+  auto state = std::make_shared<ClaimState>();
+  state->pending = count * 2;
+  state->get_codes.resize(count, ZOK);
+  state->delete_codes.resize(count, ZOK);
+  state->values.resize(count);
+
+  auto complete_one = [](ClaimState& s) {
+    if (--s.pending == 0) s.done.notify_all();
+  };
+
+  // get and delete are pipelined in order, the value is read before the
+  // item is removed and we own the item only if our delete succeeded
+  size_t issued = 0;
+  std::exception_ptr error;
+  try {
+    for (size_t i = 0; i < count; ++i) {
+      auto path = queue_path_ + '/' + listing_[listing_head_ + i];
+
+      zk_->AsyncGet(path,
+                    [state, i, complete_one](int code, const char* value,
+                                             int value_len, const NodeStat&) {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        state->get_codes[i] = code;
+        if (code == ZOK) state->values[i].assign(value, value_len);
+        complete_one(*state);
+      });
+      ++issued;
+
+      zk_->AsyncDelete(path, [state, i, complete_one](int code) {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        state->delete_codes[i] = code;
+        complete_one(*state);
+      });
+      ++issued;
+    }
+  } catch (...) {
+    error = std::current_exception();
+  }
+
+  {
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->pending -= count * 2 - issued;
+    state->done.wait(lock, [&state]{ return state->pending == 0; });
+  }
+
+  // items whose delete wasn't issued stay in the listing
+  auto attempted = issued / 2;
+
+  std::vector<std::string> items;
+  for (size_t i = 0; i < attempted; ++i) {
+    if (state->get_codes[i] == ZOK && state->delete_codes[i] == ZOK) {
+      items.push_back(std::move(state->values[i]));
+    } else {
+      ++conflicts_;
+    }
+  }
+  listing_head_ += attempted;
+
+  if (items.size() < attempted) {
+    spread_ = std::min(spread_ * 2, MAX_CLAIM_SPREAD);
+  } else if (spread_ > 1) {
+    spread_ /= 2;
+  }
+
+  // most of the batch was taken by others, so is the rest of the listing
+  // likely; one listing is cheaper than a get and delete per stale item
+  listing_stale_ = items.size() * 2 < attempted;
+
+  if (error && items.empty()) {
+    std::rethrow_exception(error);
+  }
+  return items;
+}
+
+DistributedQueueStats DistributedQueue::stats() const {
+  DistributedQueueStats stats;
+  stats.enqueued = enqueued_;
+  stats.dequeued = dequeued_;
+  stats.conflicts = conflicts_;
+  stats.listings = listings_;
+  return stats;
+}
+
+void DistributedQueue::OnChildChanged(const char* path) {
+  if (path == queue_path_) {
+    listing_changed_ = true;
+  }
+}
+
+void DistributedQueue::OnSessionExpired() {
+  listing_changed_ = true;
+}
+
+void DistributedQueue::OnConnected() {}
+void DistributedQueue::OnConnecting() {}
+void DistributedQueue::OnCreated(const char* path) {}
+void DistributedQueue::OnDeleted(const char* path) {}
+void DistributedQueue::OnChanged(const char* path) {}
+void DistributedQueue::OnNotWatching(const char* path) {}
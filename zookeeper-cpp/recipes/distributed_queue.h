@@ -0,0 +1,111 @@
+#pragma once
+
+#include <zookeeper-cpp/zookeeper.hpp>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <random>
+
+namespace zookeeper {
+
+struct DistributedQueueStats {
+  // items committed by Enqueue
+  uint64_t enqueued = 0;
+  // items claimed by Dequeue
+  uint64_t dequeued = 0;
+  // items lost to another consumer while being claimed
+  uint64_t conflicts = 0;
+  // GetChildren round trips made to refill the cached listing
+  uint64_t listings = 0;
+};
+
+// Work queue stored as sequential children of |queue_path|.
+//
+// Producers enqueue a batch of items through one multi operation. Consumers
+// keep the sorted listing of the queue between child watches, and claim
+// several items per round trip by pipelining a get and a delete for each of
+// them; an item belongs to the consumer whose delete succeeds.
+//
+// A single consumer receives items in FIFO order. Contended consumers spread
+// their claims over the first few batches of the queue, so ordering between
+// them is only approximate.
+class DistributedQueue : public zookeeper::ZooWatcher {
+public:
+  DistributedQueue(const std::string& zookeeper_servers,
+                   const std::string& queue_path);
+
+  ~DistributedQueue();
+
+  void Enqueue(const std::string& item);
+
+  // items are committed in chunks of at most max_enqueue_batch() each.
+  void Enqueue(const std::vector<std::string>& items);
+
+  // Claim up to |max_items| from the head of the queue. The returned vector
+  // is empty if the queue is empty.
+  std::vector<std::string> Dequeue(size_t max_items = 1);
+
+  size_t max_enqueue_batch() const {
+    return max_enqueue_batch_;
+  }
+
+  void max_enqueue_batch(size_t value) {
+    max_enqueue_batch_ = value > 0 ? value : 1;
+  }
+
+  DistributedQueueStats stats() const;
+
+private:
+  // ZooWatcher callbacks
+  void OnConnected() override;
+  void OnConnecting() override;
+  void OnSessionExpired() override;
+
+  void OnCreated(const char* path) override;
+  void OnDeleted(const char* path) override;
+  void OnChanged(const char* path) override;
+  void OnChildChanged(const char* path) override;
+  void OnNotWatching(const char* path) override;
+
+private:
+  void EnsureSession();
+  void RefreshListing();
+
+  std::vector<std::string> ClaimItems(size_t max_items);
+
+private:
+  const std::string zookeeper_servers_;
+  const std::string queue_path_;
+
+  std::unique_ptr<zookeeper::ZooKeeper> zk_;
+  void ResetZooKeeperClient();
+
+  size_t max_enqueue_batch_ = 256;
+
+  bool queue_path_created_ = false;
+
+  std::mutex mutex_;
+
+  // sorted item names not claimed by this consumer yet, starting at
+  // listing_head_
+  std::vector<std::string> listing_;
+  size_t listing_head_ = 0;
+
+  // set by the child watch, the listing must be fetched again before
+  // concluding the queue is empty
+  std::atomic<bool> listing_changed_{true};
+
+  // set when most of a claimed batch was already taken by other consumers
+  bool listing_stale_ = false;
+
+  // window of batches ClaimItems picks from, grows while contended
+  size_t spread_ = 1;
+  std::mt19937 rng_;
+
+  std::atomic<uint64_t> enqueued_{0};
+  std::atomic<uint64_t> dequeued_{0};
+  std::atomic<uint64_t> conflicts_{0};
+  std::atomic<uint64_t> listings_{0};
+};
+
+} // namespace zookeeper
@@ -0,0 +1,151 @@
+#include <gtest/gtest.h>
+#include "distributed_queue.h"
+#include <zookeeper-cpp/zookeeper_unittest_helper.hpp>
+#include <chrono>
+#include <set>
+#include <thread>
+
+using namespace testing;
+using namespace zookeeper;
+
+TEST(DistributedQueue, EnqueueThenDequeue) {
+  DistributedQueue queue("127.0.0.1:2181", "/test_queue");
+  sleep(1);
+
+  queue.Enqueue("a");
+  queue.Enqueue(std::vector<std::string>{"b", "c", "d"});
+
+  EXPECT_EQ(queue.Dequeue(), std::vector<std::string>({"a"}));
+  EXPECT_EQ(queue.Dequeue(2), std::vector<std::string>({"b", "c"}));
+  EXPECT_EQ(queue.Dequeue(5), std::vector<std::string>({"d"}));
+  EXPECT_TRUE(queue.Dequeue(5).empty());
+
+  EXPECT_EQ(queue.stats().enqueued, 4u);
+  EXPECT_EQ(queue.stats().dequeued, 4u);
+}
+
+TEST(DistributedQueue, EnqueueInSeveralBatches) {
+  DistributedQueue queue("127.0.0.1:2181", "/test_queue");
+  sleep(1);
+
+  queue.max_enqueue_batch(3);
+  std::vector<std::string> items;
+  for (int i = 0; i < 10; ++i) {
+    items.push_back(std::to_string(i));
+  }
+  queue.Enqueue(items);
+
+  EXPECT_EQ(queue.Dequeue(20), items);
+}
+
+TEST(DistributedQueue, EmptyQueueDoesNotListAgain) {
+  DistributedQueue queue("127.0.0.1:2181", "/test_queue");
+  sleep(1);
+
+  EXPECT_TRUE(queue.Dequeue().empty());
+  auto listings = queue.stats().listings;
+
+  EXPECT_TRUE(queue.Dequeue().empty());
+  EXPECT_EQ(queue.stats().listings, listings);
+}
+
+TEST(DistributedQueue, ConcurrentConsumersThroughput) {
+  const int ITEM_COUNT = 4000;
+  const int CONSUMER_COUNT = 4;
+
+  DistributedQueue producer("127.0.0.1:2181", "/test_queue");
+  sleep(1);
+
+  std::vector<std::string> items;
+  for (int i = 0; i < ITEM_COUNT; ++i) {
+    items.push_back(std::to_string(i));
+  }
+  producer.Enqueue(items);
+
+  std::vector<std::unique_ptr<DistributedQueue>> consumers;
+  for (int i = 0; i < CONSUMER_COUNT; ++i) {
+    consumers.push_back(std::make_unique<DistributedQueue>("127.0.0.1:2181",
+                                                           "/test_queue"));
+  }
+  sleep(1);
+
+  std::vector<std::vector<std::string>> consumed(CONSUMER_COUNT);
+  auto start = std::chrono::steady_clock::now();
+
+  std::vector<std::thread> threads;
+  for (int i = 0; i < CONSUMER_COUNT; ++i) {
+    threads.emplace_back([&, i] {
+      while (true) {
+        auto batch = consumers[i]->Dequeue(32);
+        if (batch.empty()) break;
+        consumed[i].insert(consumed[i].end(), batch.begin(), batch.end());
+      }
+    });
+  }
+  for (auto& t : threads) t.join();
+
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+  std::set<std::string> all;
+  uint64_t conflicts = 0;
+  for (int i = 0; i < CONSUMER_COUNT; ++i) {
+    for (auto& item : consumed[i]) {
+      EXPECT_TRUE(all.insert(item).second) << "item consumed twice: " << item;
+    }
+    conflicts += consumers[i]->stats().conflicts;
+  }
+  EXPECT_EQ(all.size(), static_cast<size_t>(ITEM_COUNT));
+
+  printf("%d consumers: %.0f items/sec, %llu conflicts\n",
+         CONSUMER_COUNT, ITEM_COUNT / elapsed.count(),
+         static_cast<unsigned long long>(conflicts));
+}
+
+TEST(DistributedQueue, ContendedConsumersClaimDisjointBatches) {
+  const int ITEM_COUNT = 2000;
+  const int CONSUMER_COUNT = 4;
+
+  DistributedQueue producer("127.0.0.1:2181", "/test_queue");
+  sleep(1);
+
+  std::vector<std::string> items;
+  for (int i = 0; i < ITEM_COUNT; ++i) {
+    items.push_back(std::to_string(i));
+  }
+  producer.Enqueue(items);
+
+  std::vector<std::unique_ptr<DistributedQueue>> consumers;
+  for (int i = 0; i < CONSUMER_COUNT; ++i) {
+    consumers.push_back(std::make_unique<DistributedQueue>("127.0.0.1:2181",
+                                                           "/test_queue"));
+  }
+  sleep(1);
+
+  // all consumers list the queue before any of them claims
+  for (auto& consumer : consumers) {
+    ASSERT_EQ(consumer->Dequeue(1).size(), 1u);
+  }
+
+  std::vector<std::vector<std::string>> consumed(CONSUMER_COUNT);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < CONSUMER_COUNT; ++i) {
+    threads.emplace_back([&, i] {
+      while (true) {
+        auto batch = consumers[i]->Dequeue(16);
+        if (batch.empty()) break;
+        consumed[i].insert(consumed[i].end(), batch.begin(), batch.end());
+      }
+    });
+  }
+  for (auto& t : threads) t.join();
+
+  // the batches claimed at random offsets within the window are disjoint
+  // and together cover the queue
+  std::set<std::string> all;
+  for (int i = 0; i < CONSUMER_COUNT; ++i) {
+    for (auto& item : consumed[i]) {
+      EXPECT_TRUE(all.insert(item).second) << "item consumed twice: " << item;
+    }
+  }
+  EXPECT_EQ(all.size() + CONSUMER_COUNT, static_cast<size_t>(ITEM_COUNT));
+}
@@ -0,0 +1,182 @@
+#pragma once
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <zookeeper-cpp/zookeeper_error.hpp>
+
+namespace zookeeper {
+
+// TCP proxy standing in for a local ZooKeeper server, injecting network
+// faults into the sessions connected through it. For tests only.
+class FaultProxy {
+public:
+  explicit FaultProxy(int server_port = 2181)
+  : server_port_(server_port) {
+    listen_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_fd_ < 0) {
+      throw ZooSystemErrorFromErrno(errno);
+    }
+
+    sockaddr_in addr = Loopback(0);
+    socklen_t addr_len = sizeof(addr);
+    if (bind(listen_fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0
+        || listen(listen_fd_, 16) != 0
+        || getsockname(listen_fd_, reinterpret_cast<sockaddr*>(&addr), &addr_len) != 0) {
+      auto error = errno;
+      close(listen_fd_);
+      throw ZooSystemErrorFromErrno(error);
+    }
+    port_ = ntohs(addr.sin_port);
+
+    accept_thread_ = std::thread([this] { AcceptLoop(); });
+  }
+
+  ~FaultProxy() {
+    stopped_ = true;
+    accept_thread_.join();
+    Disconnect();
+    close(listen_fd_);
+  }
+
+  // disable copy
+  FaultProxy(const FaultProxy&) = delete;
+  FaultProxy& operator=(const FaultProxy&) = delete;
+
+  // host list to give the clients instead of the server's
+  std::string address() const {
+    return "127.0.0.1:" + std::to_string(port_);
+  }
+
+  // Close the connections, as a restarted server would. Clients notice
+  // at once and reconnect.
+  void Disconnect() {
+    std::vector<std::unique_ptr<Connection>> connections;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      connections.swap(connections_);
+    }
+    for (auto& connection : connections) {
+      shutdown(connection->client_fd, SHUT_RDWR);
+      shutdown(connection->server_fd, SHUT_RDWR);
+      connection->upstream.join();
+      connection->downstream.join();
+      close(connection->client_fd);
+      close(connection->server_fd);
+    }
+  }
+
+  // Silently drop all traffic, as a crashed host or a network partition
+  // would; clients and server only notice through their timeouts. Healing
+  // closes the connections, whose streams lost data.
+  void Partition(bool partitioned) {
+    partitioned_ = partitioned;
+    if (!partitioned) Disconnect();
+  }
+
+  // delay every forwarded chunk, in both directions
+  void set_delay(std::chrono::milliseconds delay) {
+    delay_ms_ = delay.count();
+  }
+
+private:
+  struct Connection {
+    int client_fd;
+    int server_fd;
+    std::thread upstream;
+    std::thread downstream;
+  };
+
+  static sockaddr_in Loopback(int port) {
+    sockaddr_in addr = sockaddr_in();
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    return addr;
+  }
+
+  void AcceptLoop() {
+    while (!stopped_) {
+      pollfd listening = {listen_fd_, POLLIN, 0};
+      if (poll(&listening, 1, 50) <= 0) continue;
+
+      auto client_fd = accept(listen_fd_, nullptr, nullptr);
+      if (client_fd < 0) continue;
+
+      auto server_fd = socket(AF_INET, SOCK_STREAM, 0);
+      sockaddr_in server = Loopback(server_port_);
+      if (server_fd < 0
+          || connect(server_fd, reinterpret_cast<sockaddr*>(&server), sizeof(server)) != 0) {
+        if (server_fd >= 0) close(server_fd);
+        close(client_fd);
+        continue;
+      }
+
+      std::unique_ptr<Connection> connection(new Connection);
+      connection->client_fd = client_fd;
+      connection->server_fd = server_fd;
+      connection->upstream = std::thread([this, client_fd, server_fd] {
+        Pump(client_fd, server_fd);
+      });
+      connection->downstream = std::thread([this, client_fd, server_fd] {
+        Pump(server_fd, client_fd);
+      });
+
+      std::lock_guard<std::mutex> lock(mutex_);
+      connections_.push_back(std::move(connection));
+    }
+  }
+
+  void Pump(int from, int to) {
+    char buffer[16 * 1024];
+    while (true) {
+      auto received = recv(from, buffer, sizeof(buffer), 0);
+      if (received <= 0) break;
+      if (partitioned_) continue;
+
+      auto delay = delay_ms_.load();
+      if (delay > 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(delay));
+      }
+
+      for (ssize_t sent = 0; sent < received; ) {
+        auto n = send(to, buffer + sent, received - sent, MSG_NOSIGNAL);
+        if (n <= 0) {
+          received = -1;
+          break;
+        }
+        sent += n;
+      }
+      if (received < 0) break;
+    }
+
+    // closing one direction ends the other
+    shutdown(from, SHUT_RDWR);
+    shutdown(to, SHUT_RDWR);
+  }
+
+  const int server_port_;
+  int listen_fd_ = -1;
+  int port_ = 0;
+
+  std::atomic<bool> stopped_{false};
+  std::atomic<bool> partitioned_{false};
+  std::atomic<int64_t> delay_ms_{0};
+
+  std::mutex mutex_;
+  std::vector<std::unique_ptr<Connection>> connections_;
+
+  std::thread accept_thread_;
+};
+
+} // namespace zookeeper
@@ -1,10 +1,14 @@
 #include "leader_elector.h"
 #include <zookeeper-cpp/zookeeper_ext.hpp>
+#include <zookeeper-cpp/zookeeper_log.hpp>
+#include <zookeeper-cpp/zookeeper_trace.hpp>
+#include <experimental/timer>
 #include <thread>
 #include <chrono>
 #include <algorithm>
 
 using std::experimental::post;
+using std::experimental::post_after;
 using namespace zookeeper;
 
 LeaderElector::LeaderElector(const std::string& zookeeper_servers,
@@ -12,6 +16,7 @@ LeaderElector::LeaderElector(const std::string& zookeeper_servers,
                              LeaderElectorHandler * handler)
 : zookeeper_servers_(zookeeper_servers),
   election_path_(election_path),
+  election_node_prefix_(ZPath(election_path).Child("proc_")),
   leadership_handler_(handler),
   executor_(std::experimental::system_executor()) {
   assert(leadership_handler_);
@@ -46,16 +51,24 @@ void LeaderElector::RefreshLater() {
   post(executor_, [this](){ this->Refresh(); });
 }
 
+void LeaderElector::RefreshLater(std::chrono::milliseconds delay) {
+  // a timer, rather than a pool thread sleeping through the backoff
+  post_after(executor_, delay, [this](){ this->Refresh(); });
+}
+
 void LeaderElector::Refresh() {
-  printf("Refresh\n");
+  Log(LOG_LEVEL_DEBUG, "leader_elector", "refresh {}", election_path_);
   if (zk_->is_connected()) {
     // new session or reestablished connection
     if (is_elector_) {
       try {
         EnterElection();
+        refresh_backoff_.Reset();
       } catch(...) {
-        printf("EnterElection failed, try again later\n");
-        RefreshLater();
+        auto delay = refresh_backoff_.Next();
+        Log(LOG_LEVEL_WARN, "leader_elector", "enter election {} failed, try again in {} ms",
+            election_path_, delay.count());
+        RefreshLater(delay);
       }
     } else {
       // exit election should not fail
@@ -77,21 +90,23 @@ void LeaderElector::Refresh() {
 }
 
 void LeaderElector::EnterElection() {
-  printf("EnterElection\n");
+  ScopedSpan span("EnterElection", election_path_);
+  Log(LOG_LEVEL_DEBUG, "leader_elector", "enter election {}", election_path_);
   // create election directory
   RecursiveCreate(*zk_, election_path_);
 
   if (!election_sequence_node_.empty()
       && !zk_->Exists(election_sequence_node_)) {
-    // TODO: LOG election node deleted unexpectedlly
+    Log(LOG_LEVEL_WARN, "leader_elector", "election node {} deleted unexpectedly",
+        election_sequence_node_);
     election_sequence_node_.clear();
   }
 
   if (election_sequence_node_.empty()) {
     // TODO: what if sequence node is create, and node name isn't returned
-    election_sequence_node_ = zk_->Create(election_path_ + "/proc_",
+    election_sequence_node_ = zk_->Create(election_node_prefix_,
                                           "", ZOO_SEQUENCE | ZOO_EPHEMERAL);
-    printf("I'm %s\n", election_sequence_node_.c_str());
+    Log(LOG_LEVEL_INFO, "leader_elector", "joined election as {}", election_sequence_node_);
   }
 
   // watch for election node
@@ -111,7 +126,7 @@ void LeaderElector::ExitElection() {
   try {
     zk_->DeleteIfExists(election_sequence_node_);
   } catch (std::exception &e) {
-    printf("can't exit election gracefully, %s", e.what());
+    Log(LOG_LEVEL_WARN, "leader_elector", "can't exit election gracefully, {}", e.what());
     ResetZooKeeperClient();
   }
 
@@ -121,11 +136,13 @@ void LeaderElector::ExitElection() {
 }
 
 void LeaderElector::OnElectionChanged() {
-  printf("OnElectionChanged\n");
+  Log(LOG_LEVEL_DEBUG, "leader_elector", "election {} changed", election_path_);
   if (!is_elector_ || election_sequence_node_.empty()) {
     return;
   }
 
+  ScopedSpan span("ElectionRound", election_path_);
+
   // fetch all election nodes and watch for changes
   auto procs = zk_->GetChildren(election_path_, true);
   std::sort(std::begin(procs), std::end(procs));
@@ -147,14 +164,14 @@ void LeaderElector::OnElectionChanged() {
 
 void LeaderElector::TakeLeadershipImpl() {
   assert(is_elector_ && !is_leader());
-  printf("I'm leader now\n");
+  Log(LOG_LEVEL_INFO, "leader_elector", "{} takes leadership", election_sequence_node_);
   is_leader(true);
   leadership_handler_->TakeLeadership();
 }
 
 void LeaderElector::RevokeLeadershipImpl() {
   assert(is_elector_ && is_leader());
-  printf("My leadership is revoked\n");
+  Log(LOG_LEVEL_INFO, "leader_elector", "{} leadership revoked", election_sequence_node_);
   is_leader(false);
   if (is_elector_) {
     leadership_handler_->RevokeLeadership();
@@ -163,22 +180,22 @@ void LeaderElector::RevokeLeadershipImpl() {
 
 void LeaderElector::LeadershipChangedImpl(const std::string& leader_data) {
   assert(is_elector_);
-  printf("I'm follower, following %s\n", leader_data.c_str());
+  Log(LOG_LEVEL_INFO, "leader_elector", "{} follows {}", election_sequence_node_, leader_data);
   leadership_handler_->LeadershipChanged(leader_data);
 }
 
 void LeaderElector::OnConnected() {
-  printf("OnConnected\n");
+  Log(LOG_LEVEL_DEBUG, "leader_elector", "connected");
   RefreshLater();
 }
 
 void LeaderElector::OnConnecting() {
-  printf("OnConnecting\n");
+  Log(LOG_LEVEL_DEBUG, "leader_elector", "connecting");
   RefreshLater();
 }
 
 void LeaderElector::OnSessionExpired() {
-  printf("Session Expired\n");
+  Log(LOG_LEVEL_WARN, "leader_elector", "session expired");
 }
 
 void LeaderElector::OnChildChanged(const char* path) {
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <zookeeper-cpp/zookeeper.hpp>
+#include <zookeeper-cpp/zookeeper_retry.hpp>
 #include <experimental/executor>
 
 namespace zookeeper {
@@ -51,6 +52,7 @@ private:
   //
   void Refresh();
   void RefreshLater();
+  void RefreshLater(std::chrono::milliseconds delay);
 
   void EnterElection();
   void ExitElection();
@@ -66,6 +68,8 @@ private:
 private:
   const std::string zookeeper_servers_;
   const std::string election_path_;
+  // sequence node prefix of the electors
+  const zookeeper::ZPath election_node_prefix_;
 
   LeaderElectorHandler * const leadership_handler_;
 
@@ -76,6 +80,9 @@ private:
 
   bool is_elector_ = false;
 
+  // delays retries of a failed election entry
+  zookeeper::Backoff refresh_backoff_;
+
   std::string election_sequence_node_;
 };
 
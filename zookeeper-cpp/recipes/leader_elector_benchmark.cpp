@@ -0,0 +1,259 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "leader_elector.h"
+#include "fault_proxy.h"
+
+using namespace testing;
+using namespace zookeeper;
+
+// Failover benchmark of LeaderElector against the local server. Every
+// candidate connects through its own FaultProxy, faults are injected on the
+// leader's and the leadership moves are timed. It takes a few minutes, run
+// it with --gtest_also_run_disabled_tests.
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+using std::chrono::milliseconds;
+
+const int CANDIDATES = 5;
+const int TRIALS = 10;
+const char ELECTION_PATH[] = "/test_failover";
+// how long a step may take before the trial is given up
+const milliseconds STEP_TIMEOUT(30 * 1000);
+
+enum LeadershipEvent { TAKEN, REVOKED, FOLLOWING };
+
+class Timeline {
+public:
+  struct Entry {
+    int candidate;
+    LeadershipEvent event;
+    Clock::time_point time;
+  };
+
+  void Record(int candidate, LeadershipEvent event) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_.push_back(Entry{candidate, event, Clock::now()});
+    changed_.notify_all();
+  }
+
+  // Wait for the first entry after |since| matching |match|. Returns false
+  // on timeout.
+  bool WaitFor(Clock::time_point since,
+               const std::function<bool(const Entry&)>& match,
+               milliseconds timeout,
+               Entry* found) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    return changed_.wait_for(lock, timeout, [&] {
+      for (auto& entry : entries_) {
+        if (entry.time >= since && match(entry)) {
+          *found = entry;
+          return true;
+        }
+      }
+      return false;
+    });
+  }
+
+  // candidate whose last taken leadership wasn't revoked, -1 if none
+  int leader() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    int leader = -1;
+    for (auto& entry : entries_) {
+      if (entry.event == TAKEN) {
+        leader = entry.candidate;
+      } else if (entry.event == REVOKED && entry.candidate == leader) {
+        leader = -1;
+      }
+    }
+    return leader;
+  }
+
+private:
+  std::mutex mutex_;
+  std::condition_variable changed_;
+  std::vector<Entry> entries_;
+};
+
+class Candidate : public LeaderElectorHandler {
+public:
+  Candidate(int id, Timeline& timeline)
+  : id_(id),
+    timeline_(timeline),
+    elector_(proxy.address(), ELECTION_PATH, this) {
+    elector_.Join();
+  }
+
+  void TakeLeadership() override {
+    timeline_.Record(id_, TAKEN);
+  }
+
+  void RevokeLeadership() override {
+    timeline_.Record(id_, REVOKED);
+  }
+
+  void LeadershipChanged(const std::string&) override {
+    timeline_.Record(id_, FOLLOWING);
+  }
+
+  FaultProxy proxy;
+
+private:
+  const int id_;
+  Timeline& timeline_;
+  LeaderElector elector_;
+};
+
+struct Samples {
+  std::vector<double> millis;
+
+  void Add(Clock::duration elapsed) {
+    millis.push_back(std::chrono::duration<double, std::milli>(elapsed).count());
+  }
+
+  void Print(const char* scenario, const char* metric) {
+    if (millis.empty()) {
+      printf("%-24s %-16s no samples\n", scenario, metric);
+      return;
+    }
+    std::sort(millis.begin(), millis.end());
+    auto at = [this](double p) {
+      return millis[static_cast<size_t>(p * (millis.size() - 1) + 0.5)];
+    };
+    printf("%-24s %-16s p50 %7.1f ms  p90 %7.1f ms  p99 %7.1f ms  max %7.1f ms  n=%d\n",
+           scenario, metric, at(0.5), at(0.9), at(0.99), millis.back(),
+           static_cast<int>(millis.size()));
+  }
+};
+
+struct FailoverSamples {
+  Samples revoke;
+  Samples new_leader;
+  // new leader taking over before the old one revoked
+  Samples dual_leader;
+  // old leader following again once reachable
+  Samples rejoin;
+  int kept_leadership = 0;
+
+  void Print(const char* scenario) {
+    revoke.Print(scenario, "time-to-revoke");
+    new_leader.Print(scenario, "time-to-leader");
+    dual_leader.Print(scenario, "dual-leader");
+    rejoin.Print(scenario, "time-to-rejoin");
+    if (kept_leadership) {
+      printf("%-24s leadership kept through %d of %d faults\n",
+             scenario, kept_leadership, TRIALS);
+    }
+  }
+};
+
+class LeaderElectorFailover : public ::testing::Test {
+protected:
+  LeaderElectorFailover() {
+    for (int i = 0; i < CANDIDATES; ++i) {
+      candidates_.emplace_back(new Candidate(i, timeline_));
+    }
+  }
+
+  int WaitForLeader() {
+    auto deadline = Clock::now() + STEP_TIMEOUT;
+    while (Clock::now() < deadline) {
+      auto leader = timeline_.leader();
+      if (leader >= 0) return leader;
+      std::this_thread::sleep_for(milliseconds(10));
+    }
+    return -1;
+  }
+
+  // Drop the leader's connections, which it reconnects at once.
+  void Disconnect(FailoverSamples* samples) {
+    auto leader = WaitForLeader();
+    ASSERT_GE(leader, 0);
+
+    auto start = Clock::now();
+    candidates_[leader]->proxy.Disconnect();
+
+    Timeline::Entry revoked, taken;
+    if (!timeline_.WaitFor(start, [leader](const Timeline::Entry& entry) {
+          return entry.candidate == leader && entry.event == REVOKED;
+        }, milliseconds(2000), &revoked)) {
+      // reconnected before the elector saw the disconnection
+      ++samples->kept_leadership;
+      return;
+    }
+    samples->revoke.Add(revoked.time - start);
+
+    ASSERT_TRUE(timeline_.WaitFor(start, [](const Timeline::Entry& entry) {
+      return entry.event == TAKEN;
+    }, STEP_TIMEOUT, &taken));
+    samples->new_leader.Add(taken.time - start);
+  }
+
+  // Black hole the leader until its session expires and another candidate
+  // leads, as if its host crashed, then let it come back.
+  void Crash(FailoverSamples* samples) {
+    auto leader = WaitForLeader();
+    ASSERT_GE(leader, 0);
+
+    auto start = Clock::now();
+    candidates_[leader]->proxy.Partition(true);
+
+    Timeline::Entry revoked, taken, following;
+    ASSERT_TRUE(timeline_.WaitFor(start, [leader](const Timeline::Entry& entry) {
+      return entry.candidate != leader && entry.event == TAKEN;
+    }, STEP_TIMEOUT, &taken));
+    ASSERT_TRUE(timeline_.WaitFor(start, [leader](const Timeline::Entry& entry) {
+      return entry.candidate == leader && entry.event == REVOKED;
+    }, STEP_TIMEOUT, &revoked));
+    samples->revoke.Add(revoked.time - start);
+    samples->new_leader.Add(taken.time - start);
+    samples->dual_leader.Add(std::max(Clock::duration::zero(), revoked.time - taken.time));
+
+    auto healed = Clock::now();
+    candidates_[leader]->proxy.Partition(false);
+    ASSERT_TRUE(timeline_.WaitFor(healed, [leader](const Timeline::Entry& entry) {
+      return entry.candidate == leader && entry.event == FOLLOWING;
+    }, STEP_TIMEOUT, &following));
+    samples->rejoin.Add(following.time - healed);
+  }
+
+  void set_delay(milliseconds delay) {
+    for (auto& candidate : candidates_) {
+      candidate->proxy.set_delay(delay);
+    }
+  }
+
+  Timeline timeline_;
+  std::vector<std::unique_ptr<Candidate>> candidates_;
+};
+
+}
+
+TEST_F(LeaderElectorFailover, DISABLED_Benchmark) {
+  FailoverSamples disconnect;
+  for (int i = 0; i < TRIALS; ++i) {
+    Disconnect(&disconnect);
+  }
+  disconnect.Print("disconnect");
+
+  FailoverSamples crash;
+  for (int i = 0; i < TRIALS; ++i) {
+    Crash(&crash);
+  }
+  crash.Print("crash");
+
+  set_delay(milliseconds(100));
+  FailoverSamples delayed_crash;
+  for (int i = 0; i < TRIALS; ++i) {
+    Crash(&delayed_crash);
+  }
+  delayed_crash.Print("crash, 100ms delay");
+}
@@ -0,0 +1,230 @@
+#include "partition_assigner.h"
+#include <zookeeper-cpp/zookeeper_error.hpp>
+#include <zookeeper-cpp/zookeeper_ext.hpp>
+#include <zookeeper-cpp/zookeeper_log.hpp>
+#include <zookeeper-cpp/zookeeper_trace.hpp>
+#include <algorithm>
+#include <cassert>
+#include <iterator>
+
+using std::experimental::post;
+using namespace zookeeper;
+
+namespace {
+
+const std::shared_ptr<const Partitions> EMPTY_PARTITIONS =
+    std::make_shared<const Partitions>();
+
+// splitmix64 finalizer
+uint64_t Mix(uint64_t x) {
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+  return x;
+}
+
+// FNV-1a, stable across processes unlike std::hash
+uint64_t HashName(const std::string& name) {
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (auto c : name) {
+    hash ^= static_cast<uint8_t>(c);
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+}
+
+namespace zookeeper {
+
+Partitions AssignPartitions(const std::vector<std::string>& members,
+                            const std::string& member,
+                            int partition_count) {
+  Partitions partitions;
+  if (std::find(members.begin(), members.end(), member) == members.end()) {
+    return partitions;
+  }
+
+  std::vector<uint64_t> seeds;
+  seeds.reserve(members.size());
+  for (auto& name : members) {
+    seeds.push_back(HashName(name));
+  }
+  auto own_seed = HashName(member);
+
+  for (int partition = 0; partition < partition_count; ++partition) {
+    auto key = Mix(static_cast<uint64_t>(partition));
+    auto own_score = Mix(own_seed ^ key);
+
+    bool wins = true;
+    for (size_t i = 0; i < members.size() && wins; ++i) {
+      auto score = Mix(seeds[i] ^ key);
+      // ties go to the smaller name, the same way on every member
+      wins = score < own_score || (score == own_score && members[i] >= member);
+    }
+    if (wins) partitions.push_back(partition);
+  }
+  return partitions;
+}
+
+}
+
+PartitionAssigner::PartitionAssigner(const std::string& zookeeper_servers,
+                                     const std::string& group_path,
+                                     const std::string& name,
+                                     int partition_count,
+                                     PartitionAssignmentHandler* handler)
+: zookeeper_servers_(zookeeper_servers),
+  group_path_(group_path),
+  name_(name),
+  partition_count_(partition_count),
+  handler_(handler),
+  executor_(std::experimental::system_executor()),
+  assignment_(EMPTY_PARTITIONS) {
+  assert(handler_);
+  // a refresh posted by an early connected event must see zk_
+  std::lock_guard<std::mutex> lock(mutex_);
+  zk_ = std::make_unique<ZooKeeper>(zookeeper_servers_, this);
+}
+
+PartitionAssigner::~PartitionAssigner() {
+  // queued refreshes are skipped, the handler isn't called any more
+  tasks_.Close();
+  // close the session now, so the others take over at once
+  std::lock_guard<std::mutex> lock(mutex_);
+  zk_.reset();
+}
+
+void PartitionAssigner::ResetZooKeeperClient() {
+  zk_ = std::make_unique<ZooKeeper>(zookeeper_servers_, this);
+}
+
+std::string PartitionAssigner::MemberPath() const {
+  return group_path_ + '/' + name_;
+}
+
+void PartitionAssigner::Join() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  is_member_ = true;
+  RefreshLater();
+}
+
+void PartitionAssigner::Leave() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  is_member_ = false;
+  RefreshLater();
+  // released at once, even if the node can't be deleted yet
+  Rebalance(lock, {});
+}
+
+std::shared_ptr<const Partitions> PartitionAssigner::Assignment() const {
+  return std::atomic_load(&assignment_);
+}
+
+RebalanceStats PartitionAssigner::last_rebalance() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return last_rebalance_;
+}
+
+void PartitionAssigner::RefreshLater() {
+  post(executor_, tasks_.Wrap([this](){ this->Refresh(); }));
+}
+
+void PartitionAssigner::Refresh() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (!zk_) return;
+
+  if (zk_->is_expired()) {
+    ResetZooKeeperClient();
+    // the member node is gone with the session, others own our partitions
+    Rebalance(lock, {});
+    return;
+  }
+
+  if (!zk_->is_connected()) {
+    return;
+  }
+
+  try {
+    ScopedSpan span("RefreshPartitions", group_path_);
+    RecursiveCreate(*zk_, group_path_);
+    if (is_member_) {
+      // a node left by the expired session is deleted later, its child
+      // watch brings us here again to create ours
+      zk_->CreateIfNotExists(MemberPath(), "", ZOO_EPHEMERAL);
+    } else {
+      zk_->DeleteIfExists(MemberPath());
+    }
+    Rebalance(lock, zk_->GetChildren(group_path_, true));
+  } catch (std::exception& e) {
+    // refreshed again on the next connection
+    Log(LOG_LEVEL_WARN, "partition_assigner", "refresh partition assignment failed, {}", e.what());
+  }
+}
+
+void PartitionAssigner::Rebalance(std::unique_lock<std::mutex>& lock,
+                                  const std::vector<std::string>& members) {
+  auto start = std::chrono::steady_clock::now();
+
+  Partitions next;
+  if (is_member_) {
+    next = AssignPartitions(members, name_, partition_count_);
+  }
+
+  auto current = std::atomic_load(&assignment_);
+  Partitions acquired, released;
+  std::set_difference(next.begin(), next.end(), current->begin(), current->end(),
+                      std::back_inserter(acquired));
+  std::set_difference(current->begin(), current->end(), next.begin(), next.end(),
+                      std::back_inserter(released));
+
+  last_rebalance_.members = members.size();
+  last_rebalance_.acquired = acquired.size();
+  last_rebalance_.released = released.size();
+  last_rebalance_.compute_time = std::chrono::steady_clock::now() - start;
+
+  if (acquired.empty() && released.empty()) {
+    return;
+  }
+
+  std::atomic_store(&assignment_,
+                    std::make_shared<const Partitions>(std::move(next)));
+
+  pending_changes_.emplace_back(std::move(acquired), std::move(released));
+  if (delivering_) {
+    // another call delivers it, maybe the handler's own Leave()
+    return;
+  }
+
+  delivering_ = true;
+  while (!pending_changes_.empty()) {
+    auto change = std::move(pending_changes_.front());
+    pending_changes_.pop_front();
+    lock.unlock();
+    handler_->AssignmentChanged(change.first, change.second);
+    lock.lock();
+  }
+  delivering_ = false;
+}
+
+void PartitionAssigner::OnChildChanged(const char* path) {
+  if (path == group_path_) {
+    RefreshLater();
+  }
+}
+
+void PartitionAssigner::OnConnected() {
+  RefreshLater();
+}
+
+void PartitionAssigner::OnSessionExpired() {
+  RefreshLater();
+}
+
+void PartitionAssigner::OnConnecting() {}
+void PartitionAssigner::OnCreated(const char* path) {}
+void PartitionAssigner::OnDeleted(const char* path) {}
+void PartitionAssigner::OnChanged(const char* path) {}
+void PartitionAssigner::OnNotWatching(const char* path) {}
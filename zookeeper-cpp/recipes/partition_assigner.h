@@ -0,0 +1,128 @@
+#pragma once
+
+#include "task_guard.h"
+#include <zookeeper-cpp/zookeeper.hpp>
+#include <experimental/executor>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace zookeeper {
+
+// sorted partition numbers
+typedef std::vector<int> Partitions;
+
+// Partitions of |member| among |members| by rendezvous hashing: each
+// partition goes to the member scoring highest for it. A member joining
+// only takes partitions from the others, a member leaving only gives its
+// own away; no other partition changes hands.
+Partitions AssignPartitions(const std::vector<std::string>& members,
+                            const std::string& member,
+                            int partition_count);
+
+class PartitionAssignmentHandler {
+public:
+  // Called after every membership change moving partitions of this member,
+  // one change at a time and in order, without the assigner's lock: it may
+  // call back into the assigner, Leave() included.
+  virtual void AssignmentChanged(const Partitions& acquired,
+                                 const Partitions& released) = 0;
+
+protected:
+  ~PartitionAssignmentHandler() = default;
+};
+
+struct RebalanceStats {
+  size_t members = 0;
+  size_t acquired = 0;
+  size_t released = 0;
+  // computing the new assignment, excluding the membership read
+  std::chrono::nanoseconds compute_time{0};
+};
+
+// Spreads |partition_count| partitions over the members of a group, each
+// member being an ephemeral node group_path/name. There is no coordinator:
+// every member watches the group's children and derives its own partitions
+// locally with AssignPartitions, so a change costs a child watch and a
+// GetChildren per member.
+//
+// Members seeing different membership for a moment may both own a moving
+// partition; partitions are kept while disconnected, and all released once
+// the session expires.
+class PartitionAssigner : public zookeeper::ZooWatcher {
+public:
+  PartitionAssigner(const std::string& zookeeper_servers,
+                    const std::string& group_path,
+                    const std::string& name,
+                    int partition_count,
+                    PartitionAssignmentHandler* handler);
+
+  ~PartitionAssigner();
+
+  void Join();
+
+  void Leave();
+
+  // partitions owned now, served without locking
+  std::shared_ptr<const Partitions> Assignment() const;
+
+  RebalanceStats last_rebalance() const;
+
+private:
+  // ZooWatcher callbacks
+  void OnConnected() override;
+  void OnConnecting() override;
+  void OnSessionExpired() override;
+
+  void OnCreated(const char* path) override;
+  void OnDeleted(const char* path) override;
+  void OnChanged(const char* path) override;
+  void OnChildChanged(const char* path) override;
+  void OnNotWatching(const char* path) override;
+
+private:
+  void Refresh();
+  void RefreshLater();
+
+  // Update the assignment under mutex_, held by |lock|, and tell the
+  // handler what moved with it unlocked meanwhile.
+  void Rebalance(std::unique_lock<std::mutex>& lock,
+                 const std::vector<std::string>& members);
+
+  std::string MemberPath() const;
+
+private:
+  const std::string zookeeper_servers_;
+  const std::string group_path_;
+  const std::string name_;
+  const int partition_count_;
+
+  PartitionAssignmentHandler * const handler_;
+
+  // guards zk_ and everything below, never taken by Assignment()
+  mutable std::mutex mutex_;
+
+  std::unique_ptr<zookeeper::ZooKeeper> zk_;
+  void ResetZooKeeperClient();
+
+  std::experimental::executor executor_;
+  // every task posted to executor_ is wrapped by it
+  TaskGuard tasks_;
+
+  bool is_member_ = false;
+
+  // accessed through std::atomic_load/std::atomic_store only
+  std::shared_ptr<const Partitions> assignment_;
+
+  RebalanceStats last_rebalance_;
+
+  // (acquired, released) not told to the handler yet; drained in order by
+  // the one thread delivering, the others only queue theirs
+  std::deque<std::pair<Partitions, Partitions>> pending_changes_;
+  bool delivering_ = false;
+};
+
+} // namespace zookeeper
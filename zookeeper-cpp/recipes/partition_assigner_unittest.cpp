@@ -0,0 +1,160 @@
+#include <gtest/gtest.h>
+#include "partition_assigner.h"
+#include <zookeeper-cpp/zookeeper_unittest_helper.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+
+using namespace testing;
+using namespace zookeeper;
+
+static std::vector<std::string> MemberNames(int count) {
+  std::vector<std::string> members;
+  for (int i = 0; i < count; ++i) {
+    members.push_back("member-" + std::to_string(i));
+  }
+  return members;
+}
+
+// member => partitions
+static std::map<std::string, Partitions> AssignAll(const std::vector<std::string>& members,
+                                                   int partition_count) {
+  std::map<std::string, Partitions> assignment;
+  for (auto& member : members) {
+    assignment[member] = AssignPartitions(members, member, partition_count);
+  }
+  return assignment;
+}
+
+TEST(PartitionAssigner, AssignEveryPartitionOnce) {
+  const int partition_count = 10000;
+  auto members = MemberNames(10);
+  auto assignment = AssignAll(members, partition_count);
+
+  std::vector<int> owners(partition_count, 0);
+  for (auto& member : assignment) {
+    // roughly even, the average is 1000
+    EXPECT_GT(member.second.size(), 800u);
+    EXPECT_LT(member.second.size(), 1200u);
+    EXPECT_TRUE(std::is_sorted(member.second.begin(), member.second.end()));
+    for (auto partition : member.second) ++owners[partition];
+  }
+  EXPECT_EQ(std::count(owners.begin(), owners.end(), 1), partition_count);
+
+  EXPECT_TRUE(AssignPartitions(members, "stranger", partition_count).empty());
+}
+
+TEST(PartitionAssigner, OnlyNecessaryPartitionsMove) {
+  const int partition_count = 10000;
+  auto members = MemberNames(10);
+  auto before = AssignAll(members, partition_count);
+
+  // a joining member only takes partitions from the others
+  members.push_back("member-new");
+  auto joined = AssignAll(members, partition_count);
+  size_t taken = 0;
+  for (auto& member : before) {
+    auto& now = joined[member.first];
+    EXPECT_TRUE(std::includes(member.second.begin(), member.second.end(),
+                              now.begin(), now.end()));
+    taken += member.second.size() - now.size();
+  }
+  EXPECT_EQ(taken, joined["member-new"].size());
+
+  // a leaving member only gives its own away
+  members.erase(members.begin());
+  auto left = AssignAll(members, partition_count);
+  for (auto& member : left) {
+    auto& was = joined[member.first];
+    EXPECT_TRUE(std::includes(member.second.begin(), member.second.end(),
+                              was.begin(), was.end()));
+  }
+}
+
+TEST(PartitionAssigner, RebalanceTimeByGroupSize) {
+  const int partition_count = 10000;
+  for (int size : {2, 8, 32, 128, 512}) {
+    auto members = MemberNames(size);
+    auto start = std::chrono::steady_clock::now();
+    auto partitions = AssignPartitions(members, members[0], partition_count);
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    printf("%d partitions over %d members: own share %d in %.3f ms\n",
+           partition_count, size, static_cast<int>(partitions.size()),
+           std::chrono::duration<double, std::milli>(elapsed).count());
+  }
+}
+
+struct AssignmentLog : PartitionAssignmentHandler {
+  std::mutex mutex;
+  int changes = 0;
+  size_t acquired = 0;
+  size_t released = 0;
+
+  void AssignmentChanged(const Partitions& acquired_partitions,
+                         const Partitions& released_partitions) override {
+    std::lock_guard<std::mutex> lock(mutex);
+    ++changes;
+    acquired += acquired_partitions.size();
+    released += released_partitions.size();
+  }
+};
+
+TEST(PartitionAssigner, MembersSharePartitions) {
+  const int partition_count = 1000;
+  AssignmentLog log1, log2;
+
+  PartitionAssigner member1("127.0.0.1:2181", "/test_partitions", "member1",
+                            partition_count, &log1);
+  member1.Join();
+  sleep(1);
+  EXPECT_EQ(member1.Assignment()->size(), 1000u);
+
+  {
+    PartitionAssigner member2("127.0.0.1:2181", "/test_partitions", "member2",
+                              partition_count, &log2);
+    member2.Join();
+    sleep(1);
+
+    auto owned1 = member1.Assignment();
+    auto owned2 = member2.Assignment();
+    EXPECT_EQ(owned1->size() + owned2->size(), 1000u);
+    {
+      std::lock_guard<std::mutex> lock(log1.mutex);
+      EXPECT_EQ(log1.released, owned2->size());
+    }
+    EXPECT_EQ(member2.last_rebalance().members, 2u);
+
+    member2.Leave();
+    sleep(1);
+    EXPECT_TRUE(member2.Assignment()->empty());
+  }
+
+  EXPECT_EQ(member1.Assignment()->size(), 1000u);
+  std::lock_guard<std::mutex> lock(log1.mutex);
+  EXPECT_EQ(log1.acquired, 1000u + log1.released);
+}
+
+struct LeavingHandler : PartitionAssignmentHandler {
+  PartitionAssigner* assigner = nullptr;
+  std::atomic<int> changes{0};
+
+  void AssignmentChanged(const Partitions&, const Partitions&) override {
+    // calling back into the assigner doesn't deadlock
+    assigner->last_rebalance();
+    if (++changes == 1) assigner->Leave();
+  }
+};
+
+TEST(PartitionAssigner, HandlerCallsBack) {
+  LeavingHandler handler;
+  PartitionAssigner member("127.0.0.1:2181", "/test_partitions", "member1",
+                           100, &handler);
+  handler.assigner = &member;
+  member.Join();
+  sleep(1);
+
+  // the partitions acquired, then released by the Leave() in the handler
+  EXPECT_EQ(handler.changes, 2);
+  EXPECT_TRUE(member.Assignment()->empty());
+}
@@ -0,0 +1,334 @@
+#include "service_discovery.h"
+#include <zookeeper-cpp/zookeeper_error.hpp>
+#include <zookeeper-cpp/zookeeper_ext.hpp>
+#include <zookeeper-cpp/zookeeper_log.hpp>
+#include <algorithm>
+#include <cstring>
+
+using std::experimental::post;
+using namespace zookeeper;
+
+namespace {
+
+const std::shared_ptr<const ServiceInstances> EMPTY_INSTANCES =
+    std::make_shared<const ServiceInstances>();
+
+bool InstanceNameLess(const ServiceInstance& instance, const std::string& name) {
+  return instance.name < name;
+}
+
+// split "base/service[/name]" into its components
+bool SplitPath(const std::string& base_path, const char* path,
+               std::string* service, std::string* name) {
+  if (strncmp(path, base_path.c_str(), base_path.size()) != 0
+      || path[base_path.size()] != '/') {
+    return false;
+  }
+
+  std::string relative(path + base_path.size() + 1);
+  auto pos = relative.find('/');
+  if (pos == std::string::npos) {
+    *service = relative;
+    name->clear();
+  } else {
+    *service = relative.substr(0, pos);
+    *name = relative.substr(pos + 1);
+  }
+  return !service->empty();
+}
+
+}
+
+ServiceDiscovery::ServiceDiscovery(const std::string& zookeeper_servers,
+                                   const std::string& base_path)
+: zookeeper_servers_(zookeeper_servers),
+  base_path_(base_path),
+  executor_(std::experimental::system_executor()),
+  slots_(std::make_shared<const ServiceSlots>()) {
+  // a refresh posted by an early connected event must see zk_
+  std::lock_guard<std::mutex> lock(mutex_);
+  zk_ = std::make_unique<ZooKeeper>(zookeeper_servers_, this);
+}
+
+ServiceDiscovery::~ServiceDiscovery() {
+  // queued refreshes are skipped, the closing session queues more
+  tasks_.Close();
+  // close the session now, so registered instances disappear immediately
+  std::lock_guard<std::mutex> lock(mutex_);
+  zk_.reset();
+}
+
+void ServiceDiscovery::ResetZooKeeperClient() {
+  zk_ = std::make_unique<ZooKeeper>(zookeeper_servers_, this);
+
+  // watches are gone with the old session
+  for (auto& slot : *std::atomic_load(&slots_)) {
+    slot.second->reload = true;
+  }
+}
+
+std::string ServiceDiscovery::ServicePath(const std::string& service) const {
+  return base_path_ + '/' + service;
+}
+
+std::shared_ptr<ServiceDiscovery::ServiceSlot>
+ServiceDiscovery::FindSlot(const std::string& service) const {
+  auto slots = std::atomic_load(&slots_);
+  auto it = slots->find(service);
+  if (it == slots->end()) {
+    return nullptr;
+  }
+  return it->second;
+}
+
+void ServiceDiscovery::Register(const std::string& service,
+                                const std::string& name,
+                                const std::string& payload) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  registrations_[std::make_pair(service, name)] = payload;
+
+  if (!zk_->is_connected()) {
+    // created by Refresh once connected
+    return;
+  }
+
+  auto service_path = ServicePath(service);
+  RecursiveCreate(*zk_, service_path);
+
+  // replace the instance atomically if it was registered before
+  auto path = service_path + '/' + name;
+  MultiOps ops;
+  NodeStat stat;
+  if (zk_->Exists(path, false, &stat)) {
+    ops.Delete(path, stat.version);
+  }
+  ops.Create(path, payload, ZOO_EPHEMERAL);
+  zk_->Multi(ops);
+}
+
+void ServiceDiscovery::Unregister(const std::string& service,
+                                  const std::string& name) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  registrations_.erase(std::make_pair(service, name));
+
+  if (zk_->is_connected()) {
+    zk_->DeleteIfExists(ServicePath(service) + '/' + name);
+  }
+}
+
+void ServiceDiscovery::Watch(const std::string& service) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  auto slots = std::atomic_load(&slots_);
+  if (slots->count(service)) {
+    return;
+  }
+
+  auto slot = std::make_shared<ServiceSlot>();
+  slot->instances = EMPTY_INSTANCES;
+
+  auto new_slots = std::make_shared<ServiceSlots>(*slots);
+  new_slots->emplace(service, slot);
+  std::atomic_store(&slots_, std::shared_ptr<const ServiceSlots>(new_slots));
+
+  if (zk_->is_connected()) {
+    RefreshService(service);
+  }
+}
+
+std::shared_ptr<const ServiceInstances>
+ServiceDiscovery::Instances(const std::string& service) const {
+  auto slot = FindSlot(service);
+  if (!slot) {
+    return EMPTY_INSTANCES;
+  }
+  return std::atomic_load(&slot->instances);
+}
+
+void ServiceDiscovery::RefreshLater() {
+  post(executor_, tasks_.Wrap([this](){ this->Refresh(); }));
+}
+
+void ServiceDiscovery::Refresh() {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  if (zk_->is_expired()) {
+    // new session will refresh once it's connected
+    ResetZooKeeperClient();
+    return;
+  }
+
+  if (!zk_->is_connected()) {
+    return;
+  }
+
+  try {
+    RegisterInstances();
+    for (auto& slot : *std::atomic_load(&slots_)) {
+      RefreshService(slot.first);
+    }
+  } catch (std::exception& e) {
+    Log(LOG_LEVEL_WARN, "service_discovery", "refresh service discovery failed, {}", e.what());
+  }
+}
+
+void ServiceDiscovery::RegisterInstances() {
+  for (auto& registration : registrations_) {
+    auto& service = registration.first.first;
+    auto& name = registration.first.second;
+
+    auto service_path = ServicePath(service);
+    RecursiveCreate(*zk_, service_path);
+    zk_->CreateIfNotExists(service_path + '/' + name,
+                           registration.second, ZOO_EPHEMERAL);
+  }
+}
+
+void ServiceDiscovery::RefreshService(const std::string& service) {
+  auto slot = FindSlot(service);
+  if (!slot) return;
+
+  auto service_path = ServicePath(service);
+
+  std::vector<std::string> children;
+  try {
+    children = zk_->GetChildren(service_path, true);
+  } catch (ZooException& e) {
+    if (e.code() != ZNONODE) throw;
+    // watch the service before any instance registers
+    RecursiveCreate(*zk_, service_path);
+    children = zk_->GetChildren(service_path, true);
+  }
+  std::sort(std::begin(children), std::end(children));
+
+  auto current = slot->reload ? EMPTY_INSTANCES : std::atomic_load(&slot->instances);
+
+  // reuse known instances, their data watches are still armed
+  ServiceInstances instances;
+  instances.reserve(children.size());
+  std::vector<size_t> fetch_index;
+  std::vector<std::string> fetch_paths;
+  for (auto& child : children) {
+    auto it = std::lower_bound(current->begin(), current->end(), child,
+                               InstanceNameLess);
+    if (it != current->end() && it->name == child) {
+      instances.push_back(*it);
+    } else {
+      ServiceInstance instance;
+      instance.name = child;
+      instances.push_back(std::move(instance));
+      fetch_index.push_back(instances.size() - 1);
+      fetch_paths.push_back(service_path + '/' + child);
+    }
+  }
+
+  auto results = PipelinedGet(*zk_, fetch_paths, true);
+  std::vector<bool> removed(instances.size(), false);
+  for (size_t i = 0; i < results.size(); ++i) {
+    auto& instance = instances[fetch_index[i]];
+    if (results[i].code == ZNONODE) {
+      // deleted after listing, the child watch will fire again
+      removed[fetch_index[i]] = true;
+    } else if (results[i].code != ZOK) {
+      throw ZooException(results[i].code);
+    } else {
+      instance.payload = std::move(results[i].value);
+      instance.mzxid = results[i].stat.mzxid;
+    }
+  }
+
+  ServiceInstances snapshot;
+  snapshot.reserve(instances.size());
+  for (size_t i = 0; i < instances.size(); ++i) {
+    if (!removed[i]) snapshot.push_back(std::move(instances[i]));
+  }
+
+  std::atomic_store(&slot->instances,
+                    std::make_shared<const ServiceInstances>(std::move(snapshot)));
+  slot->reload = false;
+}
+
+void ServiceDiscovery::RefreshInstance(const std::string& service,
+                                       const std::string& name) {
+  auto slot = FindSlot(service);
+  if (!slot || slot->reload) return;
+
+  auto results = PipelinedGet(*zk_, {ServicePath(service) + '/' + name}, true);
+  auto& result = results[0];
+  if (result.code != ZOK && result.code != ZNONODE) {
+    throw ZooException(result.code);
+  }
+
+  auto instances = std::make_shared<ServiceInstances>(*std::atomic_load(&slot->instances));
+  auto it = std::lower_bound(instances->begin(), instances->end(), name,
+                             InstanceNameLess);
+  if (it == instances->end() || it->name != name) {
+    // new instances are added by the child watch, and its data watch is
+    // armed by that fetch
+    return;
+  }
+
+  if (result.code == ZNONODE) {
+    instances->erase(it);
+  } else {
+    it->payload = std::move(result.value);
+    it->mzxid = result.stat.mzxid;
+  }
+
+  std::atomic_store(&slot->instances,
+                    std::shared_ptr<const ServiceInstances>(instances));
+}
+
+void ServiceDiscovery::OnChildChanged(const char* path) {
+  std::string service, name;
+  if (!SplitPath(base_path_, path, &service, &name) || !name.empty()) {
+    return;
+  }
+
+  post(executor_, tasks_.Wrap([this, service](){
+    std::lock_guard<std::mutex> lock(mutex_);
+    try {
+      RefreshService(service);
+    } catch (std::exception& e) {
+      // fetched again on the next connection
+      Log(LOG_LEVEL_WARN, "service_discovery", "refresh service {} failed, {}", service, e.what());
+    }
+  }));
+}
+
+void ServiceDiscovery::OnChanged(const char* path) {
+  RefreshInstanceLater(path);
+}
+
+void ServiceDiscovery::OnDeleted(const char* path) {
+  // a re-registered instance is deleted and created again
+  RefreshInstanceLater(path);
+}
+
+void ServiceDiscovery::RefreshInstanceLater(const char* path) {
+  std::string service, name;
+  if (!SplitPath(base_path_, path, &service, &name) || name.empty()) {
+    return;
+  }
+
+  post(executor_, tasks_.Wrap([this, service, name](){
+    std::lock_guard<std::mutex> lock(mutex_);
+    try {
+      RefreshInstance(service, name);
+    } catch (std::exception& e) {
+      Log(LOG_LEVEL_WARN, "service_discovery", "refresh instance {} failed, {}", name, e.what());
+    }
+  }));
+}
+
+void ServiceDiscovery::OnConnected() {
+  RefreshLater();
+}
+
+void ServiceDiscovery::OnSessionExpired() {
+  RefreshLater();
+}
+
+void ServiceDiscovery::OnConnecting() {}
+void ServiceDiscovery::OnCreated(const char* path) {}
+void ServiceDiscovery::OnNotWatching(const char* path) {}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include "task_guard.h"
+#include <zookeeper-cpp/zookeeper.hpp>
+#include <experimental/executor>
+#include <map>
+#include <memory>
+#include <mutex>
+
+namespace zookeeper {
+
+struct ServiceInstance {
+  std::string name;
+  std::string payload;
+  // mzxid of the instance node when payload was read
+  int64_t mzxid = 0;
+};
+
+// immutable list of instances of a service, sorted by name
+typedef std::vector<ServiceInstance> ServiceInstances;
+
+// Registry of service instances under |base_path|, each service is a
+// directory holding one ephemeral node per instance: base_path/service/name.
+//
+// Watched services are kept in memory as immutable snapshots which are
+// swapped atomically when a child or data watch fires, so Instances() is
+// served from any thread without locks or network round trips. Only added
+// or changed instances are fetched on updates.
+class ServiceDiscovery : public zookeeper::ZooWatcher {
+public:
+  ServiceDiscovery(const std::string& zookeeper_servers,
+                   const std::string& base_path);
+
+  ~ServiceDiscovery();
+
+  // Publish an instance of |service|. The ephemeral node is created again
+  // after session expiry until Unregister is called.
+  void Register(const std::string& service,
+                const std::string& name,
+                const std::string& payload = std::string());
+
+  void Unregister(const std::string& service, const std::string& name);
+
+  // Start keeping a snapshot of |service| up to date.
+  void Watch(const std::string& service);
+
+  // Current snapshot of |service|, empty if the service isn't watched or
+  // hasn't been fetched yet.
+  std::shared_ptr<const ServiceInstances> Instances(const std::string& service) const;
+
+private:
+  // ZooWatcher callbacks
+  void OnConnected() override;
+  void OnConnecting() override;
+  void OnSessionExpired() override;
+
+  void OnCreated(const char* path) override;
+  void OnDeleted(const char* path) override;
+  void OnChanged(const char* path) override;
+  void OnChildChanged(const char* path) override;
+  void OnNotWatching(const char* path) override;
+
+private:
+  struct ServiceSlot {
+    // accessed through std::atomic_load/std::atomic_store only
+    std::shared_ptr<const ServiceInstances> instances;
+    // set when the snapshot must be fetched from scratch
+    bool reload = true;
+  };
+
+  typedef std::map<std::string, std::shared_ptr<ServiceSlot>> ServiceSlots;
+
+  std::shared_ptr<ServiceSlot> FindSlot(const std::string& service) const;
+
+  std::string ServicePath(const std::string& service) const;
+
+  void Refresh();
+  void RefreshLater();
+
+  void RegisterInstances();
+
+  void RefreshService(const std::string& service);
+  void RefreshInstance(const std::string& service, const std::string& name);
+  void RefreshInstanceLater(const char* path);
+
+private:
+  const std::string zookeeper_servers_;
+  const std::string base_path_;
+
+  // guards zk_ and everything below, never taken by Instances()
+  std::mutex mutex_;
+
+  std::unique_ptr<zookeeper::ZooKeeper> zk_;
+  void ResetZooKeeperClient();
+
+  std::experimental::executor executor_;
+  // every task posted to executor_ is wrapped by it
+  TaskGuard tasks_;
+
+  // (service, name) => payload
+  std::map<std::pair<std::string, std::string>, std::string> registrations_;
+
+  // accessed through std::atomic_load/std::atomic_store only, copied on
+  // Watch() so readers can look up a slot without locking
+  std::shared_ptr<const ServiceSlots> slots_;
+};
+
+} // namespace zookeeper
@@ -0,0 +1,86 @@
+#include <gtest/gtest.h>
+#include "service_discovery.h"
+#include <zookeeper-cpp/zookeeper_unittest_helper.hpp>
+
+using namespace testing;
+using namespace zookeeper;
+
+TEST(ServiceDiscovery, RegisterThenWatch) {
+  ServiceDiscovery provider("127.0.0.1:2181", "/test_services");
+  ServiceDiscovery consumer("127.0.0.1:2181", "/test_services");
+  sleep(1);
+
+  provider.Register("echo", "host1:80", "weight=1");
+  provider.Register("echo", "host2:80", "weight=2");
+
+  EXPECT_TRUE(consumer.Instances("echo")->empty());
+  consumer.Watch("echo");
+
+  auto instances = consumer.Instances("echo");
+  ASSERT_EQ(instances->size(), 2u);
+  EXPECT_EQ((*instances)[0].name, "host1:80");
+  EXPECT_EQ((*instances)[0].payload, "weight=1");
+  EXPECT_EQ((*instances)[1].name, "host2:80");
+  EXPECT_EQ((*instances)[1].payload, "weight=2");
+}
+
+TEST(ServiceDiscovery, SnapshotFollowsChanges) {
+  ServiceDiscovery provider("127.0.0.1:2181", "/test_services");
+  ServiceDiscovery consumer("127.0.0.1:2181", "/test_services");
+  sleep(1);
+
+  consumer.Watch("echo");
+  EXPECT_TRUE(consumer.Instances("echo")->empty());
+
+  provider.Register("echo", "host1:80", "v1");
+  sleep(1);
+  auto before = consumer.Instances("echo");
+  ASSERT_EQ(before->size(), 1u);
+
+  // snapshot held by reader isn't affected by later updates
+  provider.Register("echo", "host1:80", "v2");
+  provider.Register("echo", "host2:80");
+  sleep(1);
+  EXPECT_EQ((*before)[0].payload, "v1");
+
+  auto after = consumer.Instances("echo");
+  ASSERT_EQ(after->size(), 2u);
+  EXPECT_EQ((*after)[0].payload, "v2");
+
+  provider.Unregister("echo", "host1:80");
+  sleep(1);
+  ASSERT_EQ(consumer.Instances("echo")->size(), 1u);
+  EXPECT_EQ((*consumer.Instances("echo"))[0].name, "host2:80");
+}
+
+TEST(ServiceDiscovery, InstancesRemovedWithProvider) {
+  ServiceDiscovery consumer("127.0.0.1:2181", "/test_services");
+  {
+    ServiceDiscovery provider("127.0.0.1:2181", "/test_services");
+    sleep(1);
+    provider.Register("echo", "host1:80");
+    consumer.Watch("echo");
+    EXPECT_EQ(consumer.Instances("echo")->size(), 1u);
+  }
+
+  sleep(1);
+  EXPECT_TRUE(consumer.Instances("echo")->empty());
+}
+
+TEST(ServiceDiscovery, DestroyWithRefreshesQueued) {
+  ServiceDiscovery provider("127.0.0.1:2181", "/test_services");
+  sleep(1);
+
+  for (int i = 0; i < 20; ++i) {
+    // the refreshes queued by the connection and by the watches must not
+    // run on the destroyed consumer
+    ServiceDiscovery consumer("127.0.0.1:2181", "/test_services");
+    consumer.Watch("echo");
+    provider.Register("echo", "host" + std::to_string(i) + ":80");
+  }
+  sleep(1);
+
+  for (int i = 0; i < 20; ++i) {
+    provider.Unregister("echo", "host" + std::to_string(i) + ":80");
+  }
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+namespace zookeeper {
+
+// Keeps the tasks a recipe posts to an executor off the recipe once it's
+// destroyed. A wrapped task holds the guard's state, not the recipe: it's
+// skipped once the guard is closed, and Close() waits for the ones already
+// running. Close it first in the destructor, never from a wrapped task.
+class TaskGuard {
+public:
+  TaskGuard()
+  : state_(std::make_shared<State>()) {
+  }
+
+  ~TaskGuard() {
+    Close();
+  }
+
+  // disable copy
+  TaskGuard(const TaskGuard&) = delete;
+  TaskGuard& operator=(const TaskGuard&) = delete;
+
+  template <typename Task>
+  auto Wrap(Task task) const {
+    auto state = state_;
+    return [state, task]() mutable {
+      {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        if (state->closed) return;
+        ++state->running;
+      }
+      // done even if the task throws
+      struct Running {
+        ~Running() {
+          std::lock_guard<std::mutex> lock(state->mutex);
+          if (--state->running == 0) state->idle.notify_all();
+        }
+        State* state;
+      } running{state.get()};
+      task();
+    };
+  }
+
+  void Close() {
+    std::unique_lock<std::mutex> lock(state_->mutex);
+    state_->closed = true;
+    state_->idle.wait(lock, [this] { return state_->running == 0; });
+  }
+
+private:
+  struct State {
+    std::mutex mutex;
+    std::condition_variable idle;
+    int running = 0;
+    bool closed = false;
+  };
+
+  const std::shared_ptr<State> state_;
+};
+
+} // namespace zookeeper
@@ -1,9 +1,16 @@
 #include "zookeeper.hpp"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <algorithm>
 #include <cassert>
 #include <cerrno>
+#include <condition_variable>
 #include <cstring>
+#include <memory>
 #include <mutex>
 #include "zookeeper_error.hpp"
+#include "zookeeper_log.hpp"
+#include "zookeeper_trace.hpp"
 
 namespace zookeeper {
 
@@ -12,28 +19,32 @@ namespace zookeeper {
 
 void ZooKeeper::GlobalWatchFunc(zhandle_t* h, int type, int state, const char* path, void* ctx) {
   auto self = static_cast<ZooKeeper*>(ctx);
+  self->completion_thread_ = std::this_thread::get_id();
   self->WatchHandler(type, state, path);
 }
 
-static std::once_flag ONCE_FLAG_SET_DEBUG_LEVEL;
-void set_default_debug_level() {
-  std::call_once(ONCE_FLAG_SET_DEBUG_LEVEL, []{
-    zoo_set_debug_level(ZOO_LOG_LEVEL_WARN);
-  });
-}
-
 ZooKeeper::ZooKeeper(const std::string& server_hosts,
                      ZooWatcher* global_watcher,
-                     int timeout_ms)
+                     int timeout_ms,
+                     bool read_only)
 : global_watcher_(global_watcher) {
-  set_default_debug_level();
+  RouteClientLog();
+
+  int flags = 0;
+  if (read_only) {
+#ifdef ZOO_READONLY
+    flags |= ZOO_READONLY;
+#else
+    throw ZooException(ZUNIMPLEMENTED, "the client library has no read-only mode");
+#endif
+  }
 
   zoo_handle_ = zookeeper_init(server_hosts.c_str(),
                                GlobalWatchFunc,
                                timeout_ms,
                                nullptr, // client id
                                this,
-                               0);
+                               flags);
   if (!zoo_handle_) {
     throw ZooSystemErrorFromErrno(errno);
   }
@@ -43,7 +54,7 @@ ZooKeeper::~ZooKeeper() {
   if (zoo_handle_) {
     auto ret = zookeeper_close(zoo_handle_);
     if (ret != ZOK) {
-      // TODO: log information
+      Log(LOG_LEVEL_WARN, "zookeeper", "closing session failed, {}", zerror(ret));
     }
   }
 }
@@ -56,7 +67,56 @@ bool ZooKeeper::is_expired() {
   return zoo_state(zoo_handle_) == ZOO_EXPIRED_SESSION_STATE;
 }
 
+bool ZooKeeper::is_read_only() {
+#ifdef ZOO_READONLY
+  return zoo_state(zoo_handle_) == ZOO_READONLY_STATE;
+#else
+  return false;
+#endif
+}
+
+std::string ZooKeeper::connected_server() {
+  sockaddr_storage addr;
+  socklen_t addr_len = sizeof(addr);
+  if (!zookeeper_get_connected_host(zoo_handle_, reinterpret_cast<sockaddr*>(&addr),
+                                    &addr_len)) {
+    return std::string();
+  }
+
+  char ip[INET6_ADDRSTRLEN] = "";
+  int port = 0;
+  if (addr.ss_family == AF_INET) {
+    auto in = reinterpret_cast<sockaddr_in*>(&addr);
+    inet_ntop(AF_INET, &in->sin_addr, ip, sizeof(ip));
+    port = ntohs(in->sin_port);
+  } else if (addr.ss_family == AF_INET6) {
+    auto in6 = reinterpret_cast<sockaddr_in6*>(&addr);
+    inet_ntop(AF_INET6, &in6->sin6_addr, ip, sizeof(ip));
+    port = ntohs(in6->sin6_port);
+  } else {
+    return std::string();
+  }
+  return std::string(ip) + ':' + std::to_string(port);
+}
+
+ZooResult<void> ZooKeeper::TrySetServers(const std::string& server_hosts) {
+#if ZOO_MAJOR_VERSION > 3 || (ZOO_MAJOR_VERSION == 3 && ZOO_MINOR_VERSION >= 5)
+  return zoo_set_servers(zoo_handle_, server_hosts.c_str());
+#else
+  return ZUNIMPLEMENTED;
+#endif
+}
+
 void ZooKeeper::WatchHandler(int type, int state, const char* path) {
+  std::vector<std::shared_ptr<WatchListener>> listeners;
+  {
+    std::lock_guard<std::mutex> lock(listeners_mutex_);
+    listeners = listeners_;
+  }
+  for (auto& listener : listeners) {
+    listener->OnWatchEvent(type, state, path);
+  }
+
   // call global watcher
   if (!global_watcher_) return;
 
@@ -67,9 +127,13 @@ void ZooKeeper::WatchHandler(int type, int state, const char* path) {
       global_watcher_->OnConnected();
     } else if (state == ZOO_CONNECTING_STATE) {
       global_watcher_->OnConnecting();
+#ifdef ZOO_READONLY
+    } else if (state == ZOO_READONLY_STATE) {
+      global_watcher_->OnReadOnlyConnected();
+#endif
     } else {
-      // TODO:
-      assert(0 && "don't know how to process other session event yet");
+      // e.g. ZOO_AUTH_FAILED_STATE, the session can't be used any more
+      Log(LOG_LEVEL_ERROR, "zookeeper", "unhandled session state {}", state);
     }
   } else if (type == ZOO_CREATED_EVENT) {
     global_watcher_->OnCreated(path);
@@ -82,12 +146,45 @@ void ZooKeeper::WatchHandler(int type, int state, const char* path) {
   } else if (type == ZOO_NOTWATCHING_EVENT) {
     global_watcher_->OnNotWatching(path);
   } else {
-    assert(false && "unknown zookeeper event type");
+    Log(LOG_LEVEL_ERROR, "zookeeper", "unknown event type {} for {}", type, path);
   }
 }
 
-bool ZooKeeper::Exists(const std::string& path, bool watch, NodeStat* stat) {
-  auto zoo_code = zoo_exists(zoo_handle_, path.c_str(), watch, stat);
+typedef std::chrono::steady_clock::time_point TracePoint;
+
+// Close the queued phase of |span|, from |since| until the request is sent,
+// returns the time it's sent at.
+static TracePoint Sending(ScopedSpan& span, TracePoint since) {
+  auto now = span.Mark();
+  if (auto traced = span.span()) traced->queued += now - since;
+  return now;
+}
+
+// Close the wire phase of |span| with the reply to the request sent at
+// |sent|.
+static void Replied(ScopedSpan& span, TracePoint sent, int zoo_code,
+                    int64_t zxid = 0) {
+  if (auto traced = span.span()) {
+    traced->wire += std::chrono::steady_clock::now() - sent;
+    span.set_result(zoo_code, zoo_code == ZOK ? zxid : 0);
+  }
+}
+
+bool ZooKeeper::Exists(PathView path, bool watch, NodeStat* stat) {
+  ScopedSpan span("Exists", path);
+  auto queued = span.Mark();
+  if (sync_reads_) {
+    auto zoo_code = AwaitSync("/");
+    span.set_result(zoo_code);
+    CHECK_ZOOCODE_AND_THROW(zoo_code);
+  }
+
+  PathBuffer path_buffer(path);
+  NodeStat node_stat = NodeStat();
+  auto sent = Sending(span, queued);
+  auto zoo_code = TimedExists(path_buffer.c_str(), watch, &node_stat);
+  Replied(span, sent, zoo_code, node_stat.mzxid);
+  if (zoo_code == ZOK && stat) *stat = node_stat;
   if (zoo_code == ZNONODE) {
     return false;
   } else {
@@ -96,129 +193,1047 @@ bool ZooKeeper::Exists(const std::string& path, bool watch, NodeStat* stat) {
   }
 }
 
-NodeStat ZooKeeper::Stat(const std::string& path) {
-  NodeStat stat;
-  auto zoo_code = zoo_exists(zoo_handle_, path.c_str(), false, &stat);
-  CHECK_ZOOCODE_AND_THROW(zoo_code);
+ZooResult<NodeStat> ZooKeeper::TryStat(PathView path, bool watch) {
+  ScopedSpan span("Stat", path);
+  auto queued = span.Mark();
+  if (sync_reads_) {
+    auto zoo_code = AwaitSync("/");
+    span.set_result(zoo_code);
+    if (zoo_code != ZOK) return ZooResult<NodeStat>::Error(zoo_code);
+  }
 
+  NodeStat stat;
+  PathBuffer path_buffer(path);
+  auto sent = Sending(span, queued);
+  auto zoo_code = TimedExists(path_buffer.c_str(), watch, &stat);
+  Replied(span, sent, zoo_code, stat.mzxid);
+  if (zoo_code != ZOK) return ZooResult<NodeStat>::Error(zoo_code);
   return stat;
 }
 
-std::string ZooKeeper::Create(const std::string& path, const std::string& value, int flag) {
-  std::string path_buffer;
-  path_buffer.resize(path.size() + 64);
-
-  auto zoo_code = zoo_create(zoo_handle_,
-                             path.c_str(),
-                             value.data(),
-                             value.size(),
-                             &ZOO_OPEN_ACL_UNSAFE,
-                             flag,
-                             const_cast<char*>(path_buffer.data()),
-                             path_buffer.size());
+ZooResult<std::string> ZooKeeper::TryCreate(PathView path,
+                                            const std::string& value,
+                                            int flag) {
+  ScopedSpan span("Create", path);
+  std::string created_path;
+  PathBuffer path_buffer(path);
+  auto sent = span.Mark();
+  auto zoo_code = TimedCreate(path_buffer.c_str(), value, flag, &created_path);
+  Replied(span, sent, zoo_code);
+  ++write_sequence_;
+  if (zoo_code != ZOK) return ZooResult<std::string>::Error(zoo_code);
+  return created_path;
+}
 
-  CHECK_ZOOCODE_AND_THROW(zoo_code);
+ZooResult<void> ZooKeeper::TryDelete(PathView path, int version) {
+  ScopedSpan span("Delete", path);
+  PathBuffer path_buffer(path);
+  auto sent = span.Mark();
+  auto zoo_code = TimedDelete(path_buffer.c_str(), version);
+  Replied(span, sent, zoo_code);
+  ++write_sequence_;
+  return zoo_code;
+}
 
-  path_buffer.resize(strlen(path_buffer.data()));
-  return path_buffer;
+ZooResult<void> ZooKeeper::TrySet(PathView path,
+                                  const std::string& value,
+                                  int version) {
+  ScopedSpan span("Set", path);
+  NodeStat stat = NodeStat();
+  PathBuffer path_buffer(path);
+  auto sent = span.Mark();
+  auto zoo_code = TimedSet(path_buffer.c_str(), value, version, &stat);
+  Replied(span, sent, zoo_code, stat.mzxid);
+  ++write_sequence_;
+  return zoo_code;
 }
 
-std::string ZooKeeper::CreateIfNotExists(const std::string& path, const std::string& value, int flag) {
-  std::string path_buffer;
-  path_buffer.resize(path.size() + 64);
+NodeStat ZooKeeper::Stat(PathView path) {
+  return TryStat(path).value();
+}
 
-  auto zoo_code = zoo_create(zoo_handle_,
-                             path.c_str(),
-                             value.data(),
-                             value.size(),
-                             &ZOO_OPEN_ACL_UNSAFE,
-                             flag,
-                             const_cast<char*>(path_buffer.data()),
-                             path_buffer.size());
+std::string ZooKeeper::Create(PathView path, const std::string& value, int flag) {
+  return TryCreate(path, value, flag).value();
+}
 
-  if (zoo_code == ZNODEEXISTS) {
+std::string ZooKeeper::CreateIfNotExists(PathView path, const std::string& value, int flag) {
+  auto created = TryCreate(path, value, flag);
+  if (created.code() == ZNODEEXISTS) {
     assert(!(flag & ZOO_SEQUENCE));
-    return path;
+    return path.to_string();
   }
 
-  CHECK_ZOOCODE_AND_THROW(zoo_code);
+  return std::move(created).value();
+}
 
-  path_buffer.resize(strlen(path_buffer.data()));
-  return path_buffer;
+void ZooKeeper::Delete(PathView path) {
+  TryDelete(path).value();
 }
 
-void ZooKeeper::Delete(const std::string& path) {
-  NodeStat stat;
-  if (!Exists(path.c_str(), false, &stat)) {
-    throw ZooException(ZNONODE);
+void ZooKeeper::DeleteIfExists(PathView path) {
+  auto deleted = TryDelete(path);
+  if (deleted.code() == ZNONODE) {
+    return;
   }
+  deleted.value();
+}
 
-  auto zoo_code = zoo_delete(zoo_handle_, path.c_str(), stat.version);
-  CHECK_ZOOCODE_AND_THROW(zoo_code);
+struct ZooKeeper::ReadFlight {
+  uint64_t write_sequence = 0;
+  std::condition_variable done_cond;
+  bool done = false;
+  int code = ZOK;
+
+  std::string value;
+  NodeStat stat = NodeStat();
+  std::vector<std::string> children;
+};
+
+// Key of a read in flight, built in a buffer reused by the calling thread.
+// Only a read which starts a flight copies it.
+static const std::string& FlightKey(char op, PathView path, bool watch) {
+  static thread_local std::string key;
+  key.assign(1, op);
+  key.push_back(watch ? 'w' : '-');
+  key.append(path.data(), path.size());
+  return key;
 }
 
-void ZooKeeper::DeleteIfExists(const std::string& path) {
-  NodeStat stat;
-  if (!Exists(path.c_str(), false, &stat)) {
-    return;
+template <typename Read>
+int ZooKeeper::CoalescedRead(const std::string& key,
+                             std::shared_ptr<ReadFlight>* flight,
+                             const Read& read) {
+  auto write_sequence = write_sequence_.load();
+  auto deadline = operation_deadline();
+
+  std::unique_lock<std::mutex> lock(flights_mutex_);
+  auto it = flights_.find(key);
+  // the completion thread may be the one to deliver the reply
+  while (it != flights_.end()
+         && it->second->write_sequence == write_sequence
+         && completion_thread_ != std::this_thread::get_id()) {
+    *flight = it->second;
+    ++coalesced_reads_;
+
+    auto& shared = **flight;
+    auto done = [&shared]{ return shared.done; };
+    if (deadline == Deadline::max()) {
+      shared.done_cond.wait(lock, done);
+    } else if (!shared.done_cond.wait_until(lock, deadline, done)) {
+      return ZOPERATIONTIMEOUT;
+    }
+    if (shared.code != ZOPERATIONTIMEOUT
+        || std::chrono::steady_clock::now() >= deadline) {
+      return shared.code;
+    }
+
+    // the sender's deadline was earlier than ours, read again
+    write_sequence = write_sequence_.load();
+    it = flights_.find(key);
   }
 
-  auto zoo_code = zoo_delete(zoo_handle_, path.c_str(), stat.version);
-  if (zoo_code == ZNONODE) {
-    return;
+  // a flight sent before a later write is left to its waiters
+  *flight = std::make_shared<ReadFlight>();
+  (*flight)->write_sequence = write_sequence;
+  flights_[key] = *flight;
+  lock.unlock();
+
+  auto zoo_code = read(**flight);
+
+  lock.lock();
+  auto& own = **flight;
+  own.code = zoo_code;
+  own.done = true;
+  it = flights_.find(key);
+  if (it != flights_.end() && it->second == *flight) {
+    flights_.erase(it);
+  }
+  own.done_cond.notify_all();
+  return zoo_code;
+}
+
+ZooResult<std::string> ZooKeeper::TryGet(PathView path, bool watch) {
+  ScopedSpan span("Get", path);
+  auto queued = span.Mark();
+  if (sync_reads_) {
+    auto zoo_code = AwaitSync("/");
+    span.set_result(zoo_code);
+    if (zoo_code != ZOK) return ZooResult<std::string>::Error(zoo_code);
+  }
+
+  PathBuffer path_buffer(path);
+  std::string value;
+  if (!coalesce_reads_) {
+    NodeStat stat = NodeStat();
+    auto sent = Sending(span, queued);
+    auto zoo_code = TimedGet(path_buffer.c_str(), watch, &value, &stat);
+    Replied(span, sent, zoo_code, stat.mzxid);
+    if (zoo_code != ZOK) return ZooResult<std::string>::Error(zoo_code);
+    return value;
+  }
+
+  std::shared_ptr<ReadFlight> flight;
+  bool sent_own = false;
+  auto zoo_code = CoalescedRead(FlightKey('g', path, watch), &flight,
+                                [&](ReadFlight& own) {
+    sent_own = true;
+    auto sent = Sending(span, queued);
+    auto read_code = TimedGet(path_buffer.c_str(), watch, &own.value, &own.stat);
+    Replied(span, sent, read_code, own.stat.mzxid);
+    return read_code;
+  });
+  if (!sent_own) {
+    // waited for the reply of another call
+    Sending(span, queued);
+    span.set_result(zoo_code, zoo_code == ZOK ? flight->stat.mzxid : 0);
+  }
+  if (zoo_code != ZOK) return ZooResult<std::string>::Error(zoo_code);
+
+  // take the buffer if no other call shares it
+  if (flight.use_count() == 1) return std::move(flight->value);
+  return flight->value;
+}
+
+ZooResult<std::vector<std::string>> ZooKeeper::TryGetChildren(PathView parent_path,
+                                                              bool watch) {
+  typedef ZooResult<std::vector<std::string>> Result;
+
+  ScopedSpan span("GetChildren", parent_path);
+  auto queued = span.Mark();
+  if (sync_reads_) {
+    auto zoo_code = AwaitSync("/");
+    span.set_result(zoo_code);
+    if (zoo_code != ZOK) return Result::Error(zoo_code);
+  }
+
+  PathBuffer path_buffer(parent_path);
+  std::vector<std::string> children;
+  if (!coalesce_reads_) {
+    auto sent = Sending(span, queued);
+    auto zoo_code = TimedGetChildren(path_buffer.c_str(), watch, &children);
+    Replied(span, sent, zoo_code);
+    if (zoo_code != ZOK) return Result::Error(zoo_code);
+    return children;
+  }
+
+  std::shared_ptr<ReadFlight> flight;
+  bool sent_own = false;
+  auto zoo_code = CoalescedRead(FlightKey('c', parent_path, watch), &flight,
+                                [&](ReadFlight& own) {
+    sent_own = true;
+    auto sent = Sending(span, queued);
+    auto read_code = TimedGetChildren(path_buffer.c_str(), watch, &own.children);
+    Replied(span, sent, read_code);
+    return read_code;
+  });
+  if (!sent_own) {
+    Sending(span, queued);
+    span.set_result(zoo_code);
+  }
+  if (zoo_code != ZOK) return Result::Error(zoo_code);
+
+  if (flight.use_count() == 1) return std::move(flight->children);
+  return flight->children;
+}
+
+std::string ZooKeeper::Get(PathView path, bool watch) {
+  return TryGet(path, watch).value();
+}
+
+void ZooKeeper::Set(PathView path, const std::string& value) {
+  TrySet(path, value).value();
+}
+
+std::vector<std::string> ZooKeeper::GetChildren(PathView parent_path, bool watch) {
+  return TryGetChildren(parent_path, watch).value();
+}
+
+static thread_local Deadline THREAD_DEADLINE = Deadline::max();
+
+ScopedDeadline::ScopedDeadline(Deadline deadline)
+: previous_(THREAD_DEADLINE) {
+  THREAD_DEADLINE = std::min(previous_, deadline);
+}
+
+ScopedDeadline::ScopedDeadline(std::chrono::milliseconds timeout)
+: ScopedDeadline(std::chrono::steady_clock::now() + timeout) {
+}
+
+ScopedDeadline::~ScopedDeadline() {
+  THREAD_DEADLINE = previous_;
+}
+
+Deadline ScopedDeadline::current() {
+  return THREAD_DEADLINE;
+}
+
+Deadline ZooKeeper::operation_deadline() const {
+  auto deadline = ScopedDeadline::current();
+  auto timeout = operation_timeout();
+  if (timeout.count() > 0) {
+    deadline = std::min(deadline, std::chrono::steady_clock::now() + timeout);
+  }
+  return deadline;
+}
+
+bool ZooKeeper::BoundedCall(Deadline* deadline) const {
+  *deadline = operation_deadline();
+  return *deadline != Deadline::max()
+         && completion_thread_ != std::this_thread::get_id();
+}
+
+namespace {
+
+// first guess of a value's size for a synchronous get, grown as reported
+const size_t GET_BUFFER_SIZE = 4096;
+
+// Reply of an asynchronous request awaited by a blocking operation.
+// It's shared with the completion, which outlives a timed out caller.
+struct PendingCall {
+  std::mutex mutex;
+  std::condition_variable done_cond;
+  bool done = false;
+  int rc = ZOK;
+
+  NodeStat stat = NodeStat();
+  // data of a get, created path of a create
+  std::string value;
+  std::vector<std::string> children;
+
+  // written by the client library when a multi completes
+  std::vector<zoo_op_result_t> multi_results;
+  std::vector<std::string> path_buffers;
+  std::vector<NodeStat> multi_stats;
+};
+
+typedef std::shared_ptr<PendingCall> PendingCallPtr;
+
+// takes the context passed to the client library
+template <typename Fill>
+void CompletePending(int rc, const void* data, const Fill& fill) {
+  std::unique_ptr<PendingCallPtr> context(
+      static_cast<PendingCallPtr*>(const_cast<void*>(data)));
+  auto& call = **context;
+
+  std::lock_guard<std::mutex> lock(call.mutex);
+  call.rc = rc;
+  if (rc == ZOK) fill(call);
+  call.done = true;
+  call.done_cond.notify_all();
+}
+
+void PendingStatCompletion(int rc, const struct Stat* stat, const void* data) {
+  CompletePending(rc, data, [stat](PendingCall& call) {
+    if (stat) call.stat = *stat;
+  });
+}
+
+void PendingDataCompletion(int rc, const char* value, int value_len,
+                           const struct Stat* stat, const void* data) {
+  CompletePending(rc, data, [=](PendingCall& call) {
+    if (value_len > 0) call.value.assign(value, value_len);
+    if (stat) call.stat = *stat;
+  });
+}
+
+void PendingStringCompletion(int rc, const char* value, const void* data) {
+  CompletePending(rc, data, [value](PendingCall& call) {
+    if (value) call.value = value;
+  });
+}
+
+void PendingStringsCompletion(int rc, const struct String_vector* strings,
+                              const void* data) {
+  CompletePending(rc, data, [strings](PendingCall& call) {
+    if (!strings) return;
+    call.children.assign(strings->data, strings->data + strings->count);
+  });
+}
+
+void PendingVoidCompletion(int rc, const void* data) {
+  CompletePending(rc, data, [](PendingCall&) {});
+}
+
+// Issue a request with |issue|, given the completion context, and wait for
+// its reply until |deadline|, Deadline::max() for no limit.
+template <typename Issue>
+int AwaitReply(const PendingCallPtr& call, Deadline deadline, const Issue& issue) {
+  if (std::chrono::steady_clock::now() >= deadline) {
+    return ZOPERATIONTIMEOUT;
+  }
+
+  auto context = new PendingCallPtr(call);
+  auto zoo_code = issue(context);
+  if (zoo_code != ZOK) {
+    delete context;
+    return zoo_code;
+  }
+
+  std::unique_lock<std::mutex> lock(call->mutex);
+  if (deadline == Deadline::max()) {
+    call->done_cond.wait(lock, [&call]{ return call->done; });
+  } else if (!call->done_cond.wait_until(lock, deadline, [&call]{ return call->done; })) {
+    return ZOPERATIONTIMEOUT;
+  }
+  return call->rc;
+}
+
+}
+
+int ZooKeeper::TimedExists(const char* path, bool watch, NodeStat* stat) {
+  Deadline deadline;
+  if (!BoundedCall(&deadline)) {
+    return zoo_exists(zoo_handle_, path, watch, stat);
+  }
+
+  auto call = std::make_shared<PendingCall>();
+  auto zoo_code = AwaitReply(call, deadline, [&](void* context) {
+    return zoo_aexists(zoo_handle_, path, watch,
+                       PendingStatCompletion, context);
+  });
+  if (zoo_code == ZOK && stat) *stat = call->stat;
+  return zoo_code;
+}
+
+int ZooKeeper::TimedCreate(const char* path, const std::string& value,
+                           int flag, std::string* created_path) {
+  Deadline deadline;
+  if (!BoundedCall(&deadline)) {
+    auto& path_buffer = *created_path;
+    path_buffer.resize(strlen(path) + 64);
+
+    auto zoo_code = zoo_create(zoo_handle_,
+                               path,
+                               value.data(),
+                               value.size(),
+                               &ZOO_OPEN_ACL_UNSAFE,
+                               flag,
+                               const_cast<char*>(path_buffer.data()),
+                               path_buffer.size());
+
+    path_buffer.resize(zoo_code == ZOK ? strlen(path_buffer.data()) : 0);
+    return zoo_code;
+  }
+
+  auto call = std::make_shared<PendingCall>();
+  auto zoo_code = AwaitReply(call, deadline, [&](void* context) {
+    return zoo_acreate(zoo_handle_,
+                       path,
+                       value.data(),
+                       value.size(),
+                       &ZOO_OPEN_ACL_UNSAFE,
+                       flag,
+                       PendingStringCompletion,
+                       context);
+  });
+  if (zoo_code == ZOK) *created_path = call->value;
+  return zoo_code;
+}
+
+int ZooKeeper::TimedDelete(const char* path, int version) {
+  Deadline deadline;
+  if (!BoundedCall(&deadline)) {
+    return zoo_delete(zoo_handle_, path, version);
+  }
+
+  auto call = std::make_shared<PendingCall>();
+  return AwaitReply(call, deadline, [&](void* context) {
+    return zoo_adelete(zoo_handle_, path, version,
+                       PendingVoidCompletion, context);
+  });
+}
+
+int ZooKeeper::TimedGet(const char* path, bool watch, std::string* value,
+                        NodeStat* stat) {
+  if (completion_thread_ == std::this_thread::get_id()) {
+    // No reply can be awaited on the completion thread, the synchronous
+    // call is repeated with a buffer of the reported size until the value
+    // fits; usually once.
+    auto& value_buffer = *value;
+    value_buffer.resize(GET_BUFFER_SIZE);
+    while (true) {
+      int buffer_len = value_buffer.size();
+      auto zoo_code = zoo_get(zoo_handle_,
+                              path,
+                              watch,
+                              const_cast<char*>(value_buffer.data()),
+                              &buffer_len,
+                              stat);
+      if (zoo_code != ZOK) {
+        value_buffer.clear();
+        return zoo_code;
+      }
+      if (stat->dataLength <= static_cast<int>(value_buffer.size())) {
+        value_buffer.resize(buffer_len > 0 ? buffer_len : 0);
+        return zoo_code;
+      }
+      value_buffer.resize(stat->dataLength);
+    }
+  }
+
+  // a single round trip, the reply carries the whole value
+  auto deadline = operation_deadline();
+  auto call = std::make_shared<PendingCall>();
+  auto zoo_code = AwaitReply(call, deadline, [&](void* context) {
+    return zoo_aget(zoo_handle_, path, watch,
+                    PendingDataCompletion, context);
+  });
+  if (zoo_code == ZOK) {
+    *value = std::move(call->value);
+    *stat = call->stat;
+  }
+  return zoo_code;
+}
+
+int ZooKeeper::TimedSet(const char* path, const std::string& value, int version,
+                        NodeStat* stat) {
+  Deadline deadline;
+  if (!BoundedCall(&deadline)) {
+    return zoo_set2(zoo_handle_, path, value.data(), value.size(), version, stat);
+  }
+
+  auto call = std::make_shared<PendingCall>();
+  auto zoo_code = AwaitReply(call, deadline, [&](void* context) {
+    return zoo_aset(zoo_handle_, path, value.data(), value.size(),
+                    version, PendingStatCompletion, context);
+  });
+  if (zoo_code == ZOK) *stat = call->stat;
+  return zoo_code;
+}
+
+int ZooKeeper::TimedGetChildren(const char* path, bool watch,
+                                std::vector<std::string>* children) {
+  Deadline deadline;
+  if (!BoundedCall(&deadline)) {
+    struct String_vector child_vec;
+    auto zoo_code = zoo_get_children(zoo_handle_, path, watch, &child_vec);
+    if (zoo_code != ZOK) return zoo_code;
+
+    children->reserve(child_vec.count);
+    for (int i = 0; i < child_vec.count; ++i) {
+      children->push_back(child_vec.data[i]);
+    }
+
+    deallocate_String_vector(&child_vec);
+    return zoo_code;
+  }
+
+  auto call = std::make_shared<PendingCall>();
+  auto zoo_code = AwaitReply(call, deadline, [&](void* context) {
+    return zoo_aget_children(zoo_handle_, path, watch,
+                             PendingStringsCompletion, context);
+  });
+  if (zoo_code == ZOK) *children = std::move(call->children);
+  return zoo_code;
+}
+
+void MultiOps::Create(const std::string& path, const std::string& value, int flag) {
+  ops_.push_back(Op{CREATE_OP, path, value, flag, -1});
+}
+
+void MultiOps::Delete(const std::string& path, int version) {
+  ops_.push_back(Op{DELETE_OP, path, std::string(), 0, version});
+}
+
+void MultiOps::Set(const std::string& path, const std::string& value, int version) {
+  ops_.push_back(Op{SET_OP, path, value, 0, version});
+}
+
+void MultiOps::Check(const std::string& path, int version) {
+  ops_.push_back(Op{CHECK_OP, path, std::string(), 0, version});
+}
+
+void ZooKeeper::Multi(const MultiOps& ops, std::vector<MultiResult>* results) {
+  TryMulti(ops, results).value();
+}
+
+ZooResult<void> ZooKeeper::TryMulti(const MultiOps& ops, std::vector<MultiResult>* results) {
+  if (ops.empty()) {
+    if (results) results->clear();
+    return ZOK;
+  }
+
+  // the first op's path names the span
+  ScopedSpan span("Multi", ops.ops_.front().path);
+
+  // buffers the reply is written into live as long as the completion
+  auto call = std::make_shared<PendingCall>();
+  auto count = ops.ops_.size();
+  std::vector<zoo_op_t> zoo_ops(count);
+  auto& zoo_results = call->multi_results;
+  auto& path_buffers = call->path_buffers;
+  auto& stats = call->multi_stats;
+  zoo_results.resize(count);
+  path_buffers.resize(count);
+  stats.resize(count);
+
+  for (size_t i = 0; i < count; ++i) {
+    auto& op = ops.ops_[i];
+    switch (op.type) {
+      case MultiOps::CREATE_OP:
+        path_buffers[i].resize(op.path.size() + 64);
+        zoo_create_op_init(&zoo_ops[i],
+                           op.path.c_str(),
+                           op.value.data(),
+                           op.value.size(),
+                           &ZOO_OPEN_ACL_UNSAFE,
+                           op.flag,
+                           const_cast<char*>(path_buffers[i].data()),
+                           path_buffers[i].size());
+        break;
+      case MultiOps::DELETE_OP:
+        zoo_delete_op_init(&zoo_ops[i], op.path.c_str(), op.version);
+        break;
+      case MultiOps::SET_OP:
+        zoo_set_op_init(&zoo_ops[i],
+                        op.path.c_str(),
+                        op.value.data(),
+                        op.value.size(),
+                        op.version,
+                        &stats[i]);
+        break;
+      case MultiOps::CHECK_OP:
+        zoo_check_op_init(&zoo_ops[i], op.path.c_str(), op.version);
+        break;
+    }
+  }
+
+  int zoo_code;
+  Deadline deadline;
+  auto sent = span.Mark();
+  if (!BoundedCall(&deadline)) {
+    zoo_code = zoo_multi(zoo_handle_, count, zoo_ops.data(), zoo_results.data());
+  } else {
+    zoo_code = AwaitReply(call, deadline, [&](void* context) {
+      return zoo_amulti(zoo_handle_, count, zoo_ops.data(), zoo_results.data(),
+                        PendingVoidCompletion, context);
+    });
+  }
+  Replied(span, sent, zoo_code);
+
+  ++write_sequence_;
+
+  if (zoo_code == ZOPERATIONTIMEOUT) {
+    // the reply may still be written into the buffers
+    if (results) {
+      results->assign(count, MultiResult());
+      for (auto& result : *results) result.code = zoo_code;
+    }
+    return zoo_code;
+  }
+
+  if (results) {
+    results->resize(count);
+    for (size_t i = 0; i < count; ++i) {
+      auto& result = (*results)[i];
+      result.code = zoo_results[i].err;
+      result.stat = stats[i];
+      if (ops.ops_[i].type == MultiOps::CREATE_OP && result.code == ZOK) {
+        result.path = path_buffers[i].c_str();
+      } else {
+        result.path.clear();
+      }
+    }
+  }
+
+  return zoo_code;
+}
+
+struct ZooKeeper::SyncFlight {
+  std::string path;
+  std::condition_variable done_cond;
+  bool done = false;
+  int code = ZOK;
+};
+
+int ZooKeeper::AwaitSync(const char* path) {
+  if (completion_thread_ == std::this_thread::get_id()) {
+    // the reply would be delivered on this thread
+    ++syncs_;
+    return zoo_async(zoo_handle_, path,
+                     [](int, const char*, const void*) {}, nullptr);
+  }
+
+  std::unique_lock<std::mutex> lock(sync_mutex_);
+  std::shared_ptr<SyncFlight> flight;
+  if (!sync_in_flight_) {
+    // nothing to wait for, sent right away
+    sync_in_flight_ = std::make_shared<SyncFlight>();
+    sync_in_flight_->path = path;
+    flight = sync_in_flight_;
+    auto zoo_code = SendSync();
+    if (zoo_code != ZOK) {
+      sync_in_flight_.reset();
+      return zoo_code;
+    }
+  } else {
+    // the sync in flight may have been sent before the call
+    if (!next_sync_) {
+      next_sync_ = std::make_shared<SyncFlight>();
+      next_sync_->path = path;
+    }
+    flight = next_sync_;
+  }
+
+  auto& shared = *flight;
+  auto deadline = operation_deadline();
+  auto done = [&shared]{ return shared.done; };
+  if (deadline == Deadline::max()) {
+    shared.done_cond.wait(lock, done);
+  } else if (!shared.done_cond.wait_until(lock, deadline, done)) {
+    return ZOPERATIONTIMEOUT;
+  }
+  return shared.code;
+}
+
+int ZooKeeper::SendSync() {
+  ++syncs_;
+  return zoo_async(zoo_handle_, sync_in_flight_->path.c_str(), SyncCompletion, this);
+}
+
+void ZooKeeper::SyncCompletion(int rc, const char*, const void* data) {
+  auto self = static_cast<ZooKeeper*>(const_cast<void*>(data));
+  self->completion_thread_ = std::this_thread::get_id();
+
+  std::lock_guard<std::mutex> lock(self->sync_mutex_);
+  // reads in flight before the sync completed can't be joined any more
+  ++self->write_sequence_;
+
+  auto& done = *self->sync_in_flight_;
+  done.code = rc;
+  done.done = true;
+  done.done_cond.notify_all();
+  self->sync_in_flight_.reset();
+
+  if (self->next_sync_) {
+    self->sync_in_flight_ = std::move(self->next_sync_);
+    auto zoo_code = self->SendSync();
+    if (zoo_code != ZOK) {
+      auto& failed = *self->sync_in_flight_;
+      failed.code = zoo_code;
+      failed.done = true;
+      failed.done_cond.notify_all();
+      self->sync_in_flight_.reset();
+    }
+  }
+}
+
+ZooResult<void> ZooKeeper::TrySync(PathView path) {
+  ScopedSpan span("Sync", path);
+  PathBuffer path_buffer(path);
+  auto sent = span.Mark();
+  auto zoo_code = AwaitSync(path_buffer.c_str());
+  Replied(span, sent, zoo_code);
+  return zoo_code;
+}
+
+void ZooKeeper::Sync(PathView path) {
+  TrySync(path).value();
+}
+
+void ZooKeeper::set_max_outstanding_requests(size_t limit, AdmissionMode mode) {
+  std::lock_guard<std::mutex> lock(admission_mutex_);
+  request_stats_.limit = limit;
+  admission_mode_ = mode;
+  slot_released_.notify_all();
+}
+
+RequestLimitStats ZooKeeper::request_limit_stats() {
+  std::lock_guard<std::mutex> lock(admission_mutex_);
+  return request_stats_;
+}
+
+int ZooKeeper::AdmitRequest() {
+  std::unique_lock<std::mutex> lock(admission_mutex_);
+  auto& stats = request_stats_;
+
+  auto has_slot = [&stats]{
+    return stats.limit == 0 || stats.outstanding < stats.limit;
+  };
+
+  if (!has_slot() && completion_thread_ != std::this_thread::get_id()) {
+    if (admission_mode_ == ADMISSION_REJECT) {
+      ++stats.rejected;
+      return ZOPERATIONTIMEOUT;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    auto deadline = operation_deadline();
+    if (deadline == Deadline::max()) {
+      slot_released_.wait(lock, has_slot);
+    } else if (!slot_released_.wait_until(lock, deadline, has_slot)) {
+      ++stats.rejected;
+      return ZOPERATIONTIMEOUT;
+    }
+    ++stats.waited;
+    stats.wait_time += std::chrono::steady_clock::now() - start;
+  }
+
+  ++stats.admitted;
+  ++stats.outstanding;
+  stats.peak_outstanding = std::max(stats.peak_outstanding, stats.outstanding);
+  return ZOK;
+}
+
+void ZooKeeper::ReleaseRequest() {
+  std::lock_guard<std::mutex> lock(admission_mutex_);
+  --request_stats_.outstanding;
+  slot_released_.notify_one();
+}
+
+int ZooKeeper::AdmitTraced(const char* name, PathView path,
+                           std::shared_ptr<AsyncSpan>* span) {
+  *span = AsyncSpan::Begin(name, path);
+  auto zoo_code = AdmitRequest();
+  if (*span) {
+    if (zoo_code == ZOK) {
+      (*span)->Sent();
+    } else {
+      (*span)->Failed(zoo_code);
+      span->reset();
+    }
   }
-  CHECK_ZOOCODE_AND_THROW(zoo_code);
+  return zoo_code;
+}
+
+// mzxid of the first stat among the callback's arguments, zero if none
+static int64_t TraceZxid() {
+  return 0;
+}
+
+template <typename... Rest>
+static int64_t TraceZxid(const NodeStat& stat, const Rest&...) {
+  return stat.mzxid;
 }
 
-std::string ZooKeeper::Get(const std::string& path, bool watch) {
-  std::string value_buffer;
+template <typename First, typename... Rest>
+static int64_t TraceZxid(const First&, const Rest&... rest) {
+  return TraceZxid(rest...);
+}
 
-  auto node_stat = Stat(path);
+template <typename Callback>
+Callback ZooKeeper::ReleasingSlot(Callback callback, std::shared_ptr<AsyncSpan> span) {
+  if (!span) {
+    return [this, callback](auto&&... args) {
+      // released first, so the callback can issue further requests
+      this->completion_thread_ = std::this_thread::get_id();
+      this->ReleaseRequest();
+      callback(std::forward<decltype(args)>(args)...);
+    };
+  }
 
-  value_buffer.resize(node_stat.dataLength);
+  return [this, callback, span](int rc, auto&&... args) {
+    this->completion_thread_ = std::this_thread::get_id();
+    this->ReleaseRequest();
+    span->CallbackStarted(rc, rc == ZOK ? TraceZxid(args...) : 0);
+    callback(rc, std::forward<decltype(args)>(args)...);
+    span->CallbackDone();
+  };
+}
 
-  int buffer_len = value_buffer.size();
-  auto zoo_code = zoo_get(zoo_handle_,
-                          path.c_str(),
-                          watch,
-                          const_cast<char*>(value_buffer.data()),
-                          &buffer_len,
-                          &node_stat);
+static void StatCompletion(int rc, const struct Stat* stat, const void* data) {
+  std::unique_ptr<StatCallback> callback(
+      static_cast<StatCallback*>(const_cast<void*>(data)));
+
+  NodeStat node_stat = NodeStat();
+  if (stat) node_stat = *stat;
+  (*callback)(rc, node_stat);
+}
 
-  CHECK_ZOOCODE_AND_THROW(zoo_code);
+static void GetCompletion(int rc, const char* value, int value_len,
+                          const struct Stat* stat, const void* data) {
+  std::unique_ptr<GetCallback> callback(
+      static_cast<GetCallback*>(const_cast<void*>(data)));
 
-  value_buffer.resize(buffer_len);
-  return value_buffer;
+  NodeStat node_stat = NodeStat();
+  if (stat) node_stat = *stat;
+
+  // node without data is reported with value_len of -1
+  (*callback)(rc, value, value_len > 0 ? value_len : 0, node_stat);
 }
 
-void ZooKeeper::Set(const std::string& path, const std::string& value) {
-  auto node_stat = Stat(path);
+static void VoidCompletion(int rc, const void* data) {
+  std::unique_ptr<VoidCallback> callback(
+      static_cast<VoidCallback*>(const_cast<void*>(data)));
+  (*callback)(rc);
+}
 
-  auto zoo_code = zoo_set(zoo_handle_,
-                          path.c_str(),
-                          value.data(),
-                          value.size(),
-                          node_stat.version);
+ZooResult<void> ZooKeeper::TryAsyncExists(PathView path, StatCallback callback, bool watch) {
+  PathBuffer path_buffer(path);
+  std::shared_ptr<AsyncSpan> span;
+  auto zoo_code = AdmitTraced("AsyncExists", path, &span);
+  if (zoo_code != ZOK) return zoo_code;
 
-  CHECK_ZOOCODE_AND_THROW(zoo_code);
+  auto context = new StatCallback(ReleasingSlot(std::move(callback), span));
+  zoo_code = zoo_aexists(zoo_handle_, path_buffer.c_str(), watch, StatCompletion, context);
+  if (zoo_code != ZOK) {
+    delete context;
+    ReleaseRequest();
+    if (span) span->Failed(zoo_code);
+  }
+  return zoo_code;
 }
 
-std::vector<std::string> ZooKeeper::GetChildren(const std::string& parent_path, bool watch) {
+void ZooKeeper::AsyncExists(PathView path, StatCallback callback, bool watch) {
+  TryAsyncExists(path, std::move(callback), watch).value();
+}
+
+ZooResult<void> ZooKeeper::TryAsyncGet(PathView path, GetCallback callback, bool watch) {
+  PathBuffer path_buffer(path);
+  std::shared_ptr<AsyncSpan> span;
+  auto zoo_code = AdmitTraced("AsyncGet", path, &span);
+  if (zoo_code != ZOK) return zoo_code;
+
+  auto context = new GetCallback(ReleasingSlot(std::move(callback), span));
+  zoo_code = zoo_aget(zoo_handle_, path_buffer.c_str(), watch, GetCompletion, context);
+  if (zoo_code != ZOK) {
+    delete context;
+    ReleaseRequest();
+    if (span) span->Failed(zoo_code);
+  }
+  return zoo_code;
+}
+
+void ZooKeeper::AsyncGet(PathView path, GetCallback callback, bool watch) {
+  TryAsyncGet(path, std::move(callback), watch).value();
+}
+
+static void CreateCompletion(int rc, const char* value, const void* data) {
+  std::unique_ptr<CreateCallback> callback(
+      static_cast<CreateCallback*>(const_cast<void*>(data)));
+  (*callback)(rc, value);
+}
+
+ZooResult<void> ZooKeeper::TryAsyncCreate(PathView path,
+                                          const std::string& value,
+                                          CreateCallback callback,
+                                          int flag) {
+  PathBuffer path_buffer(path);
+  std::shared_ptr<AsyncSpan> span;
+  auto zoo_code = AdmitTraced("AsyncCreate", path, &span);
+  if (zoo_code != ZOK) return zoo_code;
+
+  auto context = new CreateCallback(ReleasingSlot(std::move(callback), span));
+  zoo_code = zoo_acreate(zoo_handle_,
+                         path_buffer.c_str(),
+                         value.data(),
+                         value.size(),
+                         &ZOO_OPEN_ACL_UNSAFE,
+                         flag,
+                         CreateCompletion,
+                         context);
+  ++write_sequence_;
+  if (zoo_code != ZOK) {
+    delete context;
+    ReleaseRequest();
+    if (span) span->Failed(zoo_code);
+  }
+  return zoo_code;
+}
+
+void ZooKeeper::AsyncCreate(PathView path,
+                            const std::string& value,
+                            CreateCallback callback,
+                            int flag) {
+  TryAsyncCreate(path, value, std::move(callback), flag).value();
+}
+
+static void ChildrenCompletion(int rc, const struct String_vector* strings,
+                               const struct Stat* stat, const void* data) {
+  std::unique_ptr<ChildrenCallback> callback(
+      static_cast<ChildrenCallback*>(const_cast<void*>(data)));
+
   std::vector<std::string> children;
+  if (strings) {
+    children.reserve(strings->count);
+    for (int i = 0; i < strings->count; ++i) {
+      children.push_back(strings->data[i]);
+    }
+  }
 
-  struct String_vector child_vec;
+  NodeStat node_stat = NodeStat();
+  if (stat) node_stat = *stat;
+  (*callback)(rc, children, node_stat);
+}
 
-  auto zoo_code = zoo_get_children(zoo_handle_, parent_path.c_str(), watch, &child_vec);
-  CHECK_ZOOCODE_AND_THROW(zoo_code);
+ZooResult<void> ZooKeeper::TryAsyncGetChildren(PathView parent_path,
+                                               ChildrenCallback callback,
+                                               bool watch) {
+  PathBuffer path_buffer(parent_path);
+  std::shared_ptr<AsyncSpan> span;
+  auto zoo_code = AdmitTraced("AsyncGetChildren", parent_path, &span);
+  if (zoo_code != ZOK) return zoo_code;
 
-  children.reserve(child_vec.count);
-  for (int i = 0; i < child_vec.count; ++i) {
-    children.push_back(child_vec.data[i]);
+  auto context = new ChildrenCallback(ReleasingSlot(std::move(callback), span));
+  zoo_code = zoo_aget_children2(zoo_handle_, path_buffer.c_str(), watch,
+                                ChildrenCompletion, context);
+  if (zoo_code != ZOK) {
+    delete context;
+    ReleaseRequest();
+    if (span) span->Failed(zoo_code);
   }
+  return zoo_code;
+}
 
-  // TODO: release child_vec
-  return children;
+void ZooKeeper::AsyncGetChildren(PathView parent_path,
+                                 ChildrenCallback callback,
+                                 bool watch) {
+  TryAsyncGetChildren(parent_path, std::move(callback), watch).value();
 }
 
+ZooResult<void> ZooKeeper::TryAsyncDelete(PathView path, VoidCallback callback, int version) {
+  PathBuffer path_buffer(path);
+  std::shared_ptr<AsyncSpan> span;
+  auto zoo_code = AdmitTraced("AsyncDelete", path, &span);
+  if (zoo_code != ZOK) return zoo_code;
+
+  auto context = new VoidCallback(ReleasingSlot(std::move(callback), span));
+  zoo_code = zoo_adelete(zoo_handle_, path_buffer.c_str(), version, VoidCompletion, context);
+  ++write_sequence_;
+  if (zoo_code != ZOK) {
+    delete context;
+    ReleaseRequest();
+    if (span) span->Failed(zoo_code);
+  }
+  return zoo_code;
 }
 
+void ZooKeeper::AsyncDelete(PathView path, VoidCallback callback, int version) {
+  TryAsyncDelete(path, std::move(callback), version).value();
+}
+
+ZooResult<void> ZooKeeper::TryAsyncSync(PathView path, VoidCallback callback) {
+  PathBuffer path_buffer(path);
+  std::shared_ptr<AsyncSpan> span;
+  auto zoo_code = AdmitTraced("AsyncSync", path, &span);
+  if (zoo_code != ZOK) return zoo_code;
+
+  auto context = new VoidCallback(ReleasingSlot(std::move(callback), span));
+  zoo_code = zoo_async(zoo_handle_, path_buffer.c_str(),
+                       [](int rc, const char*, const void* data) {
+                         VoidCompletion(rc, data);
+                       }, context);
+  if (zoo_code != ZOK) {
+    delete context;
+    ReleaseRequest();
+    if (span) span->Failed(zoo_code);
+  }
+  return zoo_code;
+}
+
+void ZooKeeper::AsyncSync(PathView path, VoidCallback callback) {
+  TryAsyncSync(path, std::move(callback)).value();
+}
+
+void ZooKeeper::AddWatchListener(std::shared_ptr<WatchListener> listener) {
+  std::lock_guard<std::mutex> lock(listeners_mutex_);
+  listeners_.push_back(std::move(listener));
+}
+
+void ZooKeeper::RemoveWatchListener(const std::shared_ptr<WatchListener>& listener) {
+  std::lock_guard<std::mutex> lock(listeners_mutex_);
+  listeners_.erase(std::remove(listeners_.begin(), listeners_.end(), listener),
+                   listeners_.end());
+}
+
+}
@@ -1,10 +1,22 @@
 #pragma once
 #include <zookeeper/zookeeper.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
+#include "zookeeper_error.hpp"
+#include "zookeeper_path.hpp"
 
 namespace zookeeper {
 
+class AsyncSpan;
+
 class ZooWatcher {
 public:
   virtual ~ZooWatcher() {}
@@ -12,6 +24,8 @@ public:
   virtual void OnConnected() = 0;
   virtual void OnConnecting() = 0;
   virtual void OnSessionExpired() = 0;
+  // connected to a server partitioned from the quorum, serving reads only
+  virtual void OnReadOnlyConnected() { OnConnected(); }
 
   virtual void OnCreated(const char* path) = 0;
   virtual void OnDeleted(const char* path) = 0;
@@ -20,13 +34,222 @@ public:
   virtual void OnNotWatching(const char* path) = 0;
 };
 
+// Sees the event of every watch set on a handle, before its global
+// watcher does. Called on the completion thread.
+class WatchListener {
+public:
+  virtual ~WatchListener() {}
+
+  virtual void OnWatchEvent(int type, int state, const char* path) = 0;
+};
+
 typedef Stat NodeStat;
 
+// A batch of operations committed atomically by ZooKeeper::Multi.
+class MultiOps {
+public:
+  void Create(const std::string& path,
+              const std::string& value = std::string(),
+              int flag = 0);
+
+  void Delete(const std::string& path, int version = -1);
+
+  void Set(const std::string& path, const std::string& value, int version = -1);
+
+  void Check(const std::string& path, int version);
+
+  size_t size() const {
+    return ops_.size();
+  }
+
+  bool empty() const {
+    return ops_.empty();
+  }
+
+  void clear() {
+    ops_.clear();
+  }
+
+private:
+  friend class ZooKeeper;
+
+  enum OpType { CREATE_OP, DELETE_OP, SET_OP, CHECK_OP };
+
+  struct Op {
+    OpType type;
+    std::string path;
+    std::string value;
+    int flag;
+    int version;
+  };
+
+  std::vector<Op> ops_;
+};
+
+struct MultiResult {
+  int code = ZOK;
+  // created path of a Create operation
+  std::string path;
+  // stat of a Set operation
+  NodeStat stat = NodeStat();
+};
+
+// Completion callbacks of the asynchronous operations. They are invoked on
+// the zookeeper client's completion thread, so they must not block on other
+// requests of the same handle.
+typedef std::function<void(int code, const char* value, int value_len,
+                           const NodeStat& stat)> GetCallback;
+typedef std::function<void(int code, const NodeStat& stat)> StatCallback;
+typedef std::function<void(int code)> VoidCallback;
+typedef std::function<void(int code, const char* path)> CreateCallback;
+typedef std::function<void(int code, const std::vector<std::string>& children,
+                           const NodeStat& stat)> ChildrenCallback;
+
+// Value of an operation, or the zookeeper code it failed with. Errors such
+// as ZNONODE are routine for some callers; checking code() costs neither an
+// exception nor a message string.
+template <typename T>
+class ZooResult {
+public:
+  ZooResult(T value)
+  : value_(std::move(value)) {
+  }
+
+  static ZooResult Error(int code) {
+    ZooResult result{T()};
+    result.code_ = code;
+    return result;
+  }
+
+  bool ok() const {
+    return code_ == ZOK;
+  }
+
+  explicit operator bool() const {
+    return ok();
+  }
+
+  int code() const {
+    return code_;
+  }
+
+  // the value, throws ZooException on error
+  const T& value() const & {
+    if (!ok()) throw ZooException(code_);
+    return value_;
+  }
+
+  T&& value() && {
+    if (!ok()) throw ZooException(code_);
+    return std::move(value_);
+  }
+
+  T value_or(T default_value) const {
+    return ok() ? value_ : std::move(default_value);
+  }
+
+  const T& operator*() const {
+    return value_;
+  }
+
+  const T* operator->() const {
+    return &value_;
+  }
+
+private:
+  int code_ = ZOK;
+  T value_;
+};
+
+template <>
+class ZooResult<void> {
+public:
+  ZooResult(int code = ZOK)
+  : code_(code) {
+  }
+
+  static ZooResult Error(int code) {
+    return ZooResult(code);
+  }
+
+  bool ok() const {
+    return code_ == ZOK;
+  }
+
+  explicit operator bool() const {
+    return ok();
+  }
+
+  int code() const {
+    return code_;
+  }
+
+  // throws ZooException on error
+  void value() const {
+    if (!ok()) throw ZooException(code_);
+  }
+
+private:
+  int code_;
+};
+
+typedef std::chrono::steady_clock::time_point Deadline;
+
+// what an asynchronous request does when the outstanding requests are at
+// their limit
+enum AdmissionMode {
+  // wait for a slot until the operation deadline
+  ADMISSION_WAIT,
+  // throw ZooException with ZOPERATIONTIMEOUT right away
+  ADMISSION_REJECT,
+};
+
+struct RequestLimitStats {
+  // configured cap of outstanding asynchronous requests, zero for none
+  size_t limit = 0;
+  size_t outstanding = 0;
+  size_t peak_outstanding = 0;
+  uint64_t admitted = 0;
+  // admitted requests which waited for a slot, and their total wait
+  uint64_t waited = 0;
+  std::chrono::nanoseconds wait_time{0};
+  uint64_t rejected = 0;
+};
+
+// Bound the blocking operations made by the calling thread while in scope.
+// An operation still pending at the deadline throws ZooException with
+// ZOPERATIONTIMEOUT; its reply is dropped when it arrives. Nested scopes can
+// only shorten the deadline.
+class ScopedDeadline {
+public:
+  explicit ScopedDeadline(Deadline deadline);
+  explicit ScopedDeadline(std::chrono::milliseconds timeout);
+
+  ~ScopedDeadline();
+
+  // disable copy
+  ScopedDeadline(const ScopedDeadline&) = delete;
+  ScopedDeadline& operator=(const ScopedDeadline&) = delete;
+
+  // deadline of the calling thread, Deadline::max() if none
+  static Deadline current();
+
+private:
+  Deadline previous_;
+};
+
+// Every operation is a span of the tracer installed with SetTracer, see
+// zookeeper_trace.hpp.
 class ZooKeeper {
 public:
+  // With |read_only| (ZOO_READONLY) the session may connect to a server
+  // cut off from the quorum, e.g. an observer, and keep serving reads
+  // there; writes fail with ZNOTREADONLY meanwhile. It needs a client
+  // library supporting read-only mode, throws ZUNIMPLEMENTED otherwise.
   ZooKeeper(const std::string& server_hosts,
             ZooWatcher* global_watcher = nullptr,
-            int timeout_ms = 5 * 1000);
+            int timeout_ms = 5 * 1000,
+            bool read_only = false);
 
   ~ZooKeeper();
 
@@ -36,34 +259,246 @@ public:
 
   bool is_connected();
   bool is_expired();
+  // connected in read-only mode
+  bool is_read_only();
+
+  // "ip:port" of the server the session is connected to, empty if none
+  std::string connected_server();
+
+  // Replace the servers the session may connect to; it moves to one of
+  // them if its server isn't listed. Needs a client library with
+  // zoo_set_servers (3.5), fails with ZUNIMPLEMENTED otherwise.
+  ZooResult<void> TrySetServers(const std::string& server_hosts);
+
+  // Timeout of each blocking operation, zero for none. A ScopedDeadline of
+  // the calling thread applies too, whichever ends first. Operations called
+  // from a watcher can't be bounded and wait for their reply as before.
+  void set_operation_timeout(std::chrono::milliseconds timeout) {
+    operation_timeout_ms_ = timeout.count();
+  }
+
+  std::chrono::milliseconds operation_timeout() const {
+    return std::chrono::milliseconds(operation_timeout_ms_);
+  }
+
+  // deadline of a blocking operation started now
+  Deadline operation_deadline() const;
+
+  // Cap the asynchronous requests in flight on this handle, zero for none.
+  // A burst of pipelined requests otherwise queues unbounded work in the
+  // client library, which delays pings and can expire the session. Blocking
+  // operations, used for session upkeep, bypass the cap, and so do requests
+  // issued from a completion, which would wait on their own thread.
+  void set_max_outstanding_requests(size_t limit, AdmissionMode mode = ADMISSION_WAIT);
+
+  RequestLimitStats request_limit_stats();
+
+  // Concurrent Get or GetChildren calls with the same path and watch flag
+  // share a single request and its result. A call joins only a request
+  // sent after the last write through this handle, so the session still
+  // reads its own writes. Enabled by default.
+  void set_coalesce_reads(bool enable) {
+    coalesce_reads_ = enable;
+  }
+
+  // calls answered by joining another call's request
+  uint64_t coalesced_reads() const {
+    return coalesced_reads_;
+  }
 
-  bool Exists(const std::string& path, bool watch = false, NodeStat* = nullptr);
+  // Blocking reads sync first, so they see every write committed before
+  // they were called, by any client. Concurrent reads share a sync: one
+  // arriving while a sync is in flight joins the next, sent as the first
+  // completes, so a batch of reads costs one extra round trip. Reads from
+  // a completion don't wait for their sync, the session orders them after
+  // it. Disabled by default.
+  void set_sync_reads(bool enable) {
+    sync_reads_ = enable;
+  }
 
-  NodeStat Stat(const std::string& path);
+  // syncs sent for sync reads and blocking Sync calls
+  uint64_t syncs() const {
+    return syncs_;
+  }
 
-  std::string Create(const std::string& path,
+  // Operations returning their error code instead of throwing, the
+  // throwing operations below are built on them.
+  ZooResult<NodeStat> TryStat(PathView path, bool watch = false);
+
+  ZooResult<std::string> TryCreate(PathView path,
+                                   const std::string& value = std::string(),
+                                   int flag = 0);
+
+  ZooResult<void> TryDelete(PathView path, int version = -1);
+
+  ZooResult<void> TrySet(PathView path,
+                         const std::string& value,
+                         int version = -1);
+
+  ZooResult<std::string> TryGet(PathView path, bool watch = false);
+
+  ZooResult<std::vector<std::string>> TryGetChildren(PathView parent_path,
+                                                     bool watch = false);
+
+  ZooResult<void> TryMulti(const MultiOps& ops,
+                           std::vector<MultiResult>* results = nullptr);
+
+  // Catch the server of this session up with the leader, as of a moment
+  // after the call. Shares a sync in flight the way sync reads do; the
+  // server catches up entirely, whatever the path.
+  ZooResult<void> TrySync(PathView path);
+
+  bool Exists(PathView path, bool watch = false, NodeStat* = nullptr);
+
+  NodeStat Stat(PathView path);
+
+  std::string Create(PathView path,
                      const std::string& value = std::string(),
                      int flag = 0);
 
-  std::string CreateIfNotExists(const std::string& path,
+  std::string CreateIfNotExists(PathView path,
                                 const std::string& value = std::string(),
                                 int flag = 0);
 
-  void Delete(const std::string& path);
+  void Delete(PathView path);
+
+  void DeleteIfExists(PathView path);
+
+  void Set(PathView path, const std::string& value);
+
+  std::string Get(PathView path, bool watch = false);
+
+  std::vector<std::string> GetChildren(PathView parent_path, bool watch = false);
 
-  void DeleteIfExists(const std::string& path);
+  // Commit all operations atomically. Throws ZooException with the code of
+  // the first failed operation; per operation results are stored into
+  // |results| in both cases.
+  void Multi(const MultiOps& ops, std::vector<MultiResult>* results = nullptr);
 
-  void Set(const std::string&path, const std::string& value);
+  void Sync(PathView path);
 
-  std::string Get(const std::string& path, bool watch = false);
+  // Asynchronous operations, requests issued back to back are pipelined
+  // over the session's connection. The Try ones return the code of a
+  // request that couldn't be issued, ZOPERATIONTIMEOUT if refused by the
+  // outstanding request cap, and never call |callback| then; the others
+  // throw it.
+  ZooResult<void> TryAsyncExists(PathView path, StatCallback callback, bool watch = false);
 
-  std::vector<std::string> GetChildren(const std::string& parent_path, bool watch = false);
+  ZooResult<void> TryAsyncGet(PathView path, GetCallback callback, bool watch = false);
+
+  ZooResult<void> TryAsyncGetChildren(PathView parent_path,
+                                      ChildrenCallback callback,
+                                      bool watch = false);
+
+  ZooResult<void> TryAsyncCreate(PathView path,
+                                 const std::string& value,
+                                 CreateCallback callback,
+                                 int flag = 0);
+
+  ZooResult<void> TryAsyncDelete(PathView path, VoidCallback callback, int version = -1);
+
+  ZooResult<void> TryAsyncSync(PathView path, VoidCallback callback);
+
+  void AsyncExists(PathView path, StatCallback callback, bool watch = false);
+
+  void AsyncGet(PathView path, GetCallback callback, bool watch = false);
+
+  void AsyncGetChildren(PathView parent_path,
+                        ChildrenCallback callback,
+                        bool watch = false);
+
+  void AsyncCreate(PathView path,
+                   const std::string& value,
+                   CreateCallback callback,
+                   int flag = 0);
+
+  void AsyncDelete(PathView path, VoidCallback callback, int version = -1);
+
+  // A sync of its own; requests issued after it are served on the synced
+  // state without waiting for |callback|.
+  void AsyncSync(PathView path, VoidCallback callback);
+
+  // A removed listener may still see an event being dispatched.
+  void AddWatchListener(std::shared_ptr<WatchListener> listener);
+  void RemoveWatchListener(const std::shared_ptr<WatchListener>& listener);
 
 private:
   zhandle_t* zoo_handle_ = nullptr;
 
   ZooWatcher* global_watcher_ = nullptr;
 
+  std::mutex listeners_mutex_;
+  std::vector<std::shared_ptr<WatchListener>> listeners_;
+
+  std::atomic<int64_t> operation_timeout_ms_{0};
+
+  // admission of asynchronous requests
+  std::mutex admission_mutex_;
+  std::condition_variable slot_released_;
+  AdmissionMode admission_mode_ = ADMISSION_WAIT;
+  RequestLimitStats request_stats_;
+
+  // ZOK, or ZOPERATIONTIMEOUT if no slot is free in time
+  int AdmitRequest();
+  void ReleaseRequest();
+
+  // AdmitRequest within the span of the request, |span| is left null while
+  // not tracing
+  int AdmitTraced(const char* name, PathView path, std::shared_ptr<AsyncSpan>* span);
+
+  // |callback| releasing the request slot first, and ending |span|
+  template <typename Callback>
+  Callback ReleasingSlot(Callback callback, std::shared_ptr<AsyncSpan> span);
+
+  // read shared by concurrent identical calls
+  struct ReadFlight;
+
+  std::atomic<bool> coalesce_reads_{true};
+  std::atomic<uint64_t> coalesced_reads_{0};
+  // bumped by every write, reads in flight before it can't be joined
+  std::atomic<uint64_t> write_sequence_{0};
+
+  std::mutex flights_mutex_;
+  std::map<std::string, std::shared_ptr<ReadFlight>> flights_;
+
+  template <typename Read>
+  int CoalescedRead(const std::string& key,
+                    std::shared_ptr<ReadFlight>* flight,
+                    const Read& read);
+
+  // sync shared by concurrent blocking reads and Sync calls
+  struct SyncFlight;
+
+  std::atomic<bool> sync_reads_{false};
+  std::atomic<uint64_t> syncs_{0};
+
+  std::mutex sync_mutex_;
+  // the sync awaiting its reply, and the one joined meanwhile, sent next
+  std::shared_ptr<SyncFlight> sync_in_flight_;
+  std::shared_ptr<SyncFlight> next_sync_;
+
+  int AwaitSync(const char* path);
+  // with sync_mutex_ held
+  int SendSync();
+  static void SyncCompletion(int rc, const char* value, const void* data);
+
+  // watchers and completions run on it, replies can't be awaited there
+  std::atomic<std::thread::id> completion_thread_{};
+
+  // Counterparts of the synchronous zoo_* calls honoring the operation
+  // deadline, returning its zookeeper code
+  bool BoundedCall(Deadline* deadline) const;
+  int TimedExists(const char* path, bool watch, NodeStat* stat);
+  int TimedCreate(const char* path, const std::string& value, int flag,
+                  std::string* created_path);
+  int TimedDelete(const char* path, int version);
+  int TimedGet(const char* path, bool watch, std::string* value,
+               NodeStat* stat);
+  int TimedSet(const char* path, const std::string& value, int version,
+               NodeStat* stat);
+  int TimedGetChildren(const char* path, bool watch,
+                       std::vector<std::string>* children);
+
   void WatchHandler(int type, int state, const char* path);
 
   static void GlobalWatchFunc(zhandle_t*, int type, int state,
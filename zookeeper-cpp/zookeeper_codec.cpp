@@ -0,0 +1,338 @@
+#include "zookeeper_codec.hpp"
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <time.h>
+#include "zookeeper_error.hpp"
+#include "zookeeper_ext.hpp"
+
+namespace zookeeper {
+
+namespace {
+
+// FastCodec stream: varint raw size, then sequences of
+//   token[1] literal_length_ext[...] literals[...] offset[2] match_length_ext[...]
+// where the token holds literal length in its high and match length - 4 in
+// its low nibble, 15 meaning more length bytes follow. The last sequence
+// carries literals only.
+const size_t MIN_MATCH = 4;
+const size_t MAX_OFFSET = 65535;
+const int HASH_BITS = 12;
+
+uint32_t Read32(const char* p) {
+  uint32_t value;
+  memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+uint32_t Hash(uint32_t value) {
+  return (value * 2654435761u) >> (32 - HASH_BITS);
+}
+
+void PutLengthExtension(size_t length, std::string* output) {
+  for (; length >= 255; length -= 255) {
+    output->push_back(static_cast<char>(255));
+  }
+  output->push_back(static_cast<char>(length));
+}
+
+void PutSequence(const char* literals, size_t literal_length,
+                 size_t offset, size_t match_length, std::string* output) {
+  auto literal_token = literal_length < 15 ? literal_length : 15;
+  auto match_token = 0;
+  if (match_length) {
+    match_token = match_length - MIN_MATCH < 15 ? match_length - MIN_MATCH : 15;
+  }
+  output->push_back(static_cast<char>((literal_token << 4) | match_token));
+
+  if (literal_length >= 15) {
+    PutLengthExtension(literal_length - 15, output);
+  }
+  output->append(literals, literal_length);
+
+  if (match_length) {
+    output->push_back(static_cast<char>(offset & 0xff));
+    output->push_back(static_cast<char>(offset >> 8));
+    if (match_length - MIN_MATCH >= 15) {
+      PutLengthExtension(match_length - MIN_MATCH - 15, output);
+    }
+  }
+}
+
+bool GetLengthExtension(const uint8_t** p, const uint8_t* end, size_t* length) {
+  uint8_t byte;
+  do {
+    if (*p == end) return false;
+    byte = *(*p)++;
+    *length += byte;
+  } while (byte == 255);
+  return true;
+}
+
+int64_t ThreadCpuNanos() {
+  timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+}
+
+const uint8_t FastCodec::ID;
+
+void FastCodec::Compress(const char* data, size_t size, std::string* output) const {
+  // raw size, so the reader can allocate the output once
+  for (auto n = size; ; n >>= 7) {
+    if (n < 0x80) {
+      output->push_back(static_cast<char>(n));
+      break;
+    }
+    output->push_back(static_cast<char>((n & 0x7f) | 0x80));
+  }
+
+  int64_t table[1 << HASH_BITS];
+  std::fill(std::begin(table), std::end(table), -1);
+
+  size_t anchor = 0;
+  size_t i = 0;
+  while (i + MIN_MATCH <= size) {
+    auto value = Read32(data + i);
+    auto& slot = table[Hash(value)];
+    auto candidate = slot;
+    slot = i;
+
+    if (candidate < 0
+        || i - candidate > MAX_OFFSET
+        || Read32(data + candidate) != value) {
+      ++i;
+      continue;
+    }
+
+    auto match_length = MIN_MATCH;
+    while (i + match_length < size
+           && data[candidate + match_length] == data[i + match_length]) {
+      ++match_length;
+    }
+
+    PutSequence(data + anchor, i - anchor, i - candidate, match_length, output);
+    i += match_length;
+    anchor = i;
+  }
+
+  PutSequence(data + anchor, size - anchor, 0, 0, output);
+}
+
+bool FastCodec::Decompress(const char* data, size_t size, std::string* output) const {
+  auto p = reinterpret_cast<const uint8_t*>(data);
+  auto end = p + size;
+
+  size_t raw_size = 0;
+  for (int shift = 0; ; shift += 7) {
+    if (p == end || shift > 63) return false;
+    auto byte = *p++;
+    raw_size |= static_cast<size_t>(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) break;
+  }
+
+  // a sequence expands to at most 255 bytes per input byte
+  if (raw_size / 255 > size) return false;
+
+  auto base = output->size();
+  output->resize(base + raw_size);
+  auto out = &(*output)[base];
+  size_t produced = 0;
+
+  while (true) {
+    if (p == end) return false;
+    auto token = *p++;
+
+    size_t literal_length = token >> 4;
+    if (literal_length == 15 && !GetLengthExtension(&p, end, &literal_length)) {
+      return false;
+    }
+    if (literal_length > static_cast<size_t>(end - p)
+        || literal_length > raw_size - produced) {
+      return false;
+    }
+    memcpy(out + produced, p, literal_length);
+    p += literal_length;
+    produced += literal_length;
+
+    if (p == end) {
+      // last sequence
+      return produced == raw_size;
+    }
+
+    if (end - p < 2) return false;
+    size_t offset = p[0] | (p[1] << 8);
+    p += 2;
+
+    size_t match_length = token & 0x0f;
+    if (match_length == 15 && !GetLengthExtension(&p, end, &match_length)) {
+      return false;
+    }
+    match_length += MIN_MATCH;
+
+    if (offset == 0 || offset > produced || match_length > raw_size - produced) {
+      return false;
+    }
+
+    // overlapping copy repeats the last |offset| bytes
+    auto from = out + produced - offset;
+    auto to = out + produced;
+    if (offset >= match_length) {
+      memcpy(to, from, match_length);
+    } else {
+      for (size_t k = 0; k < match_length; ++k) to[k] = from[k];
+    }
+    produced += match_length;
+  }
+}
+
+CompressedZooKeeper::CompressedZooKeeper(ZooKeeper& zk,
+                                         std::shared_ptr<const ValueCodec> codec,
+                                         size_t min_size)
+: zk_(zk),
+  codec_(codec ? codec : std::make_shared<FastCodec>()),
+  min_size_(min_size) {
+  RegisterCodec(std::make_shared<FastCodec>());
+  RegisterCodec(codec_);
+}
+
+void CompressedZooKeeper::RegisterCodec(std::shared_ptr<const ValueCodec> codec) {
+  if (codec->id() == 0) {
+    throw ZooException(ZBADARGUMENTS, "codec id 0 is reserved");
+  }
+  codecs_[codec->id()] = std::move(codec);
+}
+
+const std::string& CompressedZooKeeper::Encode(const std::string& value,
+                                               CodecStats* stats) {
+  static thread_local std::string buffer;
+  buffer.clear();
+
+  CodecStats local;
+  local.value_size = value.size();
+
+  if (value.size() >= min_size_) {
+    auto start = ThreadCpuNanos();
+    buffer.push_back(static_cast<char>(codec_->id()));
+    codec_->Compress(value.data(), value.size(), &buffer);
+    local.cpu_time = std::chrono::nanoseconds(ThreadCpuNanos() - start);
+    local.codec = codec_->id();
+
+    if (buffer.size() >= value.size() + 1) {
+      // incompressible
+      buffer.clear();
+      local.codec = 0;
+    }
+  }
+
+  if (local.codec == 0) {
+    buffer.push_back(0);
+    buffer.append(value);
+  }
+  local.stored_size = buffer.size();
+
+  ++encoded_;
+  value_bytes_ += local.value_size;
+  stored_bytes_ += local.stored_size;
+  encode_ns_ += local.cpu_time.count();
+
+  if (stats) *stats = local;
+  return buffer;
+}
+
+void CompressedZooKeeper::Decode(const char* data, size_t size,
+                                 std::string* value, CodecStats* stats) {
+  value->clear();
+  if (size == 0) {
+    throw ZooException(ZMARSHALLINGERROR, "value without codec header");
+  }
+
+  CodecStats local;
+  local.codec = static_cast<uint8_t>(data[0]);
+  local.stored_size = size;
+
+  if (local.codec == 0) {
+    value->assign(data + 1, size - 1);
+  } else {
+    auto& codec = codecs_[local.codec];
+    if (!codec) {
+      throw ZooException(ZMARSHALLINGERROR, "value of unknown codec");
+    }
+
+    auto start = ThreadCpuNanos();
+    auto ok = codec->Decompress(data + 1, size - 1, value);
+    local.cpu_time = std::chrono::nanoseconds(ThreadCpuNanos() - start);
+    if (!ok) {
+      throw ZooException(ZMARSHALLINGERROR, "corrupted compressed value");
+    }
+  }
+  local.value_size = value->size();
+
+  ++decoded_;
+  decode_ns_ += local.cpu_time.count();
+
+  if (stats) *stats = local;
+}
+
+std::string CompressedZooKeeper::Create(const std::string& path,
+                                        const std::string& value,
+                                        int flag,
+                                        CodecStats* stats) {
+  return zk_.Create(path, Encode(value, stats), flag);
+}
+
+void CompressedZooKeeper::Set(const std::string& path,
+                              const std::string& value,
+                              CodecStats* stats) {
+  zk_.Set(path, Encode(value, stats));
+}
+
+std::string CompressedZooKeeper::Get(const std::string& path,
+                                     bool watch,
+                                     CodecStats* stats) {
+  std::string value;
+  Get(path, &value, watch, stats);
+  return value;
+}
+
+void CompressedZooKeeper::Get(const std::string& path,
+                              std::string* value,
+                              bool watch,
+                              CodecStats* stats) {
+  int zoo_code = ZOK;
+  std::exception_ptr error;
+
+  PipelinedGet(zk_, {path},
+               [&](size_t, int code, const char* data, int data_len,
+                   const NodeStat&) {
+    zoo_code = code;
+    if (code != ZOK) return;
+    try {
+      Decode(data, data_len, value, stats);
+    } catch (...) {
+      error = std::current_exception();
+    }
+  }, watch);
+
+  if (zoo_code != ZOK) {
+    throw ZooException(zoo_code);
+  }
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+CodecTotals CompressedZooKeeper::totals() const {
+  CodecTotals totals;
+  totals.encoded = encoded_;
+  totals.decoded = decoded_;
+  totals.value_bytes = value_bytes_;
+  totals.stored_bytes = stored_bytes_;
+  totals.encode_time = std::chrono::nanoseconds(encode_ns_);
+  totals.decode_time = std::chrono::nanoseconds(decode_ns_);
+  return totals;
+}
+
+}
@@ -0,0 +1,134 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include "zookeeper.hpp"
+
+namespace zookeeper {
+
+// Compression codec of node values. Implementations must be thread safe.
+class ValueCodec {
+public:
+  virtual ~ValueCodec() {}
+
+  // stored in the header byte of each value, 0 is reserved for values
+  // stored uncompressed
+  virtual uint8_t id() const = 0;
+
+  virtual const char* name() const = 0;
+
+  // append the compressed form of |data| to |output|
+  virtual void Compress(const char* data, size_t size, std::string* output) const = 0;
+
+  // append the decompressed form of |data| to |output|, false if |data|
+  // is corrupted
+  virtual bool Decompress(const char* data, size_t size, std::string* output) const = 0;
+};
+
+// Built-in LZ77 codec in the spirit of LZ4, favouring speed over ratio.
+class FastCodec : public ValueCodec {
+public:
+  static const uint8_t ID = 1;
+
+  uint8_t id() const override {
+    return ID;
+  }
+
+  const char* name() const override {
+    return "fast";
+  }
+
+  void Compress(const char* data, size_t size, std::string* output) const override;
+  bool Decompress(const char* data, size_t size, std::string* output) const override;
+};
+
+// codec work done for a single operation
+struct CodecStats {
+  uint8_t codec = 0;
+  // size of the value seen by the caller
+  size_t value_size = 0;
+  // size of the value stored in zookeeper, header byte included
+  size_t stored_size = 0;
+  // thread cpu time spent compressing or decompressing
+  std::chrono::nanoseconds cpu_time{0};
+
+  int64_t bytes_saved() const {
+    return static_cast<int64_t>(value_size) - static_cast<int64_t>(stored_size);
+  }
+};
+
+struct CodecTotals {
+  uint64_t encoded = 0;
+  uint64_t decoded = 0;
+  // sizes of encoded values, before and after compression
+  uint64_t value_bytes = 0;
+  uint64_t stored_bytes = 0;
+  std::chrono::nanoseconds encode_time{0};
+  std::chrono::nanoseconds decode_time{0};
+};
+
+// Create/Set/Get of compressed values on top of a ZooKeeper handle.
+//
+// Each stored value starts with a header byte naming its codec, so values
+// written with any registered codec can be read back. Values below
+// |min_size|, or which don't shrink, are stored uncompressed. Nodes must
+// be written through this layer to be read by it.
+class CompressedZooKeeper {
+public:
+  explicit CompressedZooKeeper(ZooKeeper& zk,
+                               std::shared_ptr<const ValueCodec> codec = nullptr,
+                               size_t min_size = 64);
+
+  // disable copy
+  CompressedZooKeeper(const CompressedZooKeeper&) = delete;
+  CompressedZooKeeper& operator=(const CompressedZooKeeper&) = delete;
+
+  // make values written with |codec| readable, FastCodec is registered
+  // already
+  void RegisterCodec(std::shared_ptr<const ValueCodec> codec);
+
+  std::string Create(const std::string& path,
+                     const std::string& value = std::string(),
+                     int flag = 0,
+                     CodecStats* stats = nullptr);
+
+  void Set(const std::string& path,
+           const std::string& value,
+           CodecStats* stats = nullptr);
+
+  std::string Get(const std::string& path,
+                  bool watch = false,
+                  CodecStats* stats = nullptr);
+
+  // Decompress straight from the received reply into |value|, reusing its
+  // capacity. Must not be called from a watcher or completion callback.
+  void Get(const std::string& path,
+           std::string* value,
+           bool watch = false,
+           CodecStats* stats = nullptr);
+
+  CodecTotals totals() const;
+
+private:
+  // encoded value in a buffer reused by the calling thread
+  const std::string& Encode(const std::string& value, CodecStats* stats);
+  void Decode(const char* data, size_t size, std::string* value, CodecStats* stats);
+
+  ZooKeeper& zk_;
+  const std::shared_ptr<const ValueCodec> codec_;
+  const size_t min_size_;
+
+  // indexed by codec id, written only before the layer is shared
+  std::shared_ptr<const ValueCodec> codecs_[256];
+
+  std::atomic<uint64_t> encoded_{0};
+  std::atomic<uint64_t> decoded_{0};
+  std::atomic<uint64_t> value_bytes_{0};
+  std::atomic<uint64_t> stored_bytes_{0};
+  std::atomic<int64_t> encode_ns_{0};
+  std::atomic<int64_t> decode_ns_{0};
+};
+
+}
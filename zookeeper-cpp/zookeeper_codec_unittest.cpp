@@ -0,0 +1,114 @@
+#include "zookeeper.hpp"
+#include "zookeeper_codec.hpp"
+#include "zookeeper_error.hpp"
+#include <gtest/gtest.h>
+#include "zookeeper_unittest_helper.hpp"
+
+using namespace zookeeper;
+using namespace testing;
+
+static std::string Compress(const std::string& value) {
+  std::string compressed;
+  FastCodec().Compress(value.data(), value.size(), &compressed);
+  return compressed;
+}
+
+static std::string Decompress(const std::string& compressed) {
+  std::string value;
+  EXPECT_TRUE(FastCodec().Decompress(compressed.data(), compressed.size(), &value));
+  return value;
+}
+
+static std::string JsonLikeValue(int records) {
+  std::string value = "[";
+  for (int i = 0; i < records; ++i) {
+    value += "{\"id\":" + std::to_string(i) + ",\"host\":\"10.0.0." +
+             std::to_string(i % 256) + "\",\"port\":8080,\"weight\":1},";
+  }
+  value += "]";
+  return value;
+}
+
+TEST(FastCodec, RoundTrip) {
+  std::vector<std::string> values = {
+    "", "a", "abc", "abcd", "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa",
+    "abcabcabcabcabcabcabcabcabcabcabcabcabcabcabcabcabcabcabcabcabc",
+    JsonLikeValue(1000),
+  };
+
+  std::string random(100000, '\0');
+  uint32_t seed = 12345;
+  for (auto& c : random) {
+    seed = seed * 1103515245 + 12345;
+    c = static_cast<char>(seed >> 24);
+  }
+  values.push_back(random);
+  values.push_back(std::string(70000, 'x') + random.substr(0, 1000) + std::string(300, 'y'));
+
+  for (auto& value : values) {
+    EXPECT_EQ(Decompress(Compress(value)), value);
+  }
+
+  EXPECT_LT(Compress(JsonLikeValue(1000)).size(), JsonLikeValue(1000).size() / 3);
+}
+
+TEST(FastCodec, DecompressAppendsToOutput) {
+  std::string output = "prefix";
+  auto compressed = Compress("hello hello hello hello");
+  EXPECT_TRUE(FastCodec().Decompress(compressed.data(), compressed.size(), &output));
+  EXPECT_EQ(output, "prefixhello hello hello hello");
+}
+
+TEST(FastCodec, RejectCorruptedInput) {
+  auto compressed = Compress(JsonLikeValue(100));
+  std::string output;
+
+  EXPECT_FALSE(FastCodec().Decompress(compressed.data(), compressed.size() / 2, &output));
+
+  output.clear();
+  auto corrupted = compressed;
+  corrupted[0] = static_cast<char>(0xff);
+  EXPECT_FALSE(FastCodec().Decompress(corrupted.data(), corrupted.size(), &output));
+
+  output.clear();
+  EXPECT_FALSE(FastCodec().Decompress("", 0, &output));
+}
+
+TEST_F(ZooKeeperTest, CompressedCreateThenGet) {
+  CompressedZooKeeper czk(zk);
+
+  auto value = JsonLikeValue(200);
+  CodecStats stats;
+  czk.Create("/test", value, 0, &stats);
+  EXPECT_EQ(stats.codec, FastCodec::ID);
+  EXPECT_EQ(stats.value_size, value.size());
+  EXPECT_GT(stats.bytes_saved(), 0);
+
+  EXPECT_EQ(zk.Get("/test").size(), stats.stored_size);
+  EXPECT_EQ(czk.Get("/test", false, &stats), value);
+  EXPECT_EQ(stats.value_size, value.size());
+
+  // small values are stored as they are
+  czk.Set("/test", "abc", &stats);
+  EXPECT_EQ(stats.codec, 0);
+  EXPECT_EQ(zk.Get("/test"), std::string("\0abc", 4));
+
+  std::string buffer;
+  czk.Get("/test", &buffer);
+  EXPECT_EQ(buffer, "abc");
+
+  auto totals = czk.totals();
+  EXPECT_EQ(totals.encoded, 2u);
+  EXPECT_EQ(totals.decoded, 2u);
+
+  zk.Delete("/test");
+}
+
+TEST_F(ZooKeeperTest, CompressedGetOfUnknownCodec) {
+  zk.Create("/test", "\x7f" "abc");
+
+  CompressedZooKeeper czk(zk);
+  EXPECT_THROW(czk.Get("/test"), ZooException);
+
+  zk.Delete("/test");
+}
@@ -1,15 +1,24 @@
-#include "zookeeper.hpp"
+#include "zookeeper_ext.hpp"
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <istream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include "zookeeper_error.hpp"
 
 namespace zookeeper {
 
 std::string RecursiveCreate(ZooKeeper& zk,
-                            const std::string& path,
+                            PathView path,
                             const std::string& value,
                             int flag) {
-  std::string::size_type pos = 0;
+  PathView::size_type pos = 0;
   do {
     pos = path.find('/', pos + 1);
-    if (pos == std::string::npos) {
+    if (pos == PathView::npos) {
       break;
     }
 
@@ -20,5 +29,513 @@ std::string RecursiveCreate(ZooKeeper& zk,
   return zk.CreateIfNotExists(path, value, flag);
 }
 
-} // namespace zookeeper
+namespace {
+
+struct PipelineState {
+  std::mutex mutex;
+  std::condition_variable done;
+  size_t pending = 0;
+  std::vector<bool> replied;
+  // set once the caller stopped waiting, later replies are dropped
+  bool abandoned = false;
+};
+
+// called with state->mutex held by each reply
+void CompleteOne(PipelineState& state, size_t index) {
+  state.replied[index] = true;
+  if (--state.pending == 0) state.done.notify_all();
+}
+
+// Call |issue| for each of |count| requests and wait for every issued one
+// to complete, even if issuing fails, as the replies reference caller state.
+// Requests still pending at the operation deadline of |zk| are reported to
+// |expire| instead.
+template <typename Issue, typename Expire>
+void RunPipeline(ZooKeeper& zk, size_t count, const Issue& issue, const Expire& expire) {
+  auto deadline = zk.operation_deadline();
+  if (deadline != Deadline::max() && std::chrono::steady_clock::now() >= deadline) {
+    for (size_t i = 0; i < count; ++i) expire(i);
+    return;
+  }
+
+  auto state = std::make_shared<PipelineState>();
+  state->pending = count;
+  state->replied.resize(count);
+
+  size_t issued = 0;
+  std::exception_ptr error;
+  try {
+    for (; issued < count; ++issued) {
+      issue(issued, state);
+    }
+  } catch (...) {
+    error = std::current_exception();
+  }
+
+  std::unique_lock<std::mutex> lock(state->mutex);
+  state->pending -= count - issued;
+  auto all_replied = [&state]{ return state->pending == 0; };
+  if (deadline == Deadline::max()) {
+    state->done.wait(lock, all_replied);
+  } else if (!state->done.wait_until(lock, deadline, all_replied)) {
+    for (size_t i = 0; i < issued; ++i) {
+      if (!state->replied[i]) expire(i);
+    }
+    state->abandoned = true;
+  }
+
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+}
+
+void PipelinedGet(ZooKeeper& zk,
+                  const std::vector<std::string>& paths,
+                  const PipelinedGetHandler& on_reply,
+                  bool watch) {
+  RunPipeline(zk, paths.size(),
+              [&](size_t i, const std::shared_ptr<PipelineState>& state) {
+    zk.AsyncGet(paths[i],
+                [state, i, &on_reply](int code, const char* value,
+                                      int value_len, const NodeStat& stat) {
+      std::lock_guard<std::mutex> lock(state->mutex);
+      if (state->abandoned) return;
+      on_reply(i, code, value, value_len, stat);
+      CompleteOne(*state, i);
+    }, watch);
+  }, [&on_reply](size_t i) {
+    on_reply(i, ZOPERATIONTIMEOUT, nullptr, 0, NodeStat());
+  });
+}
+
+void PipelinedExists(ZooKeeper& zk,
+                     const std::vector<std::string>& paths,
+                     const PipelinedExistsHandler& on_reply,
+                     bool watch) {
+  RunPipeline(zk, paths.size(),
+              [&](size_t i, const std::shared_ptr<PipelineState>& state) {
+    zk.AsyncExists(paths[i],
+                   [state, i, &on_reply](int code, const NodeStat& stat) {
+      std::lock_guard<std::mutex> lock(state->mutex);
+      if (state->abandoned) return;
+      on_reply(i, code, stat);
+      CompleteOne(*state, i);
+    }, watch);
+  }, [&on_reply](size_t i) {
+    on_reply(i, ZOPERATIONTIMEOUT, NodeStat());
+  });
+}
+
+void PipelinedGetChildren(ZooKeeper& zk,
+                          const std::vector<std::string>& paths,
+                          const PipelinedGetChildrenHandler& on_reply,
+                          bool watch) {
+  RunPipeline(zk, paths.size(),
+              [&](size_t i, const std::shared_ptr<PipelineState>& state) {
+    zk.AsyncGetChildren(paths[i],
+                        [state, i, &on_reply](int code,
+                                              const std::vector<std::string>& children,
+                                              const NodeStat&) {
+      std::lock_guard<std::mutex> lock(state->mutex);
+      if (state->abandoned) return;
+      on_reply(i, code, children);
+      CompleteOne(*state, i);
+    }, watch);
+  }, [&on_reply](size_t i) {
+    on_reply(i, ZOPERATIONTIMEOUT, std::vector<std::string>());
+  });
+}
+
+std::vector<GetResult> PipelinedGet(ZooKeeper& zk,
+                                    const std::vector<std::string>& paths,
+                                    bool watch) {
+  std::vector<GetResult> results(paths.size());
+  PipelinedGet(zk, paths,
+               [&results](size_t i, int code, const char* value,
+                          int value_len, const NodeStat& stat) {
+    auto& result = results[i];
+    result.code = code;
+    result.stat = stat;
+    if (code == ZOK) result.value.assign(value, value_len);
+  }, watch);
+  return results;
+}
+
+WalkStats WalkTree(ZooKeeper& zk,
+                   PathView root,
+                   const WalkHandler& visit,
+                   const WalkOptions& options) {
+  auto start = std::chrono::steady_clock::now();
+  auto per_round = std::max<size_t>(options.concurrency, 1);
+
+  WalkStats stats;
+
+  // nodes to visit with their path and depth set; taken from the front
+  // breadth first, from the back depth first
+  std::deque<WalkedNode> pending(1);
+  pending.front().path = root.to_string();
+
+  std::vector<WalkedNode> round;
+  std::vector<int> codes;
+  std::vector<int> data_codes;
+
+  while (!pending.empty()) {
+    auto count = std::min(pending.size(), per_round);
+    round.clear();
+    for (size_t i = 0; i < count; ++i) {
+      if (options.depth_first) {
+        round.push_back(std::move(pending.back()));
+        pending.pop_back();
+      } else {
+        round.push_back(std::move(pending.front()));
+        pending.pop_front();
+      }
+    }
+
+    codes.assign(count, ZOK);
+    data_codes.assign(count, ZOK);
+    auto requests = options.fetch_data ? count * 2 : count;
+    RunPipeline(zk, requests, [&](size_t i, const std::shared_ptr<PipelineState>& state) {
+      if (i < count) {
+        zk.AsyncGetChildren(round[i].path,
+                            [&, state, i](int code,
+                                          const std::vector<std::string>& children,
+                                          const NodeStat& stat) {
+          std::lock_guard<std::mutex> lock(state->mutex);
+          if (state->abandoned) return;
+          codes[i] = code;
+          round[i].children = children;
+          if (!options.fetch_data) round[i].stat = stat;
+          CompleteOne(*state, i);
+        });
+      } else {
+        auto n = i - count;
+        zk.AsyncGet(round[n].path,
+                    [&, state, i, n](int code, const char* value,
+                                     int value_len, const NodeStat& stat) {
+          std::lock_guard<std::mutex> lock(state->mutex);
+          if (state->abandoned) return;
+          data_codes[n] = code;
+          // the stat matching the data
+          if (code == ZOK) {
+            round[n].value.assign(value, value_len);
+            round[n].stat = stat;
+          }
+          CompleteOne(*state, i);
+        });
+      }
+    }, [&](size_t i) {
+      if (i < count) {
+        codes[i] = ZOPERATIONTIMEOUT;
+      } else {
+        data_codes[i - count] = ZOPERATIONTIMEOUT;
+      }
+    });
+
+    for (size_t i = 0; i < count; ++i) {
+      auto code = codes[i] != ZOK ? codes[i] : data_codes[i];
+      if (code == ZNONODE && round[i].depth > 0) {
+        // deleted during the walk
+        round[i].children.clear();
+        continue;
+      }
+      if (code != ZOK) {
+        throw ZooException(code);
+      }
+
+      ++stats.nodes;
+      if (!visit(round[i])) {
+        round[i].children.clear();
+      }
+    }
+
+    auto add_children = [&pending](const WalkedNode& node, bool reversed) {
+      auto prefix = node.path == "/" ? node.path : node.path + '/';
+      auto add = [&](const std::string& name) {
+        WalkedNode child;
+        child.path = prefix + name;
+        child.depth = node.depth + 1;
+        pending.push_back(std::move(child));
+      };
+      if (reversed) {
+        std::for_each(node.children.rbegin(), node.children.rend(), add);
+      } else {
+        std::for_each(node.children.begin(), node.children.end(), add);
+      }
+    };
+    if (options.depth_first) {
+      // the next node to visit goes last
+      for (auto it = round.rbegin(); it != round.rend(); ++it) {
+        add_children(*it, true);
+      }
+    } else {
+      for (auto& node : round) {
+        add_children(node, false);
+      }
+    }
+  }
+
+  stats.elapsed = std::chrono::steady_clock::now() - start;
+  return stats;
+}
+
+namespace {
+
+// Export stream: magic, format, then per node
+//   tag[1] path_size relative_path[...] data_size data[...] stat fields
+// with sizes and stat fields as varints, ended by END_TAG.
+const char EXPORT_MAGIC[4] = {'Z', 'K', 'E', 'X'};
+const uint64_t EXPORT_FORMAT = 1;
+const char NODE_TAG = 1;
+const char END_TAG = 0;
+
+// stay well below the 1MB request limit of the server
+const size_t MAX_BATCH_BYTES = 512 * 1024;
+
+class ExportWriter {
+public:
+  explicit ExportWriter(std::ostream& output)
+  : output_(output) {
+  }
+
+  void Put(const char* data, size_t size) {
+    output_.write(data, size);
+    bytes_ += size;
+  }
+
+  void PutVarint(uint64_t value) {
+    char buffer[10];
+    size_t size = 0;
+    for (; value >= 0x80; value >>= 7) {
+      buffer[size++] = static_cast<char>((value & 0x7f) | 0x80);
+    }
+    buffer[size++] = static_cast<char>(value);
+    Put(buffer, size);
+  }
+
+  void PutString(const std::string& value) {
+    PutVarint(value.size());
+    Put(value.data(), value.size());
+  }
+
+  void PutNode(const std::string& relative_path,
+               const std::string& value,
+               const NodeStat& stat) {
+    Put(&NODE_TAG, 1);
+    PutString(relative_path);
+    PutString(value);
+    for (int64_t field : {stat.czxid, stat.mzxid, stat.ctime, stat.mtime,
+                          static_cast<int64_t>(stat.version),
+                          static_cast<int64_t>(stat.cversion),
+                          static_cast<int64_t>(stat.aversion),
+                          stat.ephemeralOwner, stat.pzxid}) {
+      PutVarint(static_cast<uint64_t>(field));
+    }
+  }
 
+  uint64_t bytes() const {
+    return bytes_;
+  }
+
+private:
+  std::ostream& output_;
+  uint64_t bytes_ = 0;
+};
+
+class ExportReader {
+public:
+  explicit ExportReader(std::istream& input)
+  : input_(input) {
+  }
+
+  void Get(char* data, size_t size) {
+    if (!input_.read(data, size)) {
+      throw ZooException(ZMARSHALLINGERROR, "truncated export stream");
+    }
+    bytes_ += size;
+  }
+
+  uint64_t GetVarint() {
+    uint64_t value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+      char byte;
+      Get(&byte, 1);
+      value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+      if (!(byte & 0x80)) return value;
+    }
+    throw ZooException(ZMARSHALLINGERROR, "corrupted export stream");
+  }
+
+  void GetString(std::string* value) {
+    auto size = GetVarint();
+    if (size > MAX_BATCH_BYTES * 2) {
+      // larger than the server accepts, the size is corrupted
+      throw ZooException(ZMARSHALLINGERROR, "corrupted export stream");
+    }
+    value->resize(size);
+    if (size) Get(&(*value)[0], size);
+  }
+
+  // false at the end of the stream
+  bool GetNode(std::string* relative_path, std::string* data, NodeStat* stat) {
+    char tag;
+    Get(&tag, 1);
+    if (tag == END_TAG) return false;
+    if (tag != NODE_TAG) {
+      throw ZooException(ZMARSHALLINGERROR, "corrupted export stream");
+    }
+
+    GetString(relative_path);
+    GetString(data);
+    *stat = NodeStat();
+    stat->czxid = GetVarint();
+    stat->mzxid = GetVarint();
+    stat->ctime = GetVarint();
+    stat->mtime = GetVarint();
+    stat->version = static_cast<int32_t>(GetVarint());
+    stat->cversion = static_cast<int32_t>(GetVarint());
+    stat->aversion = static_cast<int32_t>(GetVarint());
+    stat->ephemeralOwner = GetVarint();
+    stat->pzxid = GetVarint();
+    stat->dataLength = data->size();
+    return true;
+  }
+
+  uint64_t bytes() const {
+    return bytes_;
+  }
+
+private:
+  std::istream& input_;
+  uint64_t bytes_ = 0;
+};
+
+std::string JoinPath(const std::string& root, const std::string& relative_path) {
+  if (relative_path.empty()) return root;
+  return (root == "/" ? root : root + '/') + relative_path;
+}
+
+// |path| below |root|, empty for the root itself
+std::string RelativePath(const std::string& root, const std::string& path) {
+  if (path.size() <= root.size()) return std::string();
+  return path.substr(root == "/" ? 1 : root.size() + 1);
+}
+
+}
+
+TreeTransferStats ExportTree(ZooKeeper& zk,
+                             PathView root,
+                             std::ostream& output,
+                             size_t max_outstanding) {
+  auto root_path = root.to_string();
+  ExportWriter writer(output);
+  writer.Put(EXPORT_MAGIC, sizeof(EXPORT_MAGIC));
+  writer.PutVarint(EXPORT_FORMAT);
+
+  TreeTransferStats stats;
+
+  WalkOptions options;
+  options.concurrency = max_outstanding;
+  options.fetch_data = true;
+  options.depth_first = true;
+  WalkTree(zk, root, [&](const WalkedNode& node) {
+    if (root_path == "/" && node.path == "/zookeeper") {
+      return false;
+    }
+    writer.PutNode(RelativePath(root_path, node.path), node.value, node.stat);
+    ++stats.nodes;
+    return true;
+  }, options);
+
+  writer.Put(&END_TAG, 1);
+  output.flush();
+  if (!output) {
+    throw ZooException(ZSYSTEMERROR, "failed to write export stream");
+  }
+
+  stats.bytes = writer.bytes();
+  return stats;
+}
+
+TreeTransferStats ImportTree(ZooKeeper& zk,
+                             PathView root,
+                             std::istream& input,
+                             size_t batch_size) {
+  auto root_path = root.to_string();
+  ExportReader reader(input);
+
+  char magic[sizeof(EXPORT_MAGIC)];
+  reader.Get(magic, sizeof(magic));
+  if (!std::equal(magic, magic + sizeof(magic), EXPORT_MAGIC)
+      || reader.GetVarint() != EXPORT_FORMAT) {
+    throw ZooException(ZMARSHALLINGERROR, "not an export stream");
+  }
+
+  auto parent_end = root_path.rfind('/');
+  if (parent_end != std::string::npos && parent_end > 0) {
+    RecursiveCreate(zk, PathView(root_path).substr(0, parent_end));
+  }
+
+  TreeTransferStats stats;
+
+  MultiOps batch;
+  size_t batch_bytes = 0;
+  // kept to create the batch node by node if some exist already
+  std::vector<std::pair<std::string, std::string>> batch_nodes;
+
+  auto flush = [&] {
+    if (batch.empty()) return;
+
+    auto result = zk.TryMulti(batch);
+    if (result.code() == ZNODEEXISTS) {
+      for (auto& node : batch_nodes) {
+        auto created = zk.TryCreate(node.first, node.second);
+        if (created.code() == ZNODEEXISTS) {
+          zk.TrySet(node.first, node.second).value();
+          ++stats.updated;
+        } else {
+          created.value();
+        }
+      }
+    } else {
+      result.value();
+    }
+
+    stats.nodes += batch.size();
+    batch.clear();
+    batch_nodes.clear();
+    batch_bytes = 0;
+  };
+
+  std::string relative_path, data;
+  NodeStat stat;
+  while (reader.GetNode(&relative_path, &data, &stat)) {
+    if (stat.ephemeralOwner) {
+      ++stats.skipped;
+      continue;
+    }
+
+    auto path = JoinPath(root_path, relative_path);
+    auto node_bytes = path.size() + data.size();
+    // flushed first, so a large node can't push the multi past the cap
+    if (batch_bytes + node_bytes > MAX_BATCH_BYTES) {
+      flush();
+    }
+
+    batch.Create(path, data);
+    batch_bytes += node_bytes;
+    batch_nodes.emplace_back(std::move(path), std::move(data));
+
+    if (batch.size() >= batch_size) {
+      flush();
+    }
+  }
+  flush();
+
+  stats.bytes = reader.bytes();
+  return stats;
+}
+
+} // namespace zookeeper
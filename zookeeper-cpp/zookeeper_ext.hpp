@@ -1,15 +1,132 @@
 #pragma once
+#include <chrono>
+#include <iosfwd>
 #include <string>
+#include <vector>
+#include "zookeeper.hpp"
 
 namespace zookeeper {
 
-class ZooKeeper;
-
 std::string RecursiveCreate(ZooKeeper& zk,
-                            const std::string& path,
+                            PathView path,
                             const std::string& value = std::string(),
                             int flag = 0);
 
-}
+struct GetResult {
+  int code = ZOK;
+  std::string value;
+  NodeStat stat = NodeStat();
+};
+
+typedef std::function<void(size_t index, int code, const char* value,
+                           int value_len, const NodeStat& stat)> PipelinedGetHandler;
+
+// Fetch all |paths| with pipelined asynchronous gets, waiting for every reply.
+// |on_reply| is called with the index of each path on the completion thread.
+// Paths still pending at the operation deadline of |zk| are reported with
+// ZOPERATIONTIMEOUT. Must not be called from a watcher or completion callback.
+void PipelinedGet(ZooKeeper& zk,
+                  const std::vector<std::string>& paths,
+                  const PipelinedGetHandler& on_reply,
+                  bool watch = false);
+
+typedef std::function<void(size_t index, int code,
+                           const NodeStat& stat)> PipelinedExistsHandler;
+
+// Stat all |paths| with pipelined asynchronous exists, as PipelinedGet does.
+void PipelinedExists(ZooKeeper& zk,
+                     const std::vector<std::string>& paths,
+                     const PipelinedExistsHandler& on_reply,
+                     bool watch = false);
+
+typedef std::function<void(size_t index, int code,
+                           const std::vector<std::string>& children)> PipelinedGetChildrenHandler;
+
+// List the children of all |paths| with pipelined requests, as PipelinedGet does.
+void PipelinedGetChildren(ZooKeeper& zk,
+                          const std::vector<std::string>& paths,
+                          const PipelinedGetChildrenHandler& on_reply,
+                          bool watch = false);
+
+// As PipelinedGet above, collecting the replies. A missing node is reported through its
+// result code instead of an exception.
+std::vector<GetResult> PipelinedGet(ZooKeeper& zk,
+                                    const std::vector<std::string>& paths,
+                                    bool watch = false);
 
+struct WalkOptions {
+  // requests in flight per round of the walk
+  size_t concurrency = 1000;
+  // fetch the data of every node as well, the stat comes with its children
+  bool fetch_data = false;
+  // take the rounds depth first, keeping only the directories on the way
+  // in memory instead of whole levels of the tree; exact preorder with a
+  // concurrency of 1
+  bool depth_first = false;
+};
 
+struct WalkedNode {
+  std::string path;
+  // depth below the root of the walk
+  int depth = 0;
+  NodeStat stat = NodeStat();
+  std::vector<std::string> children;
+  // only with WalkOptions::fetch_data
+  std::string value;
+};
+
+// Called for every node on the caller's thread; returning false skips the
+// node's subtree.
+typedef std::function<bool(const WalkedNode& node)> WalkHandler;
+
+struct WalkStats {
+  size_t nodes = 0;
+  std::chrono::steady_clock::duration elapsed{0};
+
+  double nodes_per_sec() const {
+    auto seconds = std::chrono::duration<double>(elapsed).count();
+    return seconds > 0 ? nodes / seconds : 0;
+  }
+};
+
+// Visit the subtree at |root|, breadth first unless asked otherwise. Each
+// round lists the children, and fetches the data if asked, of up to
+// WalkOptions::concurrency nodes with pipelined requests. Nodes deleted
+// during the walk are skipped; a missing root throws ZooException with
+// ZNONODE. Must not be called from a watcher or completion callback.
+WalkStats WalkTree(ZooKeeper& zk,
+                   PathView root,
+                   const WalkHandler& visit,
+                   const WalkOptions& options = WalkOptions());
+
+struct TreeTransferStats {
+  size_t nodes = 0;
+  // size of the stream
+  uint64_t bytes = 0;
+  // imported nodes which existed already and got their data replaced
+  size_t updated = 0;
+  // ephemeral nodes, which belong to a session and aren't imported
+  size_t skipped = 0;
+};
+
+// Write the subtree at |root| to |output| as a stream of records holding
+// the path relative to |root|, the data and the stat of each node, parents
+// first. The tree is walked depth first by WalkTree with |max_outstanding|
+// requests per round; memory is bounded by the round and the widest
+// directories on the path being walked, not by the size of the tree. Exporting "/" leaves out
+// /zookeeper. Must not be called from a watcher or completion callback.
+TreeTransferStats ExportTree(ZooKeeper& zk,
+                             PathView root,
+                             std::ostream& output,
+                             size_t max_outstanding = 1000);
+
+// Create the nodes of an exported stream under |root|, with batched multi
+// operations of up to |batch_size| nodes. Existing nodes get their data
+// replaced. Stats can't be restored; versions and zxids start over.
+// Throws ZooException with ZMARSHALLINGERROR on a corrupted stream.
+TreeTransferStats ImportTree(ZooKeeper& zk,
+                             PathView root,
+                             std::istream& input,
+                             size_t batch_size = 100);
+
+}
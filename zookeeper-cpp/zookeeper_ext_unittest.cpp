@@ -2,6 +2,7 @@
 #include "zookeeper_ext.hpp"
 #include "zookeeper_error.hpp"
 #include <gtest/gtest.h>
+#include <sstream>
 #include "zookeeper_unittest_helper.hpp"
 
 using namespace zookeeper;
@@ -23,3 +24,139 @@ TEST_F(ZooKeeperTest, RecursiveCreateWithBadArgument) {
 }
 
 
+
+TEST_F(ZooKeeperTest, ExportThenImportTree) {
+  zk.Create("/test", "root");
+  zk.Create("/test/a", std::string("binary\0data", 11));
+  zk.Create("/test/a/x", "x");
+  zk.Create("/test/a/x/deep", "deep");
+  zk.Create("/test/b", "");
+  zk.Create("/test/c", std::string(5000, 'c'));
+
+  std::stringstream stream;
+  // small windows, so the walk takes several rounds
+  auto exported = ExportTree(zk, "/test", stream, 2);
+  EXPECT_EQ(exported.nodes, 6u);
+  EXPECT_EQ(exported.bytes, stream.str().size());
+
+  auto imported = ImportTree(zk, "/restored/test", stream, 2);
+  EXPECT_EQ(imported.nodes, 6u);
+  EXPECT_EQ(imported.updated, 0u);
+  EXPECT_EQ(imported.bytes, exported.bytes);
+
+  EXPECT_EQ(zk.Get("/restored/test"), "root");
+  EXPECT_EQ(zk.Get("/restored/test/a"), std::string("binary\0data", 11));
+  EXPECT_EQ(zk.Get("/restored/test/a/x/deep"), "deep");
+  EXPECT_EQ(zk.Get("/restored/test/b"), "");
+  EXPECT_EQ(zk.Get("/restored/test/c"), std::string(5000, 'c'));
+
+  // importing over existing nodes replaces their data
+  zk.Set("/restored/test/b", "changed");
+  stream.clear();
+  stream.seekg(0);
+  imported = ImportTree(zk, "/restored/test", stream);
+  EXPECT_EQ(imported.updated, 6u);
+  EXPECT_EQ(zk.Get("/restored/test/b"), "");
+
+  for (auto root : {"/test", "/restored/test"}) {
+    for (auto child : {"/a/x/deep", "/a/x", "/a", "/b", "/c", ""}) {
+      zk.Delete(std::string(root) + child);
+    }
+  }
+  zk.Delete("/restored");
+}
+
+TEST_F(ZooKeeperTest, ImportRejectsCorruptedStream) {
+  std::stringstream garbage("not an export");
+  try {
+    ImportTree(zk, "/test", garbage);
+    FAIL() << "corrupted stream imported";
+  } catch (const ZooException& e) {
+    EXPECT_EQ(e.code(), ZMARSHALLINGERROR);
+  }
+
+  zk.Create("/test", "value");
+  std::stringstream stream;
+  ExportTree(zk, "/test", stream);
+  auto truncated = stream.str();
+  truncated.resize(truncated.size() - 3);
+  std::stringstream truncated_stream(truncated);
+  EXPECT_THROW(ImportTree(zk, "/test_restored", truncated_stream), ZooException);
+  EXPECT_FALSE(zk.Exists("/test_restored"));
+  zk.Delete("/test");
+}
+
+TEST_F(ZooKeeperTest, WalkTree) {
+  zk.Create("/test", "root");
+  zk.Create("/test/a", "a");
+  zk.Create("/test/a/x", "x");
+  zk.Create("/test/b", "b");
+  zk.Create("/test/b/y", "y");
+  zk.Create("/test/b/y/z", "z");
+
+  WalkOptions options;
+  options.concurrency = 2;
+  std::vector<std::string> paths;
+  auto stats = WalkTree(zk, "/test", [&](const WalkedNode& node) {
+    paths.push_back(node.path);
+    EXPECT_EQ(node.stat.numChildren, static_cast<int>(node.children.size()));
+    EXPECT_TRUE(node.value.empty());
+    return true;
+  }, options);
+  EXPECT_EQ(stats.nodes, 6u);
+  EXPECT_EQ(paths, (std::vector<std::string>{
+      "/test", "/test/a", "/test/b", "/test/a/x", "/test/b/y", "/test/b/y/z"}));
+
+  // depth first with data, skipping the subtree of /test/b/y; a node at a
+  // time gives the exact preorder
+  options.concurrency = 1;
+  options.fetch_data = true;
+  options.depth_first = true;
+  paths.clear();
+  stats = WalkTree(zk, "/test", [&](const WalkedNode& node) {
+    paths.push_back(node.path);
+    EXPECT_EQ(node.value, node.path == "/test" ? "root" : node.path.substr(node.path.rfind('/') + 1));
+    return node.path != "/test/b/y";
+  }, options);
+  EXPECT_EQ(stats.nodes, 5u);
+  EXPECT_EQ(paths, (std::vector<std::string>{
+      "/test", "/test/a", "/test/a/x", "/test/b", "/test/b/y"}));
+
+  EXPECT_THROW(WalkTree(zk, "/test_missing", [](const WalkedNode&) { return true; }),
+               ZooException);
+
+  for (auto path : {"/test/b/y/z", "/test/b/y", "/test/b", "/test/a/x", "/test/a", "/test"}) {
+    zk.Delete(path);
+  }
+}
+
+TEST_F(ZooKeeperTest, WalkTreeBenchmark) {
+  zk.Create("/test");
+  for (int i = 0; i < 50; ++i) {
+    auto dir = "/test/" + std::to_string(i);
+    zk.Create(dir);
+    for (int j = 0; j < 40; ++j) {
+      zk.Create(dir + '/' + std::to_string(j), "value");
+    }
+  }
+
+  for (size_t concurrency : {1, 10, 100, 1000}) {
+    WalkOptions options;
+    options.concurrency = concurrency;
+    options.fetch_data = true;
+    auto stats = WalkTree(zk, "/test", [](const WalkedNode&) { return true; }, options);
+    EXPECT_EQ(stats.nodes, 2051u);
+    printf("walked %d nodes with %d requests per round: %.0f nodes/sec\n",
+           static_cast<int>(stats.nodes), static_cast<int>(concurrency),
+           stats.nodes_per_sec());
+  }
+
+  for (int i = 0; i < 50; ++i) {
+    auto dir = "/test/" + std::to_string(i);
+    for (int j = 0; j < 40; ++j) {
+      zk.Delete(dir + '/' + std::to_string(j));
+    }
+    zk.Delete(dir);
+  }
+  zk.Delete("/test");
+}
@@ -0,0 +1,363 @@
+#include "zookeeper_large_value.hpp"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <random>
+#include "zookeeper.hpp"
+#include "zookeeper_error.hpp"
+#include "zookeeper_ext.hpp"
+
+namespace zookeeper {
+
+namespace {
+
+// manifest layout, integers are big endian:
+//   magic[4] format[1] flags[1] total_size[8] chunk_size[4] chunk_count[4]
+//   generation[8] checksum[4] inline_value[...]
+// The checksum covers everything else, so a plain value starting with the
+// magic isn't taken for a manifest.
+const char MANIFEST_MAGIC[4] = {'Z', 'K', 'L', 'V'};
+const uint8_t MANIFEST_FORMAT = 2;
+const size_t MANIFEST_CHECKSUM_OFFSET = 30;
+const size_t MANIFEST_HEADER_SIZE = 34;
+
+// chunks are being written by CreateLargeValue, the value isn't readable yet
+const uint8_t MANIFEST_PENDING = 0x01;
+
+// a reader racing with writers gives up after this many manifest changes
+const int MAX_READ_ATTEMPTS = 3;
+
+const uint32_t FNV_OFFSET_BASIS = 0x811c9dc5;
+const uint32_t FNV_PRIME = 0x01000193;
+
+struct Manifest {
+  uint8_t flags = 0;
+  uint64_t total_size = 0;
+  uint32_t chunk_size = 0;
+  uint32_t chunk_count = 0;
+  uint64_t generation = 0;
+};
+
+void PutUint(std::string* out, uint64_t value, int bytes) {
+  for (int i = bytes - 1; i >= 0; --i) {
+    out->push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+  }
+}
+
+uint64_t GetUint(const char* data, int bytes) {
+  uint64_t value = 0;
+  for (int i = 0; i < bytes; ++i) {
+    value = (value << 8) | static_cast<uint8_t>(data[i]);
+  }
+  return value;
+}
+
+// FNV-1a of |size| bytes, continuing from |hash|
+uint32_t Checksum(const char* data, size_t size, uint32_t hash = FNV_OFFSET_BASIS) {
+  for (size_t i = 0; i < size; ++i) {
+    hash ^= static_cast<uint8_t>(data[i]);
+    hash *= FNV_PRIME;
+  }
+  return hash;
+}
+
+// of a manifest encoded in |data|, skipping the checksum itself
+uint32_t ManifestChecksum(const std::string& data) {
+  auto hash = Checksum(data.data(), MANIFEST_CHECKSUM_OFFSET);
+  return Checksum(data.data() + MANIFEST_HEADER_SIZE,
+                  data.size() - MANIFEST_HEADER_SIZE, hash);
+}
+
+std::string EncodeManifest(const Manifest& manifest,
+                           const std::string& inline_value = std::string()) {
+  std::string data;
+  data.reserve(MANIFEST_HEADER_SIZE + inline_value.size());
+  data.append(MANIFEST_MAGIC, sizeof(MANIFEST_MAGIC));
+  PutUint(&data, MANIFEST_FORMAT, 1);
+  PutUint(&data, manifest.flags, 1);
+  PutUint(&data, manifest.total_size, 8);
+  PutUint(&data, manifest.chunk_size, 4);
+  PutUint(&data, manifest.chunk_count, 4);
+  PutUint(&data, manifest.generation, 8);
+  PutUint(&data, 0, 4);
+  data.append(inline_value);
+
+  auto checksum = ManifestChecksum(data);
+  for (int i = 0; i < 4; ++i) {
+    data[MANIFEST_CHECKSUM_OFFSET + i] = static_cast<char>(checksum >> (8 * (3 - i)));
+  }
+  return data;
+}
+
+// false if |data| isn't a manifest: besides the magic, the checksum and the
+// sizes have to agree with the stored value
+bool DecodeManifest(const std::string& data, Manifest* manifest) {
+  if (data.size() < MANIFEST_HEADER_SIZE
+      || memcmp(data.data(), MANIFEST_MAGIC, sizeof(MANIFEST_MAGIC)) != 0
+      || static_cast<uint8_t>(data[4]) != MANIFEST_FORMAT
+      || GetUint(data.data() + MANIFEST_CHECKSUM_OFFSET, 4) != ManifestChecksum(data)) {
+    return false;
+  }
+
+  Manifest decoded;
+  auto p = data.data() + 5;
+  decoded.flags = GetUint(p, 1);
+  decoded.total_size = GetUint(p + 1, 8);
+  decoded.chunk_size = GetUint(p + 9, 4);
+  decoded.chunk_count = GetUint(p + 13, 4);
+  decoded.generation = GetUint(p + 17, 8);
+
+  auto inline_size = data.size() - MANIFEST_HEADER_SIZE;
+  if ((decoded.flags & ~MANIFEST_PENDING) != 0) {
+    return false;
+  }
+  if (decoded.chunk_count == 0) {
+    // inline
+    if (decoded.flags != 0 || decoded.generation != 0
+        || decoded.total_size != inline_size) {
+      return false;
+    }
+  } else if (inline_size != 0
+             || decoded.chunk_size == 0
+             || decoded.total_size <= decoded.chunk_size
+             || decoded.chunk_count != (decoded.total_size + decoded.chunk_size - 1)
+                                       / decoded.chunk_size) {
+    return false;
+  }
+
+  *manifest = decoded;
+  return true;
+}
+
+Manifest NewManifest(const std::string& value, size_t chunk_size) {
+  static std::mutex rng_mutex;
+  static std::mt19937_64 rng(std::random_device{}() ^
+      std::chrono::steady_clock::now().time_since_epoch().count());
+
+  Manifest manifest;
+  manifest.total_size = value.size();
+  manifest.chunk_size = chunk_size;
+  if (value.size() > chunk_size) {
+    manifest.chunk_count = (value.size() + chunk_size - 1) / chunk_size;
+
+    std::lock_guard<std::mutex> lock(rng_mutex);
+    manifest.generation = rng();
+  }
+  return manifest;
+}
+
+std::string ChunkPath(const std::string& path, const Manifest& manifest, uint32_t index) {
+  char name[48];
+  snprintf(name, sizeof(name), "/chunk-%016llx-%08u",
+           static_cast<unsigned long long>(manifest.generation), index);
+  return path + name;
+}
+
+// deletes are pipelined in front of any later request of this session
+void DeleteChunksLater(ZooKeeper& zk, const std::string& path, const Manifest& manifest) {
+  for (uint32_t i = 0; i < manifest.chunk_count; ++i) {
+    zk.AsyncDelete(ChunkPath(path, manifest, i), [](int) {});
+  }
+}
+
+struct WriteState {
+  std::mutex mutex;
+  std::condition_variable done;
+  size_t pending = 0;
+  int code = ZOK;
+};
+
+void WriteChunks(ZooKeeper& zk,
+                 const std::string& path,
+                 const Manifest& manifest,
+                 const std::string& value) {
+  auto deadline = zk.operation_deadline();
+  auto state = std::make_shared<WriteState>();
+  state->pending = manifest.chunk_count;
+
+  uint32_t issued = 0;
+  std::exception_ptr error;
+  try {
+    for (; issued < manifest.chunk_count; ++issued) {
+      auto offset = static_cast<size_t>(issued) * manifest.chunk_size;
+      zk.AsyncCreate(ChunkPath(path, manifest, issued),
+                     value.substr(offset, manifest.chunk_size),
+                     [state](int code, const char*) {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        if (code != ZOK && state->code == ZOK) state->code = code;
+        if (--state->pending == 0) state->done.notify_all();
+      });
+    }
+  } catch (...) {
+    error = std::current_exception();
+  }
+
+  {
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->pending -= manifest.chunk_count - issued;
+    auto all_written = [&state]{ return state->pending == 0; };
+    if (deadline == Deadline::max()) {
+      state->done.wait(lock, all_written);
+    } else if (!state->done.wait_until(lock, deadline, all_written)
+               && state->code == ZOK) {
+      // late chunks are removed by the deletes queued behind them
+      state->code = ZOPERATIONTIMEOUT;
+    }
+  }
+
+  if (error || state->code != ZOK) {
+    DeleteChunksLater(zk, path, manifest);
+    if (error) std::rethrow_exception(error);
+    throw ZooException(state->code);
+  }
+}
+
+}
+
+void CreateLargeValue(ZooKeeper& zk,
+                      const std::string& path,
+                      const std::string& value,
+                      size_t chunk_size) {
+  auto manifest = NewManifest(value, chunk_size);
+  if (manifest.chunk_count == 0) {
+    zk.Create(path, EncodeManifest(manifest, value));
+    return;
+  }
+
+  // chunks need their parent, hide the value until they are all written
+  manifest.flags = MANIFEST_PENDING;
+  zk.Create(path, EncodeManifest(manifest));
+
+  MultiOps ops;
+  bool chunks_written = false;
+  try {
+    WriteChunks(zk, path, manifest, value);
+    chunks_written = true;
+
+    manifest.flags = 0;
+    ops.Set(path, EncodeManifest(manifest), 0);
+    zk.Multi(ops);
+  } catch (...) {
+    if (chunks_written) DeleteChunksLater(zk, path, manifest);
+
+    // chunk deletes are queued before this, unless another writer took over
+    ops.clear();
+    ops.Delete(path, 0);
+    try {
+      zk.Multi(ops);
+    } catch (ZooException&) {
+    }
+    throw;
+  }
+}
+
+void SetLargeValue(ZooKeeper& zk,
+                   const std::string& path,
+                   const std::string& value,
+                   size_t chunk_size) {
+  auto current = PipelinedGet(zk, {path})[0];
+  if (current.code != ZOK) {
+    throw ZooException(current.code);
+  }
+
+  Manifest old_manifest;
+  if (!DecodeManifest(current.value, &old_manifest)) {
+    old_manifest = Manifest();
+  }
+
+  auto manifest = NewManifest(value, chunk_size);
+  if (manifest.chunk_count > 0) {
+    WriteChunks(zk, path, manifest, value);
+  }
+
+  MultiOps ops;
+  ops.Set(path,
+          manifest.chunk_count > 0 ? EncodeManifest(manifest)
+                                   : EncodeManifest(manifest, value),
+          current.stat.version);
+  for (uint32_t i = 0; i < old_manifest.chunk_count; ++i) {
+    ops.Delete(ChunkPath(path, old_manifest, i));
+  }
+
+  try {
+    zk.Multi(ops);
+  } catch (ZooException&) {
+    DeleteChunksLater(zk, path, manifest);
+    throw;
+  }
+}
+
+std::string GetLargeValue(ZooKeeper& zk, const std::string& path) {
+  for (int attempt = 0; attempt < MAX_READ_ATTEMPTS; ++attempt) {
+    auto current = PipelinedGet(zk, {path})[0];
+    if (current.code != ZOK) {
+      throw ZooException(current.code);
+    }
+
+    Manifest manifest;
+    if (!DecodeManifest(current.value, &manifest)) {
+      // plain node
+      return std::move(current.value);
+    }
+
+    if (manifest.flags & MANIFEST_PENDING) {
+      throw ZooException(ZNONODE);
+    }
+
+    if (manifest.chunk_count == 0) {
+      return current.value.substr(MANIFEST_HEADER_SIZE);
+    }
+
+    std::vector<std::string> chunk_paths;
+    chunk_paths.reserve(manifest.chunk_count);
+    for (uint32_t i = 0; i < manifest.chunk_count; ++i) {
+      chunk_paths.push_back(ChunkPath(path, manifest, i));
+    }
+
+    // every chunk is copied once, into its place in the result
+    std::string value(manifest.total_size, '\0');
+    int failure = ZOK;
+    PipelinedGet(zk, chunk_paths,
+                 [&](size_t i, int code, const char* data, int data_len,
+                     const NodeStat&) {
+      if (failure != ZOK) return;
+
+      auto offset = i * manifest.chunk_size;
+      auto expected = std::min<uint64_t>(manifest.chunk_size,
+                                         manifest.total_size - offset);
+      if (code != ZOK) {
+        failure = code;
+      } else if (static_cast<uint64_t>(data_len) != expected) {
+        failure = ZDATAINCONSISTENCY;
+      } else {
+        memcpy(&value[offset], data, data_len);
+      }
+    });
+
+    if (failure == ZOK) {
+      return value;
+    }
+    if (failure != ZNONODE) {
+      throw ZooException(failure);
+    }
+    // the value was replaced while reading, read the new manifest
+  }
+
+  throw ZooException(ZDATAINCONSISTENCY, "large value kept changing while being read");
+}
+
+void DeleteLargeValue(ZooKeeper& zk, const std::string& path) {
+  auto children = zk.GetChildren(path);
+  for (auto& child : children) {
+    zk.AsyncDelete(path + '/' + child, [](int) {});
+  }
+
+  zk.Delete(path);
+}
+
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include <string>
+
+namespace zookeeper {
+
+class ZooKeeper;
+
+// Values larger than jute.maxbuffer (1MB by default) are stored as chunk
+// nodes under |path|, with a manifest in |path| itself naming the chunk
+// generation in use. Chunks of a new value are written under a fresh
+// generation first, then a single multi operation swaps the manifest and
+// removes the previous chunks, so readers see either value but never a mix.
+//
+// Values that fit in one chunk are stored inline in the manifest. Nodes
+// written by ZooKeeper::Create/Set are returned as they are by GetLargeValue.
+
+const size_t DEFAULT_LARGE_VALUE_CHUNK_SIZE = 512 * 1024;
+
+void CreateLargeValue(ZooKeeper& zk,
+                      const std::string& path,
+                      const std::string& value,
+                      size_t chunk_size = DEFAULT_LARGE_VALUE_CHUNK_SIZE);
+
+// Replace the value of an existing node. Throws ZooException with ZBADVERSION
+// if another writer replaced it concurrently.
+void SetLargeValue(ZooKeeper& zk,
+                   const std::string& path,
+                   const std::string& value,
+                   size_t chunk_size = DEFAULT_LARGE_VALUE_CHUNK_SIZE);
+
+// Chunks are fetched with pipelined gets straight into the returned buffer.
+std::string GetLargeValue(ZooKeeper& zk, const std::string& path);
+
+// Delete the manifest and all chunks, including ones left by failed writers.
+void DeleteLargeValue(ZooKeeper& zk, const std::string& path);
+
+}
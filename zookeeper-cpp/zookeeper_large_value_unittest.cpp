@@ -0,0 +1,78 @@
+#include "zookeeper.hpp"
+#include "zookeeper_large_value.hpp"
+#include "zookeeper_error.hpp"
+#include <gtest/gtest.h>
+#include "zookeeper_unittest_helper.hpp"
+
+using namespace zookeeper;
+using namespace testing;
+
+static std::string MakeValue(size_t size) {
+  std::string value(size, '\0');
+  for (size_t i = 0; i < size; ++i) {
+    value[i] = static_cast<char>(i * 31 + i / 7);
+  }
+  return value;
+}
+
+TEST_F(ZooKeeperTest, SmallLargeValueIsInline) {
+  CreateLargeValue(zk, "/test", "abc");
+  EXPECT_EQ(GetLargeValue(zk, "/test"), "abc");
+  EXPECT_TRUE(zk.GetChildren("/test").empty());
+
+  DeleteLargeValue(zk, "/test");
+  EXPECT_FALSE(zk.Exists("/test"));
+}
+
+TEST_F(ZooKeeperTest, CreateThenGetLargeValue) {
+  auto value = MakeValue(3 * 1024 * 1024 + 17);
+  CreateLargeValue(zk, "/test", value);
+
+  EXPECT_EQ(zk.GetChildren("/test").size(), 7u);
+  EXPECT_EQ(GetLargeValue(zk, "/test"), value);
+
+  DeleteLargeValue(zk, "/test");
+  EXPECT_FALSE(zk.Exists("/test"));
+}
+
+TEST_F(ZooKeeperTest, SetLargeValueReplacesChunks) {
+  CreateLargeValue(zk, "/test", MakeValue(2 * 1024 * 1024));
+
+  auto value = MakeValue(1024 * 1024 + 1);
+  SetLargeValue(zk, "/test", value);
+  EXPECT_EQ(GetLargeValue(zk, "/test"), value);
+  EXPECT_EQ(zk.GetChildren("/test").size(), 3u);
+
+  SetLargeValue(zk, "/test", "small");
+  EXPECT_EQ(GetLargeValue(zk, "/test"), "small");
+  EXPECT_TRUE(zk.GetChildren("/test").empty());
+
+  DeleteLargeValue(zk, "/test");
+}
+
+TEST_F(ZooKeeperTest, GetLargeValueOfPlainNode) {
+  zk.Create("/test", "plain");
+  EXPECT_EQ(GetLargeValue(zk, "/test"), "plain");
+  zk.Delete("/test");
+
+  EXPECT_THROW(GetLargeValue(zk, "/test"), ZooException);
+}
+
+TEST_F(ZooKeeperTest, GetLargeValueOfPlainNodeWithMagic) {
+  // the magic and format of a manifest, an inline size of 3 and no checksum
+  std::string value("ZKLV\x02", 5);
+  value += std::string(29, '\0') + "abc";
+  value[13] = 3;
+  zk.Create("/test", value);
+  EXPECT_EQ(GetLargeValue(zk, "/test"), value);
+
+  // a manifest of chunks that was cut short
+  CreateLargeValue(zk, "/test/large", MakeValue(2 * 1024 * 1024));
+  auto manifest = zk.Get("/test/large");
+  zk.Create("/test/copy", manifest.substr(0, manifest.size() - 1));
+  EXPECT_EQ(GetLargeValue(zk, "/test/copy"), manifest.substr(0, manifest.size() - 1));
+
+  DeleteLargeValue(zk, "/test/large");
+  zk.Delete("/test/copy");
+  zk.Delete("/test");
+}
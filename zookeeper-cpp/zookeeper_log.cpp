@@ -0,0 +1,304 @@
+#include "zookeeper_log.hpp"
+#include <zookeeper/zookeeper.h>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <mutex>
+
+namespace zookeeper {
+
+namespace detail {
+
+std::atomic<int> LOG_LEVEL{LOG_LEVEL_WARN};
+
+std::string LogEntry::Format() const {
+  std::string message;
+  message.reserve(strlen(format) + text_size + arg_count * 8);
+
+  int next = 0;
+  for (auto p = format; *p; ++p) {
+    if (p[0] != '{' || p[1] != '}' || next >= arg_count) {
+      message += *p;
+      continue;
+    }
+    ++p;
+
+    auto& arg = args[next++];
+    char number[32];
+    switch (arg.type) {
+      case LogArg::SIGNED:
+        snprintf(number, sizeof(number), "%lld", static_cast<long long>(arg.i));
+        message += number;
+        break;
+      case LogArg::UNSIGNED:
+        snprintf(number, sizeof(number), "%llu", static_cast<unsigned long long>(arg.u));
+        message += number;
+        break;
+      case LogArg::FLOAT:
+        snprintf(number, sizeof(number), "%g", arg.d);
+        message += number;
+        break;
+      case LogArg::TEXT:
+        message.append(text + arg.offset, arg.size);
+        break;
+    }
+  }
+  return message;
+}
+
+}
+
+namespace {
+
+using detail::LogEntry;
+using detail::LogSlot;
+using detail::LOG_BUFFER_CAPACITY;
+
+class StderrLogSink : public LogSink {
+public:
+  void Write(const LogRecord& record) override {
+    auto time = std::chrono::system_clock::to_time_t(record.time);
+    auto micros = std::chrono::duration_cast<std::chrono::microseconds>(
+        record.time.time_since_epoch()).count() % 1000000;
+    tm local;
+    localtime_r(&time, &local);
+    char stamp[32];
+    strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &local);
+
+    fprintf(stderr, "%s.%06d %-5s %s: %s\n", stamp, static_cast<int>(micros),
+            LogLevelName(record.level), record.component, record.message.c_str());
+  }
+};
+
+// Ring buffer of the records drained by a single logging thread. Never
+// destroyed, records may be logged until the process exits.
+class Logger {
+public:
+  static Logger& instance() {
+    static Logger* logger = new Logger;
+    return *logger;
+  }
+
+  LogSlot* Claim() {
+    auto slot = buffer_.Claim();
+    if (!slot) dropped_.fetch_add(1, std::memory_order_relaxed);
+    return slot;
+  }
+
+  void Publish(LogSlot* slot) {
+    // ordered before reading sleeping_, against the logging thread going
+    // to sleep
+    buffer_.Publish(slot);
+    if (sleeping_.load()) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      wakeup_.notify_one();
+    }
+  }
+
+  void set_sink(std::shared_ptr<LogSink> sink) {
+    if (!sink) sink = std::make_shared<StderrLogSink>();
+    std::atomic_store(&sink_, std::move(sink));
+  }
+
+  LogStats stats() const {
+    return LogStats{written_.load(), dropped_.load()};
+  }
+
+  void Flush() {
+    auto target = buffer_.claimed();
+    std::unique_lock<std::mutex> lock(mutex_);
+    wakeup_.notify_one();
+    flushed_.wait(lock, [this, target] {
+      return buffer_.popped() >= target;
+    });
+  }
+
+private:
+  Logger()
+  : buffer_(LOG_BUFFER_CAPACITY),
+    sink_(std::make_shared<StderrLogSink>()) {
+    std::thread([this] { Run(); }).detach();
+    // don't lose the last records, e.g. of a failing assertion
+    std::atexit([] { FlushLog(); });
+  }
+
+  void Run() {
+    uint64_t reported_dropped = 0;
+    while (true) {
+      auto sink = std::atomic_load(&sink_);
+
+      auto dropped = dropped_.load(std::memory_order_relaxed);
+      if (dropped != reported_dropped) {
+        LogRecord record{LOG_LEVEL_WARN, std::chrono::system_clock::now(),
+                         std::this_thread::get_id(), "log",
+                         std::to_string(dropped - reported_dropped)
+                         + " records dropped, the log buffer was full"};
+        sink->Write(record);
+        reported_dropped = dropped;
+      }
+
+      // pick up a new sink every batch
+      int written = 0;
+      while (written < 256 && WriteNext(*sink)) ++written;
+      if (written == 256) continue;
+
+      std::unique_lock<std::mutex> lock(mutex_);
+      flushed_.notify_all();
+      sleeping_ = true;
+      if (!buffer_.Front()) {
+        // timed, so an unpublished slot doesn't hold a flush for long
+        wakeup_.wait_for(lock, std::chrono::milliseconds(100));
+      }
+      sleeping_ = false;
+    }
+  }
+
+  bool WriteNext(LogSink& sink) {
+    auto entry = buffer_.Front();
+    if (!entry) return false;
+
+    LogRecord record{entry->level, entry->time, entry->thread, entry->component,
+                     entry->Format()};
+    buffer_.Pop();
+
+    sink.Write(record);
+    written_.fetch_add(1, std::memory_order_relaxed);
+    return true;
+  }
+
+  detail::RingBuffer<LogEntry> buffer_;
+
+  std::atomic<uint64_t> written_{0};
+  std::atomic<uint64_t> dropped_{0};
+
+  // accessed through std::atomic_load/std::atomic_store only
+  std::shared_ptr<LogSink> sink_;
+
+  std::mutex mutex_;
+  std::condition_variable wakeup_;
+  std::condition_variable flushed_;
+  std::atomic<bool> sleeping_{false};
+};
+
+ZooLogLevel ClientLogLevel(LogLevel level) {
+  switch (level) {
+    case LOG_LEVEL_DEBUG: return ZOO_LOG_LEVEL_DEBUG;
+    case LOG_LEVEL_INFO: return ZOO_LOG_LEVEL_INFO;
+    case LOG_LEVEL_WARN: return ZOO_LOG_LEVEL_WARN;
+    case LOG_LEVEL_ERROR: return ZOO_LOG_LEVEL_ERROR;
+    default: return static_cast<ZooLogLevel>(0);
+  }
+}
+
+// A line of the C client's log looks like
+//   2016-05-01 12:00:00,000:1234(0x7f00):ZOO_WARN@function@123: message
+void LogClientLine(const std::string& line) {
+  static const struct {
+    const char* marker;
+    LogLevel level;
+  } LEVELS[] = {
+    {":ZOO_ERROR@", LOG_LEVEL_ERROR},
+    {":ZOO_WARN@", LOG_LEVEL_WARN},
+    {":ZOO_INFO@", LOG_LEVEL_INFO},
+    {":ZOO_DEBUG@", LOG_LEVEL_DEBUG},
+  };
+
+  for (auto& level : LEVELS) {
+    auto found = line.find(level.marker);
+    if (found != std::string::npos) {
+      Log(level.level, "zookeeper_c", "{}",
+          line.substr(found + strlen(level.marker)));
+      return;
+    }
+  }
+  Log(LOG_LEVEL_WARN, "zookeeper_c", "{}", line);
+}
+
+// only called with the stream locked
+std::string CLIENT_LOG_PENDING;
+
+ssize_t WriteClientLog(void*, const char* buffer, size_t size) {
+  CLIENT_LOG_PENDING.append(buffer, size);
+  size_t begin = 0;
+  for (auto end = CLIENT_LOG_PENDING.find('\n'); end != std::string::npos;
+       end = CLIENT_LOG_PENDING.find('\n', begin)) {
+    if (end > begin) {
+      LogClientLine(CLIENT_LOG_PENDING.substr(begin, end - begin));
+    }
+    begin = end + 1;
+  }
+  CLIENT_LOG_PENDING.erase(0, begin);
+  return size;
+}
+
+FILE* OpenClientLogStream() {
+#if defined(__GLIBC__)
+  cookie_io_functions_t functions = {nullptr, WriteClientLog, nullptr, nullptr};
+  return fopencookie(nullptr, "w", functions);
+#elif defined(__APPLE__) || defined(__FreeBSD__)
+  return funopen(nullptr, nullptr, [](void* cookie, const char* buffer, int size) {
+    return static_cast<int>(WriteClientLog(cookie, buffer, size));
+  }, nullptr, nullptr);
+#else
+  return nullptr;
+#endif
+}
+
+std::once_flag ONCE_FLAG_ROUTE_CLIENT_LOG;
+
+}
+
+namespace detail {
+
+LogSlot* ClaimLogSlot() {
+  return Logger::instance().Claim();
+}
+
+void PublishLogSlot(LogSlot* slot) {
+  Logger::instance().Publish(slot);
+}
+
+}
+
+const char* LogLevelName(LogLevel level) {
+  switch (level) {
+    case LOG_LEVEL_DEBUG: return "DEBUG";
+    case LOG_LEVEL_INFO: return "INFO";
+    case LOG_LEVEL_WARN: return "WARN";
+    case LOG_LEVEL_ERROR: return "ERROR";
+    default: return "NONE";
+  }
+}
+
+void SetLogSink(std::shared_ptr<LogSink> sink) {
+  Logger::instance().set_sink(std::move(sink));
+}
+
+void SetLogLevel(LogLevel level) {
+  detail::LOG_LEVEL = level;
+  zoo_set_debug_level(ClientLogLevel(level));
+}
+
+LogStats log_stats() {
+  return Logger::instance().stats();
+}
+
+void FlushLog() {
+  Logger::instance().Flush();
+}
+
+void RouteClientLog() {
+  std::call_once(ONCE_FLAG_ROUTE_CLIENT_LOG, [] {
+    zoo_set_debug_level(ClientLogLevel(static_cast<LogLevel>(detail::LOG_LEVEL.load())));
+    // without a stream the C client keeps writing to stderr
+    auto stream = OpenClientLogStream();
+    if (stream) {
+      // the C client flushes after every message
+      setvbuf(stream, nullptr, _IOFBF, 4096);
+      zoo_set_log_stream(stream);
+    }
+  });
+}
+
+}
@@ -0,0 +1,197 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include "zookeeper_ring_buffer.hpp"
+
+namespace zookeeper {
+
+enum LogLevel {
+  LOG_LEVEL_DEBUG,
+  LOG_LEVEL_INFO,
+  LOG_LEVEL_WARN,
+  LOG_LEVEL_ERROR,
+  // logs nothing
+  LOG_LEVEL_NONE,
+};
+
+const char* LogLevelName(LogLevel level);
+
+struct LogRecord {
+  LogLevel level;
+  std::chrono::system_clock::time_point time;
+  // thread which logged the record
+  std::thread::id thread;
+  // "leader_elector", ..., "zookeeper_c" for the C client's own log
+  const char* component;
+  std::string message;
+};
+
+class LogSink {
+public:
+  virtual ~LogSink() = default;
+
+  // Called on the logging thread only, one record at a time. Must not log
+  // or flush the log itself.
+  virtual void Write(const LogRecord& record) = 0;
+};
+
+// Replace the sink; null restores the default one printing lines to
+// stderr. Records being written may still reach the old sink.
+void SetLogSink(std::shared_ptr<LogSink> sink);
+
+// Records below |level| are dropped before anything is copied. The C
+// client's debug level follows, WARN by default.
+void SetLogLevel(LogLevel level);
+
+struct LogStats {
+  // records handed to the sink
+  uint64_t written;
+  // records dropped while the buffer was full
+  uint64_t dropped;
+};
+
+LogStats log_stats();
+
+// Wait until every record logged before is handed to the sink.
+void FlushLog();
+
+// Route the C client's log (zoo_set_log_stream) through the sink. Done
+// once, by the first ZooKeeper created.
+void RouteClientLog();
+
+namespace detail {
+
+extern std::atomic<int> LOG_LEVEL;
+
+const size_t LOG_MAX_ARGS = 4;
+// room for the text of all string arguments, longer ones are truncated
+const size_t LOG_TEXT_SIZE = 240;
+// records buffered for the logging thread, a power of two
+const size_t LOG_BUFFER_CAPACITY = 4096;
+
+struct LogArg {
+  enum Type : uint8_t { SIGNED, UNSIGNED, FLOAT, TEXT };
+  Type type;
+  // of the text in LogEntry::text
+  uint16_t offset;
+  uint16_t size;
+  union {
+    int64_t i;
+    uint64_t u;
+    double d;
+  };
+};
+
+// A record as logged: formatting is left to the logging thread, only the
+// arguments are copied.
+struct LogEntry {
+  LogLevel level;
+  std::chrono::system_clock::time_point time;
+  std::thread::id thread;
+  // both of static storage
+  const char* component;
+  const char* format;
+  uint8_t arg_count;
+  uint16_t text_size;
+  LogArg args[LOG_MAX_ARGS];
+  char text[LOG_TEXT_SIZE];
+
+  template <typename T>
+  typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value>::type
+  Capture(T value) {
+    auto& arg = args[arg_count++];
+    arg.type = LogArg::SIGNED;
+    arg.i = value;
+  }
+
+  template <typename T>
+  typename std::enable_if<std::is_integral<T>::value && std::is_unsigned<T>::value>::type
+  Capture(T value) {
+    auto& arg = args[arg_count++];
+    arg.type = LogArg::UNSIGNED;
+    arg.u = value;
+  }
+
+  template <typename T>
+  typename std::enable_if<std::is_enum<T>::value>::type
+  Capture(T value) {
+    Capture(static_cast<int64_t>(value));
+  }
+
+  template <typename T>
+  typename std::enable_if<std::is_floating_point<T>::value>::type
+  Capture(T value) {
+    auto& arg = args[arg_count++];
+    arg.type = LogArg::FLOAT;
+    arg.d = value;
+  }
+
+  void Capture(const char* value) {
+    CaptureText(value ? value : "(null)", value ? strlen(value) : 6);
+  }
+
+  void Capture(const std::string& value) {
+    CaptureText(value.data(), value.size());
+  }
+
+  void CaptureText(const char* data, size_t size) {
+    auto& arg = args[arg_count++];
+    arg.type = LogArg::TEXT;
+    arg.offset = text_size;
+    arg.size = static_cast<uint16_t>(std::min(size, LOG_TEXT_SIZE - text_size));
+    memcpy(text + arg.offset, data, arg.size);
+    text_size += arg.size;
+  }
+
+  std::string Format() const;
+};
+
+typedef RingBuffer<LogEntry>::Slot LogSlot;
+
+// Claim a slot of the ring buffer without blocking; null if it's full.
+LogSlot* ClaimLogSlot();
+
+void PublishLogSlot(LogSlot* slot);
+
+}
+
+inline bool IsLogEnabled(LogLevel level) {
+  return level >= detail::LOG_LEVEL.load(std::memory_order_relaxed);
+}
+
+// Log a message with "{}" in |format| replaced by |args| in turn: integers,
+// floating points and strings. Costs a level check when disabled, and a
+// copy of the arguments into a lock free ring buffer otherwise; the record
+// is formatted and written by the logging thread, never blocking the
+// caller. Records logged while the buffer is full are dropped and counted.
+template <typename... Args>
+void Log(LogLevel level, const char* component, const char* format,
+         const Args&... args) {
+  static_assert(sizeof...(Args) <= detail::LOG_MAX_ARGS, "too many log arguments");
+  if (!IsLogEnabled(level)) return;
+
+  auto slot = detail::ClaimLogSlot();
+  if (!slot) return;
+
+  auto& entry = slot->value;
+  entry.level = level;
+  entry.time = std::chrono::system_clock::now();
+  entry.thread = std::this_thread::get_id();
+  entry.component = component;
+  entry.format = format;
+  entry.arg_count = 0;
+  entry.text_size = 0;
+  int capture[] = {0, (entry.Capture(args), 0)...};
+  (void)capture;
+
+  detail::PublishLogSlot(slot);
+}
+
+}
@@ -0,0 +1,182 @@
+#include <gtest/gtest.h>
+#include "zookeeper_log.hpp"
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <vector>
+
+using namespace testing;
+using namespace zookeeper;
+
+namespace {
+
+const char COMPONENT[] = "log_unittest";
+
+class CapturingSink : public LogSink {
+public:
+  void Write(const LogRecord& record) override {
+    if (strcmp(record.component, COMPONENT) != 0) return;
+    std::unique_lock<std::mutex> lock(mutex_);
+    records_.push_back(record);
+    // hold the logging thread until released
+    released_cv_.wait(lock, [this] { return !blocked_; });
+  }
+
+  std::vector<LogRecord> records() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return records_;
+  }
+
+  void Block(bool blocked) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    blocked_ = blocked;
+    released_cv_.notify_all();
+  }
+
+private:
+  std::mutex mutex_;
+  std::condition_variable released_cv_;
+  bool blocked_ = false;
+  std::vector<LogRecord> records_;
+};
+
+class LogTest : public ::testing::Test {
+protected:
+  LogTest() : sink_(std::make_shared<CapturingSink>()) {
+    FlushLog();
+    SetLogSink(sink_);
+    SetLogLevel(LOG_LEVEL_DEBUG);
+  }
+
+  ~LogTest() {
+    FlushLog();
+    SetLogSink(nullptr);
+    SetLogLevel(LOG_LEVEL_WARN);
+  }
+
+  std::shared_ptr<CapturingSink> sink_;
+};
+
+}
+
+TEST_F(LogTest, FormatArguments) {
+  auto before = std::chrono::system_clock::now();
+  Log(LOG_LEVEL_INFO, COMPONENT, "node {} version {} of {}", std::string("/a/b"), -3, 2.5);
+  Log(LOG_LEVEL_WARN, COMPONENT, "{} {} and {} more {}", "x", 42u, true);
+  Log(LOG_LEVEL_ERROR, COMPONENT, "no arguments {}");
+  FlushLog();
+
+  auto records = sink_->records();
+  ASSERT_EQ(records.size(), 3u);
+  EXPECT_EQ(records[0].message, "node /a/b version -3 of 2.5");
+  EXPECT_EQ(records[0].level, LOG_LEVEL_INFO);
+  EXPECT_EQ(records[0].thread, std::this_thread::get_id());
+  EXPECT_GE(records[0].time, before);
+  EXPECT_EQ(records[1].message, "x 42 and 1 more {}");
+  EXPECT_EQ(records[2].message, "no arguments {}");
+  EXPECT_STREQ(LogLevelName(records[2].level), "ERROR");
+}
+
+TEST_F(LogTest, TruncateLongText) {
+  std::string long_text(1000, 'x');
+  Log(LOG_LEVEL_INFO, COMPONENT, "{}|{}", long_text, "tail");
+  FlushLog();
+
+  auto records = sink_->records();
+  ASSERT_EQ(records.size(), 1u);
+  EXPECT_EQ(records[0].message, std::string(detail::LOG_TEXT_SIZE, 'x') + "|");
+}
+
+TEST_F(LogTest, DropBelowLevel) {
+  SetLogLevel(LOG_LEVEL_WARN);
+  EXPECT_FALSE(IsLogEnabled(LOG_LEVEL_INFO));
+  Log(LOG_LEVEL_DEBUG, COMPONENT, "debug");
+  Log(LOG_LEVEL_INFO, COMPONENT, "info");
+  Log(LOG_LEVEL_WARN, COMPONENT, "warn");
+
+  SetLogLevel(LOG_LEVEL_NONE);
+  Log(LOG_LEVEL_ERROR, COMPONENT, "error");
+  FlushLog();
+
+  auto records = sink_->records();
+  ASSERT_EQ(records.size(), 1u);
+  EXPECT_EQ(records[0].message, "warn");
+}
+
+TEST_F(LogTest, DropWhileBufferFull) {
+  sink_->Block(true);
+  Log(LOG_LEVEL_INFO, COMPONENT, "first");
+  // wait for the logging thread to be held by the sink
+  while (sink_->records().empty()) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  auto dropped = log_stats().dropped;
+  const size_t extra = 100;
+  for (size_t i = 0; i < detail::LOG_BUFFER_CAPACITY + extra; ++i) {
+    Log(LOG_LEVEL_INFO, COMPONENT, "record {}", i);
+  }
+  EXPECT_EQ(log_stats().dropped - dropped, extra);
+
+  sink_->Block(false);
+  FlushLog();
+  auto records = sink_->records();
+  ASSERT_EQ(records.size(), detail::LOG_BUFFER_CAPACITY + 1);
+  EXPECT_EQ(records.back().message,
+            "record " + std::to_string(detail::LOG_BUFFER_CAPACITY - 1));
+}
+
+TEST_F(LogTest, LoggingThreads) {
+  const int threads = 4;
+  const int per_thread = 10000;
+  std::vector<std::thread> loggers;
+  for (int t = 0; t < threads; ++t) {
+    loggers.emplace_back([t] {
+      for (int i = 0; i < per_thread; ++i) {
+        Log(LOG_LEVEL_INFO, COMPONENT, "thread {} record {}", t, i);
+        if (i % 1000 == 0) FlushLog();
+      }
+    });
+  }
+  for (auto& logger : loggers) logger.join();
+  FlushLog();
+
+  // records of every thread keep their order, some may be dropped
+  auto records = sink_->records();
+  std::vector<int> last(threads, -1);
+  for (auto& record : records) {
+    int t, i;
+    ASSERT_EQ(sscanf(record.message.c_str(), "thread %d record %d", &t, &i), 2);
+    EXPECT_GT(i, last[t]);
+    last[t] = i;
+  }
+  EXPECT_GT(records.size(), 0u);
+}
+
+TEST_F(LogTest, CostOnCallerThread) {
+  const int batches = 100;
+  const int batch_size = 4000;
+  auto time = [](LogLevel level) {
+    std::chrono::steady_clock::duration elapsed{0};
+    for (int batch = 0; batch < batches; ++batch) {
+      // never full, the time spent waiting is left out
+      FlushLog();
+      auto start = std::chrono::steady_clock::now();
+      for (int i = 0; i < batch_size; ++i) {
+        Log(level, COMPONENT, "election {} node {}", "/election", i);
+      }
+      elapsed += std::chrono::steady_clock::now() - start;
+    }
+    return std::chrono::duration<double, std::nano>(elapsed).count()
+           / (batches * batch_size);
+  };
+
+  SetLogLevel(LOG_LEVEL_INFO);
+  auto disabled = time(LOG_LEVEL_DEBUG);
+  auto enabled = time(LOG_LEVEL_INFO);
+  FlushLog();
+  EXPECT_EQ(sink_->records().size(), static_cast<size_t>(batches * batch_size));
+  printf("log call: %.1f ns disabled, %.1f ns enabled\n", disabled, enabled);
+}
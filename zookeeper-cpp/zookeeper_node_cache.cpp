@@ -0,0 +1,388 @@
+#include "zookeeper_node_cache.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "zookeeper_error.hpp"
+#include "zookeeper_ext.hpp"
+
+namespace zookeeper {
+
+namespace {
+
+// Snapshot file layout: header, blob of path and data bytes, then the index
+// of entries sorted by path. Integers and stats are stored in host layout,
+// so the index can be used straight from the mapping.
+const char SNAPSHOT_MAGIC[4] = {'Z', 'K', 'N', 'S'};
+const uint32_t SNAPSHOT_FORMAT = 1;
+
+struct SnapshotHeader {
+  char magic[4];
+  uint32_t format;
+  // guards against a layout change of SnapshotEntry or NodeStat
+  uint32_t entry_size;
+  uint32_t count;
+  uint64_t index_offset;
+  uint64_t file_size;
+};
+
+struct SnapshotEntry {
+  uint64_t path_offset;
+  uint64_t data_offset;
+  uint32_t path_size;
+  uint32_t data_size;
+  NodeStat stat;
+};
+
+// nodes checked per round of pipelined requests
+const size_t REVALIDATE_BATCH = 1024;
+
+}
+
+struct NodeCache::Snapshot {
+  ~Snapshot() {
+    munmap(const_cast<char*>(base), size);
+  }
+
+  std::string Path(const SnapshotEntry& entry) const {
+    return std::string(base + entry.path_offset, entry.path_size);
+  }
+
+  const SnapshotEntry* Find(const std::string& path) const {
+    auto end = entries + count;
+    auto it = std::lower_bound(entries, end, path,
+                               [this](const SnapshotEntry& entry, const std::string& p) {
+      auto n = std::min<size_t>(entry.path_size, p.size());
+      auto c = memcmp(base + entry.path_offset, p.data(), n);
+      return c < 0 || (c == 0 && entry.path_size < p.size());
+    });
+    if (it == end
+        || it->path_size != path.size()
+        || memcmp(base + it->path_offset, path.data(), path.size()) != 0) {
+      return nullptr;
+    }
+    return it;
+  }
+
+  void Read(const SnapshotEntry& entry, CachedNode* node) const {
+    node->data.assign(base + entry.data_offset, entry.data_size);
+    node->stat = entry.stat;
+  }
+
+  const char* base = nullptr;
+  size_t size = 0;
+  const SnapshotEntry* entries = nullptr;
+  size_t count = 0;
+};
+
+NodeCache::NodeCache(ZooKeeper& zk)
+: zk_(zk) {
+}
+
+NodeCache::~NodeCache() {
+  if (revalidate_thread_.joinable()) {
+    revalidate_thread_.join();
+  }
+}
+
+bool NodeCache::Load(const std::string& snapshot_path) {
+  auto fd = open(snapshot_path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0
+      || static_cast<size_t>(file_stat.st_size) < sizeof(SnapshotHeader)) {
+    close(fd);
+    return false;
+  }
+
+  auto size = static_cast<size_t>(file_stat.st_size);
+  auto base = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) {
+    return false;
+  }
+
+  std::unique_ptr<Snapshot> snapshot(new Snapshot);
+  snapshot->base = static_cast<const char*>(base);
+  snapshot->size = size;
+
+  auto header = reinterpret_cast<const SnapshotHeader*>(snapshot->base);
+  if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0
+      || header->format != SNAPSHOT_FORMAT
+      || header->entry_size != sizeof(SnapshotEntry)
+      || header->file_size != size
+      || header->index_offset % alignof(SnapshotEntry) != 0
+      || header->index_offset > size
+      || (size - header->index_offset) / sizeof(SnapshotEntry) < header->count) {
+    return false;
+  }
+
+  snapshot->entries = reinterpret_cast<const SnapshotEntry*>(
+      snapshot->base + header->index_offset);
+  snapshot->count = header->count;
+
+  for (size_t i = 0; i < snapshot->count; ++i) {
+    // checked field by field, a corrupted offset can't wrap around
+    auto& entry = snapshot->entries[i];
+    auto limit = header->index_offset;
+    if (entry.path_size > limit || entry.path_offset > limit - entry.path_size
+        || entry.data_size > limit || entry.data_offset > limit - entry.data_size) {
+      return false;
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  snapshot_ = std::move(snapshot);
+  overlay_.clear();
+  return true;
+}
+
+void NodeCache::Save(const std::string& snapshot_path) const {
+  auto temp_path = snapshot_path + ".tmp";
+  auto file = fopen(temp_path.c_str(), "wb");
+  if (!file) {
+    throw ZooSystemErrorFromErrno(errno);
+  }
+
+  std::vector<SnapshotEntry> entries;
+  uint64_t offset = sizeof(SnapshotHeader);
+  bool ok = fseek(file, offset, SEEK_SET) == 0;
+
+  auto write_entry = [&](const char* path, size_t path_size,
+                         const char* data, size_t data_size,
+                         const NodeStat& stat) {
+    SnapshotEntry entry;
+    entry.path_offset = offset;
+    entry.path_size = path_size;
+    entry.data_offset = offset + path_size;
+    entry.data_size = data_size;
+    entry.stat = stat;
+    entries.push_back(entry);
+
+    ok = ok && fwrite(path, 1, path_size, file) == path_size
+            && fwrite(data, 1, data_size, file) == data_size;
+    offset += path_size + data_size;
+  };
+
+  {
+    // merge the snapshot and the overlay, both sorted by path
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t i = 0;
+    auto count = snapshot_ ? snapshot_->count : 0;
+    auto it = overlay_.begin();
+    while (i < count || it != overlay_.end()) {
+      if (it == overlay_.end()
+          || (i < count && snapshot_->Path(snapshot_->entries[i]) < it->first)) {
+        auto& entry = snapshot_->entries[i++];
+        write_entry(snapshot_->base + entry.path_offset, entry.path_size,
+                    snapshot_->base + entry.data_offset, entry.data_size,
+                    entry.stat);
+        continue;
+      }
+
+      if (i < count && snapshot_->Path(snapshot_->entries[i]) == it->first) {
+        ++i;
+      }
+      if (!it->second.removed) {
+        auto& node = it->second.node;
+        write_entry(it->first.data(), it->first.size(),
+                    node.data.data(), node.data.size(), node.stat);
+      }
+      ++it;
+    }
+  }
+
+  // align the index, it's used in place once mapped
+  static const char PADDING[alignof(SnapshotEntry)] = {};
+  auto padding = (alignof(SnapshotEntry) - offset % alignof(SnapshotEntry))
+                 % alignof(SnapshotEntry);
+  ok = ok && fwrite(PADDING, 1, padding, file) == padding;
+  offset += padding;
+
+  SnapshotHeader header;
+  memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+  header.format = SNAPSHOT_FORMAT;
+  header.entry_size = sizeof(SnapshotEntry);
+  header.count = entries.size();
+  header.index_offset = offset;
+  header.file_size = offset + entries.size() * sizeof(SnapshotEntry);
+
+  ok = ok && fwrite(entries.data(), sizeof(SnapshotEntry), entries.size(), file) == entries.size()
+          && fseek(file, 0, SEEK_SET) == 0
+          && fwrite(&header, sizeof(header), 1, file) == 1
+          && fflush(file) == 0
+          && fsync(fileno(file)) == 0;
+  auto saved_errno = errno;
+  fclose(file);
+
+  if (!ok || rename(temp_path.c_str(), snapshot_path.c_str()) != 0) {
+    saved_errno = ok ? errno : saved_errno;
+    unlink(temp_path.c_str());
+    throw ZooSystemErrorFromErrno(saved_errno);
+  }
+}
+
+bool NodeCache::Lookup(const std::string& path, CachedNode* node) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  auto it = overlay_.find(path);
+  if (it != overlay_.end()) {
+    if (it->second.removed) return false;
+    *node = it->second.node;
+    return true;
+  }
+
+  auto entry = snapshot_ ? snapshot_->Find(path) : nullptr;
+  if (!entry) {
+    return false;
+  }
+  snapshot_->Read(*entry, node);
+  return true;
+}
+
+bool NodeCache::LookupStat(const std::string& path, NodeStat* stat) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  auto it = overlay_.find(path);
+  if (it != overlay_.end()) {
+    if (it->second.removed) return false;
+    *stat = it->second.node.stat;
+    return true;
+  }
+
+  auto entry = snapshot_ ? snapshot_->Find(path) : nullptr;
+  if (!entry) {
+    return false;
+  }
+  *stat = entry->stat;
+  return true;
+}
+
+CachedNode NodeCache::Get(const std::string& path) {
+  CachedNode node;
+  if (Lookup(path, &node)) {
+    return node;
+  }
+
+  auto result = PipelinedGet(zk_, {path})[0];
+  if (result.code != ZOK) {
+    throw ZooException(result.code);
+  }
+
+  node.data = std::move(result.value);
+  node.stat = result.stat;
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto& entry = overlay_[path];
+  entry.removed = false;
+  entry.node = node;
+  return node;
+}
+
+void NodeCache::Fetch(const std::vector<std::string>& paths) {
+  auto results = PipelinedGet(zk_, paths);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (size_t i = 0; i < paths.size(); ++i) {
+    auto& result = results[i];
+    if (result.code == ZNONODE) {
+      // deleted since checked, as Invalidate does with mutex_ held
+      overlay_[paths[i]].removed = true;
+      continue;
+    }
+    if (result.code != ZOK) {
+      throw ZooException(result.code);
+    }
+
+    auto& entry = overlay_[paths[i]];
+    entry.removed = false;
+    entry.node.data = std::move(result.value);
+    entry.node.stat = result.stat;
+  }
+}
+
+void NodeCache::Invalidate(const std::string& path) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  overlay_[path].removed = true;
+}
+
+std::vector<std::string> NodeCache::CachedPaths() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  std::vector<std::string> paths;
+  if (snapshot_) {
+    for (size_t i = 0; i < snapshot_->count; ++i) {
+      auto path = snapshot_->Path(snapshot_->entries[i]);
+      if (!overlay_.count(path)) paths.push_back(std::move(path));
+    }
+  }
+  for (auto& entry : overlay_) {
+    if (!entry.second.removed) paths.push_back(entry.first);
+  }
+  return paths;
+}
+
+size_t NodeCache::size() const {
+  return CachedPaths().size();
+}
+
+RevalidateStats NodeCache::Revalidate() {
+  RevalidateStats stats;
+
+  auto paths = CachedPaths();
+  for (size_t begin = 0; begin < paths.size(); begin += REVALIDATE_BATCH) {
+    auto end = std::min(paths.size(), begin + REVALIDATE_BATCH);
+    std::vector<std::string> batch(paths.begin() + begin, paths.begin() + end);
+
+    std::vector<int> codes(batch.size());
+    std::vector<NodeStat> stats_now(batch.size());
+    PipelinedExists(zk_, batch, [&](size_t i, int code, const NodeStat& stat) {
+      codes[i] = code;
+      stats_now[i] = stat;
+    });
+
+    std::vector<std::string> changed;
+    for (size_t i = 0; i < batch.size(); ++i) {
+      if (codes[i] == ZNONODE) {
+        Invalidate(batch[i]);
+        ++stats.removed;
+        continue;
+      }
+      if (codes[i] != ZOK) {
+        throw ZooException(codes[i]);
+      }
+
+      NodeStat cached;
+      if (!LookupStat(batch[i], &cached)
+          || cached.mzxid != stats_now[i].mzxid
+          || cached.version != stats_now[i].version) {
+        changed.push_back(batch[i]);
+      }
+    }
+
+    stats.checked += batch.size();
+    stats.changed += changed.size();
+    Fetch(changed);
+  }
+
+  return stats;
+}
+
+std::future<RevalidateStats> NodeCache::RevalidateInBackground() {
+  if (revalidate_thread_.joinable()) {
+    revalidate_thread_.join();
+  }
+
+  std::packaged_task<RevalidateStats()> task([this] { return Revalidate(); });
+  auto result = task.get_future();
+  revalidate_thread_ = std::thread(std::move(task));
+  return result;
+}
+
+}
@@ -0,0 +1,94 @@
+#pragma once
+#include <future>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "zookeeper.hpp"
+
+namespace zookeeper {
+
+struct CachedNode {
+  std::string data;
+  NodeStat stat = NodeStat();
+};
+
+struct RevalidateStats {
+  // cached nodes whose stat was checked
+  size_t checked = 0;
+  // nodes fetched again because their mzxid changed
+  size_t changed = 0;
+  // nodes dropped because they were deleted
+  size_t removed = 0;
+};
+
+// Client side cache of node data and stat, which can be persisted to a
+// snapshot file to avoid re-reading everything after a restart.
+//
+// A loaded snapshot is memory mapped and served as it is, lookups binary
+// search its sorted index; nodes fetched or revalidated later are kept in
+// memory in front of it. Revalidate() checks every cached node with
+// pipelined exists requests and re-fetches only those whose mzxid changed.
+class NodeCache {
+public:
+  explicit NodeCache(ZooKeeper& zk);
+
+  // waits for a background revalidation
+  ~NodeCache();
+
+  // disable copy
+  NodeCache(const NodeCache&) = delete;
+  NodeCache& operator=(const NodeCache&) = delete;
+
+  // Serve the nodes saved in |snapshot_path|, replacing the cache content.
+  // Returns false if the file is missing or not a valid snapshot.
+  bool Load(const std::string& snapshot_path);
+
+  // Write all cached nodes to |snapshot_path|, replacing it atomically.
+  void Save(const std::string& snapshot_path) const;
+
+  // cached node without touching the network
+  bool Lookup(const std::string& path, CachedNode* node) const;
+
+  // Cached node, fetched on a miss. Throws ZooException like ZooKeeper::Get.
+  CachedNode Get(const std::string& path);
+
+  // fetch |paths| into the cache with pipelined gets, missing nodes are
+  // skipped
+  void Fetch(const std::vector<std::string>& paths);
+
+  void Invalidate(const std::string& path);
+
+  size_t size() const;
+
+  // Must not be called from a watcher or completion callback.
+  RevalidateStats Revalidate();
+
+  // Revalidate on a background thread, cached nodes are served meanwhile.
+  std::future<RevalidateStats> RevalidateInBackground();
+
+private:
+  struct Snapshot;
+
+  // node fetched or deleted since the snapshot was loaded
+  struct Entry {
+    bool removed = false;
+    CachedNode node;
+  };
+
+  std::vector<std::string> CachedPaths() const;
+
+  // stat of a cached node, without copying its data
+  bool LookupStat(const std::string& path, NodeStat* stat) const;
+
+  ZooKeeper& zk_;
+
+  mutable std::mutex mutex_;
+  std::unique_ptr<Snapshot> snapshot_;
+  std::map<std::string, Entry> overlay_;
+
+  std::thread revalidate_thread_;
+};
+
+}
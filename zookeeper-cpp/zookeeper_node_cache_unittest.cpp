@@ -0,0 +1,139 @@
+#include "zookeeper.hpp"
+#include "zookeeper_node_cache.hpp"
+#include "zookeeper_error.hpp"
+#include <gtest/gtest.h>
+#include <unistd.h>
+#include "zookeeper_unittest_helper.hpp"
+
+using namespace zookeeper;
+using namespace testing;
+
+static const char SNAPSHOT_PATH[] = "/tmp/zookeeper_node_cache_unittest.snapshot";
+
+TEST_F(ZooKeeperTest, NodeCacheSaveThenLoad) {
+  zk.Create("/test", "root");
+  zk.Create("/test/a", "value a");
+  zk.Create("/test/b", std::string(10000, 'b'));
+
+  {
+    NodeCache cache(zk);
+    cache.Fetch({"/test", "/test/a", "/test/b", "/test/missing"});
+    EXPECT_EQ(cache.size(), 3u);
+    cache.Save(SNAPSHOT_PATH);
+  }
+
+  zk.Delete("/test/a");
+  zk.Delete("/test/b");
+  zk.Delete("/test");
+
+  // served from the snapshot, without asking the server
+  NodeCache cache(zk);
+  ASSERT_TRUE(cache.Load(SNAPSHOT_PATH));
+  EXPECT_EQ(cache.size(), 3u);
+
+  CachedNode node;
+  ASSERT_TRUE(cache.Lookup("/test/a", &node));
+  EXPECT_EQ(node.data, "value a");
+  ASSERT_TRUE(cache.Lookup("/test/b", &node));
+  EXPECT_EQ(node.data, std::string(10000, 'b'));
+  EXPECT_EQ(cache.Get("/test").data, "root");
+  EXPECT_FALSE(cache.Lookup("/test/missing", &node));
+
+  unlink(SNAPSHOT_PATH);
+}
+
+TEST_F(ZooKeeperTest, NodeCacheLoadRejectsBadSnapshot) {
+  NodeCache cache(zk);
+  EXPECT_FALSE(cache.Load("/tmp/zookeeper_node_cache_unittest.missing"));
+
+  auto file = fopen(SNAPSHOT_PATH, "wb");
+  fputs("not a snapshot, just some text long enough for a header", file);
+  fclose(file);
+  EXPECT_FALSE(cache.Load(SNAPSHOT_PATH));
+
+  unlink(SNAPSHOT_PATH);
+}
+
+TEST_F(ZooKeeperTest, NodeCacheLoadRejectsWrappingOffset) {
+  zk.Create("/test", "root");
+  {
+    NodeCache cache(zk);
+    cache.Fetch({"/test"});
+    cache.Save(SNAPSHOT_PATH);
+  }
+  zk.Delete("/test");
+
+  // the header's index offset follows magic, format, entry size and count;
+  // the first entry starts with its path offset
+  auto file = fopen(SNAPSHOT_PATH, "r+b");
+  ASSERT_TRUE(file != nullptr);
+  uint64_t index_offset = 0;
+  fseek(file, 16, SEEK_SET);
+  ASSERT_EQ(fread(&index_offset, sizeof(index_offset), 1, file), 1u);
+  // wraps around to a small end offset once the path size is added
+  uint64_t path_offset = UINT64_MAX - 1;
+  fseek(file, index_offset, SEEK_SET);
+  fwrite(&path_offset, sizeof(path_offset), 1, file);
+  fclose(file);
+
+  NodeCache cache(zk);
+  EXPECT_FALSE(cache.Load(SNAPSHOT_PATH));
+
+  unlink(SNAPSHOT_PATH);
+}
+
+TEST_F(ZooKeeperTest, NodeCacheRevalidate) {
+  zk.Create("/test", "root");
+  zk.Create("/test/same", "same");
+  zk.Create("/test/changed", "old");
+  zk.Create("/test/deleted", "deleted");
+
+  {
+    NodeCache cache(zk);
+    cache.Fetch({"/test", "/test/same", "/test/changed", "/test/deleted"});
+    cache.Save(SNAPSHOT_PATH);
+  }
+
+  zk.Set("/test/changed", "new");
+  zk.Delete("/test/deleted");
+
+  NodeCache cache(zk);
+  ASSERT_TRUE(cache.Load(SNAPSHOT_PATH));
+
+  auto stats = cache.RevalidateInBackground().get();
+  EXPECT_EQ(stats.checked, 4u);
+  EXPECT_EQ(stats.changed, 1u);
+  EXPECT_EQ(stats.removed, 1u);
+
+  CachedNode node;
+  ASSERT_TRUE(cache.Lookup("/test/changed", &node));
+  EXPECT_EQ(node.data, "new");
+  EXPECT_FALSE(cache.Lookup("/test/deleted", &node));
+  EXPECT_EQ(cache.size(), 3u);
+
+  // the overlay is merged into the next snapshot
+  cache.Save(SNAPSHOT_PATH);
+  NodeCache reloaded(zk);
+  ASSERT_TRUE(reloaded.Load(SNAPSHOT_PATH));
+  EXPECT_EQ(reloaded.size(), 3u);
+  EXPECT_EQ(reloaded.Get("/test/changed").data, "new");
+  EXPECT_EQ(reloaded.Revalidate().changed, 0u);
+
+  zk.Delete("/test/changed");
+  zk.Delete("/test/same");
+  zk.Delete("/test");
+  unlink(SNAPSHOT_PATH);
+}
+
+TEST_F(ZooKeeperTest, NodeCacheFetchDropsDeletedNode) {
+  zk.Create("/test", "root");
+
+  NodeCache cache(zk);
+  cache.Fetch({"/test"});
+  zk.Delete("/test");
+
+  cache.Fetch({"/test"});
+  CachedNode node;
+  EXPECT_FALSE(cache.Lookup("/test", &node));
+  EXPECT_EQ(cache.size(), 0u);
+}
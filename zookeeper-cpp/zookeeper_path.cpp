@@ -0,0 +1,113 @@
+#include "zookeeper_path.hpp"
+#include <cstring>
+#include <map>
+#include <shared_mutex>
+#include <zookeeper/zookeeper.h>
+#include "zookeeper_error.hpp"
+
+namespace zookeeper {
+
+PathBuffer::PathBuffer(PathView path) {
+  char* data = inline_;
+  if (path.size() >= sizeof(inline_)) {
+    heap_.reset(new char[path.size() + 1]);
+    data = heap_.get();
+  }
+
+  memcpy(data, path.data(), path.size());
+  data[path.size()] = '\0';
+  data_ = data;
+}
+
+struct ZPath::Node {
+  std::string path;
+  const Node* parent = nullptr;
+  size_t depth = 0;
+  // guarded by the interning lock
+  std::map<std::string, std::unique_ptr<Node>, std::less<>> children;
+};
+
+namespace {
+
+std::shared_timed_mutex& InternMutex() {
+  static std::shared_timed_mutex mutex;
+  return mutex;
+}
+
+bool IsValidName(PathView name) {
+  return !name.empty() && name.find('/') == PathView::npos;
+}
+
+}
+
+ZPath::ZPath() {
+  // never freed, like the nodes interned below it
+  static const Node* root = [] {
+    auto node = new Node;
+    node->path = "/";
+    return node;
+  }();
+  node_ = root;
+}
+
+ZPath::ZPath(PathView path)
+: ZPath() {
+  if (path.empty() || path[0] != '/' || (path.size() > 1 && path.back() == '/')) {
+    throw ZooException(ZBADARGUMENTS, "invalid path");
+  }
+
+  size_t begin = 1;
+  while (begin < path.size()) {
+    auto end = path.find('/', begin);
+    if (end == PathView::npos) end = path.size();
+    *this = Child(path.substr(begin, end - begin));
+    begin = end + 1;
+  }
+}
+
+ZPath ZPath::Child(PathView name) const {
+  if (!IsValidName(name)) {
+    throw ZooException(ZBADARGUMENTS, "invalid path component");
+  }
+
+  auto& mutex = InternMutex();
+  auto& children = const_cast<Node*>(node_)->children;
+  {
+    std::shared_lock<std::shared_timed_mutex> lock(mutex);
+    auto it = children.find(name);
+    if (it != children.end()) return ZPath(it->second.get());
+  }
+
+  std::lock_guard<std::shared_timed_mutex> lock(mutex);
+  auto& child = children[name.to_string()];
+  if (!child) {
+    child.reset(new Node);
+    child->path.reserve(node_->path.size() + 1 + name.size());
+    if (node_->parent) child->path = node_->path;
+    child->path += '/';
+    child->path.append(name.data(), name.size());
+    child->parent = node_;
+    child->depth = node_->depth + 1;
+  }
+  return ZPath(child.get());
+}
+
+ZPath ZPath::parent() const {
+  return node_->parent ? ZPath(node_->parent) : *this;
+}
+
+PathView ZPath::name() const {
+  if (!node_->parent) return PathView();
+  PathView path(node_->path);
+  return path.substr(path.rfind('/') + 1);
+}
+
+size_t ZPath::depth() const {
+  return node_->depth;
+}
+
+const std::string& ZPath::str() const {
+  return node_->path;
+}
+
+}
@@ -0,0 +1,87 @@
+#pragma once
+#include <experimental/string_view>
+#include <memory>
+#include <string>
+
+namespace zookeeper {
+
+// Path argument accepting std::string, string literals and slices of
+// either without a temporary std::string.
+typedef std::experimental::string_view PathView;
+
+// Null terminated copy of a path for the client library, kept on the stack
+// unless the path is unusually long.
+class PathBuffer {
+public:
+  explicit PathBuffer(PathView path);
+
+  // disable copy
+  PathBuffer(const PathBuffer&) = delete;
+  PathBuffer& operator=(const PathBuffer&) = delete;
+
+  const char* c_str() const {
+    return data_;
+  }
+
+private:
+  char inline_[256];
+  std::unique_ptr<char[]> heap_;
+  const char* data_;
+};
+
+// Interned absolute path. Each distinct path is stored once for the life of
+// the process, along with its parent and last component, so copying a
+// ZPath, taking its parent, or looking up a child which was built before
+// costs no allocation. Meant for the bounded set of paths a process keeps
+// coming back to, e.g. election or config directories, not for sequence
+// nodes.
+class ZPath {
+public:
+  // the root
+  ZPath();
+
+  // throws ZooException with ZBADARGUMENTS if |path| isn't a valid
+  // absolute path
+  explicit ZPath(PathView path);
+
+  // |name| is a single path component
+  ZPath Child(PathView name) const;
+
+  // the root is its own parent
+  ZPath parent() const;
+
+  // last component, empty for the root
+  PathView name() const;
+
+  // components below the root
+  size_t depth() const;
+
+  const std::string& str() const;
+
+  const char* c_str() const {
+    return str().c_str();
+  }
+
+  operator PathView() const {
+    return str();
+  }
+
+  bool operator==(const ZPath& other) const {
+    return node_ == other.node_;
+  }
+
+  bool operator!=(const ZPath& other) const {
+    return node_ != other.node_;
+  }
+
+private:
+  struct Node;
+
+  explicit ZPath(const Node* node)
+  : node_(node) {
+  }
+
+  const Node* node_;
+};
+
+}
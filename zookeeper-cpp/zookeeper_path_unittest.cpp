@@ -0,0 +1,64 @@
+#include "zookeeper.hpp"
+#include "zookeeper_path.hpp"
+#include "zookeeper_error.hpp"
+#include <gtest/gtest.h>
+#include "zookeeper_unittest_helper.hpp"
+
+using namespace zookeeper;
+using namespace testing;
+
+TEST(PathBuffer, TerminatesSlices) {
+  std::string path = "/a/b/c";
+  PathBuffer parent(PathView(path).substr(0, 4));
+  EXPECT_STREQ("/a/b", parent.c_str());
+
+  std::string long_path = "/" + std::string(1000, 'x');
+  PathBuffer buffer(long_path);
+  EXPECT_EQ(long_path, buffer.c_str());
+}
+
+TEST(ZPath, InternsPaths) {
+  ZPath path("/service/election");
+  EXPECT_EQ("/service/election", path.str());
+  EXPECT_EQ("election", path.name().to_string());
+  EXPECT_EQ(2u, path.depth());
+  EXPECT_EQ("/service", path.parent().str());
+  EXPECT_EQ(ZPath(), path.parent().parent());
+
+  EXPECT_EQ("/", ZPath().str());
+  EXPECT_EQ(ZPath(), ZPath().parent());
+  EXPECT_TRUE(ZPath().name().empty());
+  EXPECT_EQ(0u, ZPath().depth());
+
+  // built once, the same node is found again
+  EXPECT_EQ(path, ZPath("/service").Child("election"));
+  EXPECT_EQ(&path.str(), &ZPath("/service/election").str());
+  EXPECT_NE(path, path.Child("proc_"));
+  EXPECT_EQ("/service/election/proc_", path.Child("proc_").str());
+}
+
+TEST(ZPath, RejectsInvalidPaths) {
+  EXPECT_THROW(ZPath(""), ZooException);
+  EXPECT_THROW(ZPath("relative"), ZooException);
+  EXPECT_THROW(ZPath("/trailing/"), ZooException);
+  EXPECT_THROW(ZPath("/double//slash"), ZooException);
+  EXPECT_THROW(ZPath("/a").Child("b/c"), ZooException);
+  EXPECT_THROW(ZPath("/a").Child(""), ZooException);
+}
+
+TEST_F(ZooKeeperTest, OperationsOnPathViews) {
+  ZPath test("/test");
+  zk.Create(test, "value");
+  zk.Create(test.Child("child"), "child value");
+
+  // slices of a larger buffer aren't null terminated
+  std::string paths = "/test/child,/test";
+  auto comma = paths.find(',');
+  auto child = PathView(paths).substr(0, comma);
+  EXPECT_EQ("child value", zk.Get(child));
+  EXPECT_EQ(std::vector<std::string>{"child"}, zk.GetChildren(test));
+
+  zk.Delete(child);
+  zk.Delete(PathView(paths).substr(comma + 1));
+  EXPECT_FALSE(zk.Exists(test));
+}
@@ -0,0 +1,28 @@
+#include "zookeeper_retry.hpp"
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+namespace zookeeper {
+
+bool IsRetryable(int code) {
+  return code == ZCONNECTIONLOSS || code == ZOPERATIONTIMEOUT;
+}
+
+Backoff::Backoff(const RetryPolicy& policy)
+: policy_(policy) {
+}
+
+std::chrono::milliseconds Backoff::Next() {
+  static thread_local std::mt19937 rng(std::random_device{}());
+
+  auto backoff = policy_.initial_backoff.count()
+                 * std::pow(policy_.multiplier, attempts_);
+  backoff = std::min(backoff, static_cast<double>(policy_.max_backoff.count()));
+  ++attempts_;
+
+  std::uniform_real_distribution<double> jitter(backoff / 2, backoff);
+  return std::chrono::milliseconds(static_cast<int64_t>(jitter(rng)));
+}
+
+}
@@ -0,0 +1,79 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <thread>
+#include "zookeeper.hpp"
+#include "zookeeper_error.hpp"
+
+namespace zookeeper {
+
+// whether an operation failing with |code| may succeed when tried again,
+// i.e. the request was lost or timed out before a reply
+bool IsRetryable(int code);
+
+struct RetryPolicy {
+  // attempts in total, the first one included
+  int max_attempts = 5;
+  std::chrono::milliseconds initial_backoff{50};
+  std::chrono::milliseconds max_backoff{2000};
+  double multiplier = 2.0;
+  // bound of all attempts and backoffs together, zero for none
+  std::chrono::milliseconds timeout{0};
+};
+
+// Jittered exponential backoff: the n-th delay is drawn uniformly from
+// [d/2, d] with d = initial_backoff * multiplier^n capped by max_backoff,
+// so clients failing together don't retry in lockstep.
+class Backoff {
+public:
+  explicit Backoff(const RetryPolicy& policy = RetryPolicy());
+
+  std::chrono::milliseconds Next();
+
+  void Reset() {
+    attempts_ = 0;
+  }
+
+  int attempts() const {
+    return attempts_;
+  }
+
+private:
+  RetryPolicy policy_;
+  int attempts_ = 0;
+};
+
+// Call |operation| until it returns, throws a ZooException which isn't
+// retryable, or the policy runs out of attempts or time; the last error is
+// thrown then. Attempts run under the policy timeout as a ScopedDeadline, so
+// a blocked attempt is cut off too. Retried operations must be idempotent,
+// a lost create may have been applied.
+template <typename Operation>
+auto Retry(const RetryPolicy& policy, const Operation& operation) -> decltype(operation()) {
+  auto deadline = Deadline::max();
+  if (policy.timeout.count() > 0) {
+    deadline = std::chrono::steady_clock::now() + policy.timeout;
+  }
+  ScopedDeadline scoped_deadline(deadline);
+  deadline = ScopedDeadline::current();
+
+  Backoff backoff(policy);
+  for (int attempt = 1; ; ++attempt) {
+    try {
+      return operation();
+    } catch (const ZooException& e) {
+      if (!IsRetryable(e.code()) || attempt >= policy.max_attempts) {
+        throw;
+      }
+
+      auto delay = backoff.Next();
+      if (deadline != Deadline::max()
+          && std::chrono::steady_clock::now() + delay >= deadline) {
+        throw;
+      }
+      std::this_thread::sleep_for(delay);
+    }
+  }
+}
+
+}
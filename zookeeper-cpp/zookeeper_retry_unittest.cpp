@@ -0,0 +1,130 @@
+#include "zookeeper.hpp"
+#include "zookeeper_retry.hpp"
+#include "zookeeper_ext.hpp"
+#include "zookeeper_error.hpp"
+#include <gtest/gtest.h>
+#include "zookeeper_unittest_helper.hpp"
+
+using namespace zookeeper;
+using namespace testing;
+using std::chrono::milliseconds;
+
+TEST(Retry, BackoffGrowsWithJitter) {
+  RetryPolicy policy;
+  policy.initial_backoff = milliseconds(100);
+  policy.max_backoff = milliseconds(1000);
+
+  Backoff backoff(policy);
+  int64_t expected[] = {100, 200, 400, 800, 1000, 1000};
+  for (auto ms : expected) {
+    auto delay = backoff.Next().count();
+    EXPECT_GE(delay, ms / 2);
+    EXPECT_LE(delay, ms);
+  }
+  EXPECT_EQ(backoff.attempts(), 6);
+
+  backoff.Reset();
+  EXPECT_LE(backoff.Next().count(), 100);
+}
+
+TEST(Retry, RetryableErrors) {
+  EXPECT_TRUE(IsRetryable(ZCONNECTIONLOSS));
+  EXPECT_TRUE(IsRetryable(ZOPERATIONTIMEOUT));
+  EXPECT_FALSE(IsRetryable(ZNONODE));
+  EXPECT_FALSE(IsRetryable(ZNODEEXISTS));
+  EXPECT_FALSE(IsRetryable(ZSESSIONEXPIRED));
+}
+
+TEST(Retry, RetryUntilSuccess) {
+  RetryPolicy policy;
+  policy.initial_backoff = milliseconds(1);
+
+  int attempts = 0;
+  auto result = Retry(policy, [&attempts] {
+    if (++attempts < 3) throw ZooException(ZCONNECTIONLOSS);
+    return attempts;
+  });
+  EXPECT_EQ(result, 3);
+}
+
+TEST(Retry, NoRetryOfOtherErrors) {
+  int attempts = 0;
+  EXPECT_THROW(Retry(RetryPolicy(), [&attempts] {
+    ++attempts;
+    throw ZooException(ZNONODE);
+  }), ZooException);
+  EXPECT_EQ(attempts, 1);
+}
+
+TEST(Retry, BoundedAttemptsAndTime) {
+  RetryPolicy policy;
+  policy.initial_backoff = milliseconds(1);
+  policy.max_attempts = 4;
+
+  int attempts = 0;
+  EXPECT_THROW(Retry(policy, [&attempts] {
+    ++attempts;
+    throw ZooException(ZOPERATIONTIMEOUT);
+  }), ZooException);
+  EXPECT_EQ(attempts, 4);
+
+  policy.max_attempts = 1000;
+  policy.initial_backoff = milliseconds(20);
+  policy.timeout = milliseconds(200);
+
+  auto start = std::chrono::steady_clock::now();
+  EXPECT_THROW(Retry(policy, [] {
+    throw ZooException(ZCONNECTIONLOSS);
+  }), ZooException);
+  EXPECT_LT(std::chrono::steady_clock::now() - start, milliseconds(250));
+}
+
+TEST(Retry, ScopedDeadlinesNest) {
+  EXPECT_EQ(ScopedDeadline::current(), Deadline::max());
+  {
+    ScopedDeadline outer(milliseconds(100));
+    auto outer_deadline = ScopedDeadline::current();
+    {
+      ScopedDeadline inner(milliseconds(10000));
+      EXPECT_EQ(ScopedDeadline::current(), outer_deadline);
+    }
+    {
+      ScopedDeadline inner(milliseconds(10));
+      EXPECT_LT(ScopedDeadline::current(), outer_deadline);
+    }
+    EXPECT_EQ(ScopedDeadline::current(), outer_deadline);
+  }
+  EXPECT_EQ(ScopedDeadline::current(), Deadline::max());
+}
+
+TEST_F(ZooKeeperTest, OperationsWithinDeadline) {
+  zk.set_operation_timeout(milliseconds(5000));
+
+  zk.Create("/test", "value");
+  EXPECT_TRUE(zk.Exists("/test"));
+  EXPECT_EQ(zk.Get("/test"), "value");
+  zk.Set("/test", "new value");
+  EXPECT_EQ(zk.Get("/test"), "new value");
+  EXPECT_EQ(zk.Create("/test/child"), "/test/child");
+  EXPECT_EQ(zk.GetChildren("/test"), std::vector<std::string>{"child"});
+
+  MultiOps ops;
+  ops.Delete("/test/child");
+  ops.Delete("/test");
+  zk.Multi(ops);
+  EXPECT_FALSE(zk.Exists("/test"));
+}
+
+TEST_F(ZooKeeperTest, ExpiredDeadlineFailsFast) {
+  ScopedDeadline deadline(milliseconds(0));
+
+  try {
+    zk.Exists("/");
+    FAIL() << "no timeout";
+  } catch (const ZooException& e) {
+    EXPECT_EQ(e.code(), ZOPERATIONTIMEOUT);
+  }
+
+  auto results = PipelinedGet(zk, {"/"});
+  EXPECT_EQ(results[0].code, ZOPERATIONTIMEOUT);
+}
@@ -0,0 +1,98 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace zookeeper {
+
+namespace detail {
+
+// Bounded multi producer ring buffer, after Dmitry Vyukov's queue, with a
+// single consumer. Values are written and read in place, the slots are
+// reused and never destroyed before the buffer.
+template <typename T>
+class RingBuffer {
+public:
+  struct Slot {
+    // Slot is free for the position equal to sequence, and readable at
+    // sequence - 1 once published
+    std::atomic<size_t> sequence;
+    T value;
+  };
+
+  // |capacity| is a power of two
+  explicit RingBuffer(size_t capacity)
+  : capacity_(capacity),
+    slots_(new Slot[capacity]) {
+    for (size_t i = 0; i < capacity_; ++i) {
+      slots_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  // disable copy
+  RingBuffer(const RingBuffer&) = delete;
+  RingBuffer& operator=(const RingBuffer&) = delete;
+
+  // Claim a slot without blocking; null if the buffer is full.
+  Slot* Claim() {
+    auto pos = enqueue_pos_.load(std::memory_order_relaxed);
+    while (true) {
+      auto& slot = slots_[pos & (capacity_ - 1)];
+      auto sequence = slot.sequence.load(std::memory_order_acquire);
+      auto diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+      if (diff == 0) {
+        if (enqueue_pos_.compare_exchange_weak(pos, pos + 1,
+                                               std::memory_order_relaxed)) {
+          return &slot;
+        }
+      } else if (diff < 0) {
+        // not consumed yet
+        return nullptr;
+      } else {
+        pos = enqueue_pos_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  // Sequentially consistent, so a consumer's sleeping flag read after it
+  // is ordered against the consumer's last Front().
+  void Publish(Slot* slot) {
+    slot->sequence.fetch_add(1);
+  }
+
+  // The oldest value, null if none is published yet. Consumer only.
+  T* Front() {
+    auto pos = dequeue_pos_.load(std::memory_order_relaxed);
+    auto& slot = slots_[pos & (capacity_ - 1)];
+    return slot.sequence.load() == pos + 1 ? &slot.value : nullptr;
+  }
+
+  // Release the value of Front() for reuse. Consumer only.
+  void Pop() {
+    auto pos = dequeue_pos_.load(std::memory_order_relaxed);
+    auto& slot = slots_[pos & (capacity_ - 1)];
+    slot.sequence.store(pos + capacity_, std::memory_order_release);
+    dequeue_pos_.store(pos + 1);
+  }
+
+  // slots claimed and popped so far; everything claimed before a
+  // position is consumed once popped() reaches it
+  size_t claimed() const {
+    return enqueue_pos_.load();
+  }
+
+  size_t popped() const {
+    return dequeue_pos_.load();
+  }
+
+private:
+  const size_t capacity_;
+  std::unique_ptr<Slot[]> slots_;
+  std::atomic<size_t> enqueue_pos_{0};
+  std::atomic<size_t> dequeue_pos_{0};
+};
+
+}
+
+}
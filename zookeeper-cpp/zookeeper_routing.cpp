@@ -0,0 +1,253 @@
+#include "zookeeper_routing.hpp"
+#include <set>
+
+namespace zookeeper {
+
+namespace {
+
+#ifdef ZOO_READONLY
+const bool READ_ONLY_SUPPORTED = true;
+#else
+const bool READ_ONLY_SUPPORTED = false;
+#endif
+
+}
+
+class ReadRoutingZooKeeper::ObserverWatcher : public ZooWatcher {
+public:
+  explicit ObserverWatcher(ZooWatcher* watcher)
+  : watcher_(watcher) {
+  }
+
+  // a watch set through the observer session
+  void Watching(PathView path, bool children) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    (children ? child_watches_ : data_watches_).insert(path.to_string());
+  }
+
+  // the voting member session reports the session events
+  void OnConnected() override {}
+  void OnConnecting() override {}
+
+  void OnSessionExpired() override {
+    // the watches are gone with the session, it's replaced on the next read
+    std::set<std::string> lost;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      lost.swap(data_watches_);
+      lost.insert(child_watches_.begin(), child_watches_.end());
+      child_watches_.clear();
+    }
+    if (!watcher_) return;
+    for (auto& path : lost) {
+      watcher_->OnNotWatching(path.c_str());
+    }
+  }
+
+  void OnCreated(const char* path) override {
+    Fired(path, false);
+    if (watcher_) watcher_->OnCreated(path);
+  }
+
+  void OnDeleted(const char* path) override {
+    Fired(path, false);
+    Fired(path, true);
+    if (watcher_) watcher_->OnDeleted(path);
+  }
+
+  void OnChanged(const char* path) override {
+    Fired(path, false);
+    if (watcher_) watcher_->OnChanged(path);
+  }
+
+  void OnChildChanged(const char* path) override {
+    Fired(path, true);
+    if (watcher_) watcher_->OnChildChanged(path);
+  }
+
+  void OnNotWatching(const char* path) override {
+    if (watcher_) watcher_->OnNotWatching(path);
+  }
+
+private:
+  // a watch is used up by its event
+  void Fired(const char* path, bool children) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    (children ? child_watches_ : data_watches_).erase(path);
+  }
+
+  ZooWatcher* const watcher_;
+
+  std::mutex mutex_;
+  std::set<std::string> data_watches_;
+  std::set<std::string> child_watches_;
+};
+
+ReadRoutingZooKeeper::ReadRoutingZooKeeper(const std::string& voting_hosts,
+                                           const std::string& observer_hosts,
+                                           ZooWatcher* global_watcher,
+                                           int timeout_ms)
+: observer_hosts_(observer_hosts),
+  timeout_ms_(timeout_ms),
+  observer_watcher_(new ObserverWatcher(global_watcher)),
+  voting_(std::make_shared<ZooKeeper>(voting_hosts, global_watcher, timeout_ms)),
+  observer_(std::make_shared<ZooKeeper>(observer_hosts, observer_watcher_.get(),
+                                        timeout_ms, READ_ONLY_SUPPORTED)) {
+}
+
+ReadRoutingZooKeeper::~ReadRoutingZooKeeper() {
+}
+
+ReadRoutingStats ReadRoutingZooKeeper::stats() const {
+  ReadRoutingStats stats;
+  stats.observer_reads = observer_reads_;
+  stats.voting_reads = voting_reads_;
+  stats.syncs = expired_syncs_ + std::atomic_load(&observer_)->syncs();
+  return stats;
+}
+
+std::shared_ptr<ZooKeeper> ReadRoutingZooKeeper::Observer() {
+  auto observer = std::atomic_load(&observer_);
+  if (!observer->is_expired()) return observer;
+
+  // as the recipes reset their client, from a caller's thread rather than
+  // the completion thread of the expired session
+  std::lock_guard<std::mutex> lock(observer_mutex_);
+  observer = std::atomic_load(&observer_);
+  if (observer->is_expired()) {
+    expired_syncs_ += observer->syncs();
+    observer = std::make_shared<ZooKeeper>(observer_hosts_, observer_watcher_.get(),
+                                           timeout_ms_, READ_ONLY_SUPPORTED);
+    std::atomic_store(&observer_, observer);
+    // the new session needs a sync to read the writes made so far
+    synced_writes_ = 0;
+  }
+  return observer;
+}
+
+int ReadRoutingZooKeeper::Reader(std::shared_ptr<ZooKeeper>* reader) {
+  auto observer = Observer();
+  if (!observer->is_connected() && !observer->is_read_only()
+      && voting_->is_connected()) {
+    // the voting session reads its own writes
+    ++voting_reads_;
+    *reader = voting_;
+    return ZOK;
+  }
+
+  ++observer_reads_;
+  *reader = observer;
+  if (observer->is_read_only()) {
+    // cut off from the leader, a sync can't succeed
+    return ZOK;
+  }
+
+  auto writes = writes_.load();
+  if (synced_writes_.load() >= writes) {
+    return ZOK;
+  }
+
+  // concurrent reads share the sync
+  auto zoo_code = observer->TrySync("/").code();
+  if (zoo_code != ZOK) return zoo_code;
+
+  auto synced = synced_writes_.load();
+  while (synced < writes && !synced_writes_.compare_exchange_weak(synced, writes)) {
+  }
+  return ZOK;
+}
+
+ZooResult<NodeStat> ReadRoutingZooKeeper::TryStat(PathView path, bool watch) {
+  std::shared_ptr<ZooKeeper> reader;
+  auto zoo_code = Reader(&reader);
+  if (zoo_code != ZOK) return ZooResult<NodeStat>::Error(zoo_code);
+  if (watch && reader != voting_) observer_watcher_->Watching(path, false);
+  return reader->TryStat(path, watch);
+}
+
+ZooResult<std::string> ReadRoutingZooKeeper::TryGet(PathView path, bool watch) {
+  std::shared_ptr<ZooKeeper> reader;
+  auto zoo_code = Reader(&reader);
+  if (zoo_code != ZOK) return ZooResult<std::string>::Error(zoo_code);
+  if (watch && reader != voting_) observer_watcher_->Watching(path, false);
+  return reader->TryGet(path, watch);
+}
+
+ZooResult<std::vector<std::string>>
+ReadRoutingZooKeeper::TryGetChildren(PathView parent_path, bool watch) {
+  std::shared_ptr<ZooKeeper> reader;
+  auto zoo_code = Reader(&reader);
+  if (zoo_code != ZOK) {
+    return ZooResult<std::vector<std::string>>::Error(zoo_code);
+  }
+  if (watch && reader != voting_) observer_watcher_->Watching(parent_path, true);
+  return reader->TryGetChildren(parent_path, watch);
+}
+
+bool ReadRoutingZooKeeper::Exists(PathView path, bool watch, NodeStat* stat) {
+  auto result = TryStat(path, watch);
+  if (result.code() == ZNONODE) return false;
+  // throws the other errors
+  auto node_stat = result.value();
+  if (stat) *stat = node_stat;
+  return true;
+}
+
+std::string ReadRoutingZooKeeper::Get(PathView path, bool watch) {
+  return TryGet(path, watch).value();
+}
+
+std::vector<std::string> ReadRoutingZooKeeper::GetChildren(PathView parent_path,
+                                                           bool watch) {
+  return TryGetChildren(parent_path, watch).value();
+}
+
+template <typename Write>
+auto ReadRoutingZooKeeper::Written(const Write& write) -> decltype(write()) {
+  auto result = write();
+  // counted even if failed, a lost write may have been applied
+  ++writes_;
+  return result;
+}
+
+ZooResult<std::string> ReadRoutingZooKeeper::TryCreate(PathView path,
+                                                       const std::string& value,
+                                                       int flag) {
+  return Written([&] { return voting_->TryCreate(path, value, flag); });
+}
+
+ZooResult<void> ReadRoutingZooKeeper::TryDelete(PathView path, int version) {
+  return Written([&] { return voting_->TryDelete(path, version); });
+}
+
+ZooResult<void> ReadRoutingZooKeeper::TrySet(PathView path,
+                                             const std::string& value,
+                                             int version) {
+  return Written([&] { return voting_->TrySet(path, value, version); });
+}
+
+ZooResult<void> ReadRoutingZooKeeper::TryMulti(const MultiOps& ops,
+                                               std::vector<MultiResult>* results) {
+  return Written([&] { return voting_->TryMulti(ops, results); });
+}
+
+std::string ReadRoutingZooKeeper::Create(PathView path,
+                                         const std::string& value,
+                                         int flag) {
+  return TryCreate(path, value, flag).value();
+}
+
+void ReadRoutingZooKeeper::Delete(PathView path) {
+  TryDelete(path).value();
+}
+
+void ReadRoutingZooKeeper::Set(PathView path, const std::string& value) {
+  TrySet(path, value).value();
+}
+
+void ReadRoutingZooKeeper::Multi(const MultiOps& ops,
+                                 std::vector<MultiResult>* results) {
+  TryMulti(ops, results).value();
+}
+
+}
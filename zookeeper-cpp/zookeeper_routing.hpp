@@ -0,0 +1,134 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "zookeeper.hpp"
+
+namespace zookeeper {
+
+struct ReadRoutingStats {
+  // reads served by the observer session
+  uint64_t observer_reads = 0;
+  // reads served by the voting member session, no observer being reachable
+  uint64_t voting_reads = 0;
+  // syncs of the observer session, letting it catch up with writes of
+  // this client
+  uint64_t syncs = 0;
+};
+
+// Client with two sessions: writes go to the voting members, reads to the
+// designated observers, typically local ones. Adding observers then scales
+// reads without slowing writes down, and the observer session allows
+// read-only mode, so reads survive a loss of quorum.
+//
+// An observer may lag behind the leader. The first read after writes of
+// this client syncs the observer session, sharing the sync with concurrent
+// reads, so the client still reads its own writes; in read-only mode reads
+// are served as they are. Reads fall back to the voting member session
+// while no observer is reachable.
+//
+// An expired observer session is replaced by a new one on the next read,
+// watches set through it are reported lost with OnNotWatching.
+class ReadRoutingZooKeeper {
+public:
+  // |global_watcher| sees the session events of the voting member session
+  // and the watch events of both.
+  ReadRoutingZooKeeper(const std::string& voting_hosts,
+                       const std::string& observer_hosts,
+                       ZooWatcher* global_watcher = nullptr,
+                       int timeout_ms = 5 * 1000);
+
+  ~ReadRoutingZooKeeper();
+
+  // disable copy
+  ReadRoutingZooKeeper(const ReadRoutingZooKeeper&) = delete;
+  ReadRoutingZooKeeper& operator=(const ReadRoutingZooKeeper&) = delete;
+
+  // Session of the voting members, for anything not routed. Writes made
+  // through it directly aren't synced to the observers before reads.
+  ZooKeeper& voting_session() {
+    return *voting_;
+  }
+
+  // replaced once its session expired, don't hold on to it
+  ZooKeeper& observer_session() {
+    return *std::atomic_load(&observer_);
+  }
+
+  ReadRoutingStats stats() const;
+
+  // routed reads
+  ZooResult<NodeStat> TryStat(PathView path, bool watch = false);
+
+  ZooResult<std::string> TryGet(PathView path, bool watch = false);
+
+  ZooResult<std::vector<std::string>> TryGetChildren(PathView parent_path,
+                                                     bool watch = false);
+
+  bool Exists(PathView path, bool watch = false, NodeStat* stat = nullptr);
+
+  std::string Get(PathView path, bool watch = false);
+
+  std::vector<std::string> GetChildren(PathView parent_path, bool watch = false);
+
+  // writes, on the voting member session
+  ZooResult<std::string> TryCreate(PathView path,
+                                   const std::string& value = std::string(),
+                                   int flag = 0);
+
+  ZooResult<void> TryDelete(PathView path, int version = -1);
+
+  ZooResult<void> TrySet(PathView path,
+                         const std::string& value,
+                         int version = -1);
+
+  ZooResult<void> TryMulti(const MultiOps& ops,
+                           std::vector<MultiResult>* results = nullptr);
+
+  std::string Create(PathView path,
+                     const std::string& value = std::string(),
+                     int flag = 0);
+
+  void Delete(PathView path);
+
+  void Set(PathView path, const std::string& value);
+
+  void Multi(const MultiOps& ops, std::vector<MultiResult>* results = nullptr);
+
+private:
+  // forwards the watch events of the observer session
+  class ObserverWatcher;
+
+  // the observer session, a new one if it expired
+  std::shared_ptr<ZooKeeper> Observer();
+
+  // Session to read from, synced with the writes made so far. Fails with
+  // the code of the sync.
+  int Reader(std::shared_ptr<ZooKeeper>* reader);
+
+  template <typename Write>
+  auto Written(const Write& write) -> decltype(write());
+
+  const std::string observer_hosts_;
+  const int timeout_ms_;
+
+  std::unique_ptr<ObserverWatcher> observer_watcher_;
+  std::shared_ptr<ZooKeeper> voting_;
+
+  // replaced under observer_mutex_, read with atomic_load
+  std::mutex observer_mutex_;
+  std::shared_ptr<ZooKeeper> observer_;
+  // syncs of the expired observer sessions
+  std::atomic<uint64_t> expired_syncs_{0};
+
+  // writes completed, and those the observer session was synced after
+  std::atomic<uint64_t> writes_{0};
+  std::atomic<uint64_t> synced_writes_{0};
+
+  std::atomic<uint64_t> observer_reads_{0};
+  std::atomic<uint64_t> voting_reads_{0};
+};
+
+}
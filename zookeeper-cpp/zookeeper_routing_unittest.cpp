@@ -0,0 +1,52 @@
+#include "zookeeper.hpp"
+#include "zookeeper_routing.hpp"
+#include "zookeeper_error.hpp"
+#include <gtest/gtest.h>
+#include <unistd.h>
+#include "zookeeper_unittest_helper.hpp"
+
+using namespace zookeeper;
+using namespace testing;
+
+// The local server stands in for both the voting members and the observers.
+TEST(ReadRoutingZooKeeper, ReadOwnWritesFromObservers) {
+  ReadRoutingZooKeeper zk(ZOOKEEPER_HOSTS, ZOOKEEPER_HOSTS);
+  WaitForConnected(zk.voting_session());
+  WaitForConnected(zk.observer_session());
+
+  zk.Create("/test", "value");
+  EXPECT_EQ(zk.Get("/test"), "value");
+  EXPECT_EQ(zk.stats().syncs, 1u);
+
+  // synced already
+  EXPECT_TRUE(zk.Exists("/test"));
+  EXPECT_EQ(zk.GetChildren("/test").size(), 0u);
+  EXPECT_EQ(zk.stats().syncs, 1u);
+
+  zk.Set("/test", "new value");
+  EXPECT_EQ(zk.Get("/test"), "new value");
+  EXPECT_EQ(zk.stats().syncs, 2u);
+
+  zk.Delete("/test");
+  EXPECT_FALSE(zk.Exists("/test"));
+  EXPECT_EQ(zk.TryGet("/test").code(), ZNONODE);
+
+  auto stats = zk.stats();
+  EXPECT_EQ(stats.observer_reads, 6u);
+  EXPECT_EQ(stats.voting_reads, 0u);
+}
+
+TEST(ReadRoutingZooKeeper, ReadFromVotingMembersWithoutObservers) {
+  // nothing listens there
+  ReadRoutingZooKeeper zk(ZOOKEEPER_HOSTS, "127.0.0.1:1");
+  WaitForConnected(zk.voting_session());
+
+  zk.Create("/test", "value");
+  EXPECT_EQ(zk.Get("/test"), "value");
+  zk.Delete("/test");
+
+  auto stats = zk.stats();
+  EXPECT_EQ(stats.observer_reads, 0u);
+  EXPECT_EQ(stats.voting_reads, 1u);
+  EXPECT_EQ(stats.syncs, 0u);
+}
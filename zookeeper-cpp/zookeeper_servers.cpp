@@ -0,0 +1,322 @@
+#include "zookeeper_servers.hpp"
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <mutex>
+#include "zookeeper_log.hpp"
+
+namespace zookeeper {
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+// "a:1,b:2/chroot" => {"a:1", "b:2"} and "/chroot"
+std::vector<std::string> SplitHosts(const std::string& server_hosts,
+                                    std::string* chroot) {
+  auto slash = server_hosts.find('/');
+  if (chroot) {
+    *chroot = slash == std::string::npos ? std::string() : server_hosts.substr(slash);
+  }
+
+  std::vector<std::string> hosts;
+  auto list = server_hosts.substr(0, slash);
+  size_t begin = 0;
+  while (begin <= list.size()) {
+    auto end = list.find(',', begin);
+    if (end == std::string::npos) end = list.size();
+    if (end > begin) hosts.push_back(list.substr(begin, end - begin));
+    begin = end + 1;
+  }
+  return hosts;
+}
+
+std::string FormatAddress(const sockaddr* addr) {
+  char ip[INET6_ADDRSTRLEN] = "";
+  int port = 0;
+  if (addr->sa_family == AF_INET) {
+    auto in = reinterpret_cast<const sockaddr_in*>(addr);
+    inet_ntop(AF_INET, &in->sin_addr, ip, sizeof(ip));
+    port = ntohs(in->sin_port);
+  } else {
+    auto in6 = reinterpret_cast<const sockaddr_in6*>(addr);
+    inet_ntop(AF_INET6, &in6->sin6_addr, ip, sizeof(ip));
+    port = ntohs(in6->sin6_port);
+  }
+  return std::string(ip) + ':' + std::to_string(port);
+}
+
+// Start a non blocking connect to |host|, -1 if it can't even start.
+// |started| is when the connect was made, after the host's name lookup.
+int StartConnect(const std::string& host, std::string* address,
+                 Clock::time_point* started) {
+  // the port follows the last colon, an IPv6 address may be bracketed
+  auto colon = host.rfind(':');
+  auto name = host.substr(0, colon);
+  auto port = colon == std::string::npos ? std::string("2181") : host.substr(colon + 1);
+  if (name.size() > 2 && name.front() == '[' && name.back() == ']') {
+    name = name.substr(1, name.size() - 2);
+  }
+
+  addrinfo hints = addrinfo();
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_NUMERICSERV;
+  addrinfo* resolved = nullptr;
+  if (getaddrinfo(name.c_str(), port.c_str(), &hints, &resolved) != 0 || !resolved) {
+    return -1;
+  }
+  std::unique_ptr<addrinfo, decltype(&freeaddrinfo)> holder(resolved, freeaddrinfo);
+  *address = FormatAddress(resolved->ai_addr);
+
+  auto fd = socket(resolved->ai_family, SOCK_STREAM, 0);
+  if (fd < 0) return -1;
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+  *started = Clock::now();
+  if (connect(fd, resolved->ai_addr, resolved->ai_addrlen) != 0
+      && errno != EINPROGRESS) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+}
+
+std::vector<ServerProbe> ProbeServers(const std::string& server_hosts,
+                                      std::chrono::milliseconds timeout) {
+  std::vector<ServerProbe> probes;
+  std::vector<pollfd> connecting;
+  // probe index of each connecting fd, and when its connect started
+  std::vector<size_t> owners;
+  std::vector<Clock::time_point> starts;
+
+  for (auto& host : SplitHosts(server_hosts, nullptr)) {
+    ServerProbe probe;
+    probe.host = host;
+    Clock::time_point started;
+    auto fd = StartConnect(host, &probe.address, &started);
+    if (fd >= 0) {
+      connecting.push_back(pollfd{fd, POLLOUT, 0});
+      owners.push_back(probes.size());
+      starts.push_back(started);
+    }
+    probes.push_back(std::move(probe));
+  }
+
+  // every server gets the whole timeout, however long the lookups took
+  auto deadline = Clock::now() + timeout;
+  size_t pending = connecting.size();
+  while (pending > 0) {
+    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+        deadline - Clock::now()).count();
+    if (left <= 0) break;
+    if (poll(connecting.data(), connecting.size(), static_cast<int>(left)) < 0
+        && errno != EINTR) {
+      break;
+    }
+
+    auto now = Clock::now();
+    for (size_t i = 0; i < connecting.size(); ++i) {
+      auto& entry = connecting[i];
+      if (entry.fd < 0 || entry.revents == 0) continue;
+
+      int error = 0;
+      socklen_t error_len = sizeof(error);
+      getsockopt(entry.fd, SOL_SOCKET, SO_ERROR, &error, &error_len);
+      auto& probe = probes[owners[i]];
+      probe.reachable = error == 0;
+      probe.rtt = std::chrono::duration_cast<std::chrono::microseconds>(now - starts[i]);
+
+      close(entry.fd);
+      // poll ignores negative fds
+      entry.fd = -1;
+      --pending;
+    }
+  }
+  for (auto& entry : connecting) {
+    if (entry.fd >= 0) close(entry.fd);
+  }
+
+  std::stable_sort(probes.begin(), probes.end(),
+                   [](const ServerProbe& a, const ServerProbe& b) {
+    if (a.reachable != b.reachable) return a.reachable;
+    // the unreachable ones keep the list's order, their rtt means nothing
+    return a.reachable && a.rtt < b.rtt;
+  });
+  return probes;
+}
+
+std::string SelectServers(const std::string& server_hosts,
+                          const std::vector<ServerProbe>& probes,
+                          std::chrono::microseconds tolerance) {
+  std::string chroot;
+  SplitHosts(server_hosts, &chroot);
+
+  std::chrono::microseconds nearest = std::chrono::microseconds::max();
+  for (auto& probe : probes) {
+    if (probe.reachable) nearest = std::min(nearest, probe.rtt);
+  }
+  if (nearest == std::chrono::microseconds::max()) {
+    // let the client keep trying them all
+    return server_hosts;
+  }
+
+  std::string selected;
+  for (auto& probe : probes) {
+    if (!probe.reachable || probe.rtt > nearest + tolerance) continue;
+    if (!selected.empty()) selected += ',';
+    selected += probe.host;
+  }
+  return selected + chroot;
+}
+
+std::string NearestServers(const std::string& server_hosts,
+                           const ServerSelection& selection) {
+  auto probes = ProbeServers(server_hosts, selection.probe_timeout);
+  return SelectServers(server_hosts, probes, selection.tolerance);
+}
+
+class ServerSelector::State : public WatchListener {
+public:
+  State(ZooKeeper& zk, const std::string& server_hosts,
+        const ServerSelection& selection)
+  : zk_(zk),
+    server_hosts_(server_hosts),
+    selection_(selection),
+    disconnected_at_(zk.is_connected() ? Clock::time_point() : Clock::now()) {
+  }
+
+  void OnWatchEvent(int type, int state, const char*) override {
+    if (type != ZOO_SESSION_EVENT) return;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (state == ZOO_CONNECTED_STATE) {
+      if (disconnected_at_ == Clock::time_point()) return;
+      auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+          Clock::now() - disconnected_at_);
+      disconnected_at_ = Clock::time_point();
+
+      auto& stats = connect_stats_[zk_.connected_server()];
+      ++stats.connects;
+      stats.last = elapsed;
+      stats.total += elapsed;
+    } else if (state == ZOO_CONNECTING_STATE) {
+      if (disconnected_at_ == Clock::time_point()) {
+        disconnected_at_ = Clock::now();
+      }
+      // the server may be gone, look for the nearest one left
+      reprobe_ = true;
+      wakeup_.notify_one();
+    }
+  }
+
+  std::vector<ServerProbe> Rebalance() {
+    auto probes = ProbeServers(server_hosts_, selection_.probe_timeout);
+    auto selected = SelectServers(server_hosts_, probes, selection_.tolerance);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    last_probes_ = probes;
+    if (selected != selected_hosts_) {
+      auto zoo_code = zk_.TrySetServers(selected).code();
+      if (zoo_code == ZOK) {
+        Log(LOG_LEVEL_INFO, "server_selector", "servers {}", selected);
+        selected_hosts_ = selected;
+      } else if (zoo_code != ZUNIMPLEMENTED) {
+        Log(LOG_LEVEL_WARN, "server_selector", "set servers {} failed, {}",
+            selected, zerror(zoo_code));
+      }
+    }
+    return probes;
+  }
+
+  void Run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stopped_) {
+      auto woken = [this] { return stopped_ || reprobe_; };
+      if (selection_.reprobe_interval.count() > 0) {
+        wakeup_.wait_for(lock, selection_.reprobe_interval, woken);
+      } else {
+        wakeup_.wait(lock, woken);
+      }
+      if (stopped_) break;
+      reprobe_ = false;
+
+      lock.unlock();
+      Rebalance();
+      lock.lock();
+    }
+  }
+
+  void Stop() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopped_ = true;
+    wakeup_.notify_one();
+  }
+
+  std::vector<ServerProbe> last_probes() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return last_probes_;
+  }
+
+  std::map<std::string, ServerConnectStats> connect_stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return connect_stats_;
+  }
+
+private:
+  ZooKeeper& zk_;
+  const std::string server_hosts_;
+  const ServerSelection selection_;
+
+  mutable std::mutex mutex_;
+  std::condition_variable wakeup_;
+  bool stopped_ = false;
+  bool reprobe_ = false;
+
+  std::string selected_hosts_;
+  std::vector<ServerProbe> last_probes_;
+
+  // when the connection was lost, zero while connected
+  Clock::time_point disconnected_at_;
+  std::map<std::string, ServerConnectStats> connect_stats_;
+};
+
+ServerSelector::ServerSelector(ZooKeeper& zk,
+                               const std::string& server_hosts,
+                               const ServerSelection& selection)
+: zk_(zk),
+  state_(std::make_shared<State>(zk, server_hosts, selection)) {
+  zk_.AddWatchListener(state_);
+  state_->Rebalance();
+
+  auto state = state_;
+  thread_ = std::thread([state] { state->Run(); });
+}
+
+ServerSelector::~ServerSelector() {
+  zk_.RemoveWatchListener(state_);
+  state_->Stop();
+  thread_.join();
+}
+
+std::vector<ServerProbe> ServerSelector::Rebalance() {
+  return state_->Rebalance();
+}
+
+std::vector<ServerProbe> ServerSelector::last_probes() const {
+  return state_->last_probes();
+}
+
+std::map<std::string, ServerConnectStats> ServerSelector::connect_stats() const {
+  return state_->connect_stats();
+}
+
+}
@@ -0,0 +1,92 @@
+#pragma once
+#include <chrono>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "zookeeper.hpp"
+
+namespace zookeeper {
+
+struct ServerProbe {
+  // as given in the host list
+  std::string host;
+  // "ip:port" probed, empty if the host didn't resolve
+  std::string address;
+  bool reachable = false;
+  // TCP connect time, a network round trip
+  std::chrono::microseconds rtt{0};
+};
+
+// Probe the servers of a host list "host:port,..." by connecting to all of
+// them at once, so a dead server costs |timeout| at most. Sorted by rtt,
+// the unreachable ones last.
+std::vector<ServerProbe> ProbeServers(const std::string& server_hosts,
+                                      std::chrono::milliseconds timeout
+                                          = std::chrono::milliseconds(1000));
+
+struct ServerSelection {
+  // servers slower than the nearest one by more than this are left out
+  std::chrono::microseconds tolerance{2000};
+  std::chrono::milliseconds probe_timeout{1000};
+  // probe again this often, moving back to a nearer server which came
+  // back; zero for never
+  std::chrono::milliseconds reprobe_interval{60 * 1000};
+};
+
+// Host list of the reachable servers within |tolerance| of the nearest, or
+// |server_hosts| itself if none is reachable. A chroot suffix is kept.
+std::string SelectServers(const std::string& server_hosts,
+                          const std::vector<ServerProbe>& probes,
+                          std::chrono::microseconds tolerance);
+
+// Probe and select, for a session to start on the nearest servers:
+//   ZooKeeper zk(NearestServers(hosts));
+std::string NearestServers(const std::string& server_hosts,
+                           const ServerSelection& selection = ServerSelection());
+
+struct ServerConnectStats {
+  uint64_t connects = 0;
+  // from losing the connection, or starting, until connected to the server
+  std::chrono::microseconds last{0};
+  std::chrono::microseconds total{0};
+};
+
+// Keeps a session on the nearest reachable servers of |server_hosts|. The
+// client library picks servers at random and takes its connect timeout to
+// skip a dead one; the selector probes the servers itself and points the
+// session at the selection with ZooKeeper::TrySetServers, again whenever
+// the session loses its connection and every reprobe_interval. Without
+// zoo_set_servers (3.4) the servers are probed and the connects recorded
+// only, start the session with NearestServers then.
+//
+// Must be destroyed before |zk|.
+class ServerSelector {
+public:
+  ServerSelector(ZooKeeper& zk,
+                 const std::string& server_hosts,
+                 const ServerSelection& selection = ServerSelection());
+
+  ~ServerSelector();
+
+  // disable copy
+  ServerSelector(const ServerSelector&) = delete;
+  ServerSelector& operator=(const ServerSelector&) = delete;
+
+  // Probe now and point the session at the selection, returns the probes.
+  std::vector<ServerProbe> Rebalance();
+
+  std::vector<ServerProbe> last_probes() const;
+
+  // by "ip:port" of the server connected to
+  std::map<std::string, ServerConnectStats> connect_stats() const;
+
+private:
+  class State;
+  ZooKeeper& zk_;
+  std::shared_ptr<State> state_;
+  std::thread thread_;
+};
+
+}
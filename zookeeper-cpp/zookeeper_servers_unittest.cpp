@@ -0,0 +1,101 @@
+#include "zookeeper.hpp"
+#include "zookeeper_servers.hpp"
+#include <gtest/gtest.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "zookeeper_unittest_helper.hpp"
+
+using namespace zookeeper;
+using namespace testing;
+
+namespace {
+
+// a server accepting connections on a loopback port, nothing more
+class Listener {
+public:
+  Listener() {
+    fd_ = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr = sockaddr_in();
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addr_len = sizeof(addr);
+    bind(fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+    listen(fd_, 16);
+    getsockname(fd_, reinterpret_cast<sockaddr*>(&addr), &addr_len);
+    port_ = ntohs(addr.sin_port);
+  }
+
+  ~Listener() {
+    close(fd_);
+  }
+
+  std::string host() const {
+    return "127.0.0.1:" + std::to_string(port_);
+  }
+
+private:
+  int fd_;
+  int port_;
+};
+
+ServerProbe Probe(const std::string& host, bool reachable, int rtt_us) {
+  ServerProbe probe;
+  probe.host = host;
+  probe.reachable = reachable;
+  probe.rtt = std::chrono::microseconds(rtt_us);
+  return probe;
+}
+
+}
+
+TEST(ServerSelection, ProbeServers) {
+  Listener listener;
+  // nothing listens on port 1
+  auto probes = ProbeServers("127.0.0.1:1," + listener.host() + "/chroot",
+                             std::chrono::milliseconds(500));
+  ASSERT_EQ(probes.size(), 2u);
+  EXPECT_EQ(probes[0].host, listener.host());
+  EXPECT_EQ(probes[0].address, listener.host());
+  EXPECT_TRUE(probes[0].reachable);
+  EXPECT_LT(probes[0].rtt, std::chrono::microseconds(500 * 1000));
+  EXPECT_EQ(probes[1].host, "127.0.0.1:1");
+  EXPECT_FALSE(probes[1].reachable);
+}
+
+TEST(ServerSelection, SelectNearestServers) {
+  const std::string hosts = "far:2181,near:2181,close:2181,dead:2181/app";
+  std::vector<ServerProbe> probes = {
+    Probe("near", true, 300),
+    Probe("close", true, 1500),
+    Probe("far", true, 40000),
+    Probe("dead", false, 0),
+  };
+  EXPECT_EQ(SelectServers(hosts, probes, std::chrono::microseconds(2000)),
+            "near,close/app");
+  EXPECT_EQ(SelectServers(hosts, probes, std::chrono::microseconds(0)),
+            "near/app");
+
+  // none reachable, all kept for the client to retry
+  std::vector<ServerProbe> dead = {Probe("far", false, 0), Probe("near", false, 0)};
+  EXPECT_EQ(SelectServers(hosts, dead, std::chrono::microseconds(2000)), hosts);
+}
+
+TEST(ServerSelection, SelectorProbesServers) {
+  ZooKeeper zk(ZOOKEEPER_HOSTS);
+  WaitForConnected(zk);
+
+  ServerSelection selection;
+  selection.probe_timeout = std::chrono::milliseconds(200);
+  // the session stays on the local server, the dead one is left out
+  ServerSelector selector(zk, ZOOKEEPER_HOSTS + ",127.0.0.1:1", selection);
+  auto probes = selector.last_probes();
+  ASSERT_EQ(probes.size(), 2u);
+  EXPECT_EQ(probes[1].host, "127.0.0.1:1");
+  EXPECT_FALSE(probes[1].reachable);
+
+  EXPECT_EQ(selector.Rebalance().size(), 2u);
+  EXPECT_TRUE(zk.is_connected());
+  EXPECT_EQ(zk.connected_server(), "127.0.0.1:2181");
+}
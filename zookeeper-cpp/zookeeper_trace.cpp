@@ -0,0 +1,255 @@
+#include "zookeeper_trace.hpp"
+#include <unistd.h>
+#include <cerrno>
+#include "zookeeper_error.hpp"
+
+namespace zookeeper {
+
+namespace detail {
+
+std::atomic<bool> TRACING{false};
+
+}
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+std::shared_ptr<Tracer> TRACER;
+
+std::atomic<uint64_t> NEXT_SPAN_ID{1};
+
+thread_local uint64_t CURRENT_SPAN = 0;
+
+// spans buffered for the writer of a TraceFileExporter, a power of two
+const size_t TRACE_BUFFER_CAPACITY = 4096;
+// longest a written event stays in the writer's own buffer
+const std::chrono::milliseconds TRACE_FLUSH_INTERVAL(100);
+
+// the installed tracer, null if none
+std::shared_ptr<Tracer> LoadTracer() {
+  return std::atomic_load(&TRACER);
+}
+
+void StartSpan(Span* span, const char* name, PathView path) {
+  span->id = NEXT_SPAN_ID++;
+  span->parent = CURRENT_SPAN;
+  span->name = name;
+  span->path = path.to_string();
+  span->thread = std::this_thread::get_id();
+  span->start = Clock::now();
+}
+
+double Microseconds(std::chrono::nanoseconds duration) {
+  return std::chrono::duration<double, std::micro>(duration).count();
+}
+
+void AppendJsonString(std::string* out, const std::string& value) {
+  *out += '"';
+  for (unsigned char c : value) {
+    if (c == '"' || c == '\\') {
+      *out += '\\';
+      *out += c;
+    } else if (c < 0x20) {
+      char escaped[8];
+      snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+      *out += escaped;
+    } else {
+      *out += c;
+    }
+  }
+  *out += '"';
+}
+
+}
+
+void SetTracer(std::shared_ptr<Tracer> tracer) {
+  bool tracing = tracer != nullptr;
+  std::atomic_store(&TRACER, std::move(tracer));
+  detail::TRACING.store(tracing);
+}
+
+uint64_t ScopedSpan::current() {
+  return CURRENT_SPAN;
+}
+
+void ScopedSpan::Begin(const char* name, PathView path) {
+  tracer_ = LoadTracer();
+  // removed meanwhile
+  if (!tracer_) return;
+
+  span_.reset(new Span);
+  StartSpan(span_.get(), name, path);
+  previous_ = CURRENT_SPAN;
+  CURRENT_SPAN = span_->id;
+  tracer_->BeginSpan(*span_);
+}
+
+void ScopedSpan::End() {
+  span_->end = Clock::now();
+  CURRENT_SPAN = previous_;
+  tracer_->EndSpan(*span_);
+}
+
+std::shared_ptr<AsyncSpan> AsyncSpan::Begin(const char* name, PathView path) {
+  if (!IsTracing()) return nullptr;
+  auto tracer = LoadTracer();
+  if (!tracer) return nullptr;
+
+  auto span = std::make_shared<AsyncSpan>();
+  span->tracer_ = std::move(tracer);
+  StartSpan(&span->span_, name, path);
+  span->tracer_->BeginSpan(span->span_);
+  return span;
+}
+
+void AsyncSpan::Sent() {
+  sent_ = Clock::now();
+  span_.queued = sent_ - span_.start;
+}
+
+void AsyncSpan::Failed(int code) {
+  if (sent_ == Clock::time_point()) Sent();
+  span_.code = code;
+  End();
+}
+
+void AsyncSpan::CallbackStarted(int code, int64_t zxid) {
+  callback_started_ = Clock::now();
+  span_.wire = callback_started_ - sent_;
+  span_.code = code;
+  span_.zxid = zxid;
+
+  previous_ = CURRENT_SPAN;
+  CURRENT_SPAN = span_.id;
+}
+
+void AsyncSpan::CallbackDone() {
+  CURRENT_SPAN = previous_;
+  End();
+}
+
+void AsyncSpan::End() {
+  span_.end = Clock::now();
+  if (callback_started_ != Clock::time_point()) {
+    span_.callback = span_.end - callback_started_;
+  }
+  tracer_->EndSpan(span_);
+}
+
+TraceFileExporter::TraceFileExporter(const std::string& path)
+: buffer_(TRACE_BUFFER_CAPACITY),
+  epoch_(Clock::now()),
+  file_(fopen(path.c_str(), "w")) {
+  if (!file_) throw ZooSystemErrorFromErrno(errno);
+  // written a batch of whole events at a time, from pending_
+  setvbuf(file_, nullptr, _IONBF, 0);
+  pending_ = "[\n";
+  writer_ = std::thread([this] { Run(); });
+}
+
+TraceFileExporter::~TraceFileExporter() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+    wakeup_.notify_one();
+  }
+  writer_.join();
+  fputs("\n]\n", file_);
+  fclose(file_);
+}
+
+void TraceFileExporter::BeginSpan(const Span&) {
+  // a complete event is written once the span ends
+}
+
+void TraceFileExporter::EndSpan(const Span& span) {
+  auto slot = buffer_.Claim();
+  if (!slot) {
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  slot->value = span;
+  // ordered before reading sleeping_, against the writer going to sleep
+  buffer_.Publish(slot);
+  if (sleeping_.load()) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    wakeup_.notify_one();
+  }
+}
+
+void TraceFileExporter::Flush() {
+  auto target = buffer_.claimed();
+  std::unique_lock<std::mutex> lock(mutex_);
+  wakeup_.notify_one();
+  flushed_.wait(lock, [this, target] { return flushed_pos_ >= target; });
+}
+
+void TraceFileExporter::Run() {
+  auto flushed_at = Clock::now();
+  while (true) {
+    int formatted = 0;
+    while (formatted < 256 && FormatNext()) ++formatted;
+    bool busy = formatted == 256;
+    if (busy && Clock::now() - flushed_at < TRACE_FLUSH_INTERVAL) continue;
+
+    auto pos = buffer_.popped();
+    if (!pending_.empty()) {
+      fwrite(pending_.data(), 1, pending_.size(), file_);
+      pending_.clear();
+    }
+    flushed_at = Clock::now();
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    flushed_pos_ = pos;
+    flushed_.notify_all();
+    if (busy) continue;
+    if (stopping_ && !buffer_.Front()) return;
+
+    sleeping_ = true;
+    if (!stopping_ && !buffer_.Front()) {
+      // timed, so an unpublished slot doesn't hold a flush for long
+      wakeup_.wait_for(lock, TRACE_FLUSH_INTERVAL);
+    }
+    sleeping_ = false;
+  }
+}
+
+bool TraceFileExporter::FormatNext() {
+  auto span = buffer_.Front();
+  if (!span) return false;
+
+  if (!first_) pending_ += ",\n";
+  first_ = false;
+  pending_ += "{\"name\":";
+  AppendJsonString(&pending_, span->name ? span->name : "");
+
+  auto thread = thread_ids_.emplace(span->thread, thread_ids_.size() + 1).first->second;
+  char fields[512];
+  snprintf(fields, sizeof(fields),
+           ",\"cat\":\"zookeeper\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d"
+           ",\"tid\":%d,\"args\":{\"path\":",
+           Microseconds(span->start - epoch_),
+           Microseconds(span->end - span->start),
+           static_cast<int>(getpid()),
+           thread);
+  pending_ += fields;
+  AppendJsonString(&pending_, span->path);
+
+  snprintf(fields, sizeof(fields),
+           ",\"id\":%llu,\"parent\":%llu,\"code\":%d,\"zxid\":%lld"
+           ",\"queued_us\":%.3f,\"wire_us\":%.3f,\"callback_us\":%.3f}}",
+           static_cast<unsigned long long>(span->id),
+           static_cast<unsigned long long>(span->parent),
+           span->code,
+           static_cast<long long>(span->zxid),
+           Microseconds(span->queued),
+           Microseconds(span->wire),
+           Microseconds(span->callback));
+  pending_ += fields;
+
+  buffer_.Pop();
+  return true;
+}
+
+}
@@ -0,0 +1,198 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "zookeeper_path.hpp"
+#include "zookeeper_ring_buffer.hpp"
+
+namespace zookeeper {
+
+struct Span {
+  uint64_t id = 0;
+  // span the operation was started in, zero if none
+  uint64_t parent = 0;
+  // "Get", "AsyncCreate", ..., or the name given by a recipe; of static
+  // storage
+  const char* name = nullptr;
+  std::string path;
+  // thread which started the span
+  std::thread::id thread;
+  std::chrono::steady_clock::time_point start;
+  std::chrono::steady_clock::time_point end;
+
+  // zookeeper code of the operation, ZOK for a recipe's span
+  int code = 0;
+  // mzxid of the node when the reply carries its stat, zero otherwise
+  int64_t zxid = 0;
+
+  // Until the request was sent: admission under the outstanding request
+  // cap, or waiting for another call's read or sync.
+  std::chrono::nanoseconds queued{0};
+  // from sending the request to its reply, queues of the client library
+  // included
+  std::chrono::nanoseconds wire{0};
+  // in the completion callback of an asynchronous operation
+  std::chrono::nanoseconds callback{0};
+};
+
+class Tracer {
+public:
+  virtual ~Tracer() = default;
+
+  // Called on the thread starting the span and on the one ending it, the
+  // completion thread for asynchronous operations. Must not block.
+  virtual void BeginSpan(const Span& span) = 0;
+  virtual void EndSpan(const Span& span) = 0;
+};
+
+// Install the tracer of all operations and spans, null to stop tracing.
+// Without a tracer, a traced operation costs a flag check.
+void SetTracer(std::shared_ptr<Tracer> tracer);
+
+namespace detail {
+extern std::atomic<bool> TRACING;
+}
+
+inline bool IsTracing() {
+  return detail::TRACING.load(std::memory_order_relaxed);
+}
+
+// A span for the enclosing scope. Operations and spans started within it
+// on the same thread, asynchronous ones included, nest under it.
+class ScopedSpan {
+public:
+  ScopedSpan(const char* name, PathView path) {
+    if (IsTracing()) Begin(name, path);
+  }
+
+  ~ScopedSpan() {
+    if (span_) End();
+  }
+
+  // disable copy
+  ScopedSpan(const ScopedSpan&) = delete;
+  ScopedSpan& operator=(const ScopedSpan&) = delete;
+
+  bool active() const {
+    return span_ != nullptr;
+  }
+
+  // null while not tracing
+  Span* span() {
+    return span_.get();
+  }
+
+  // now if tracing, for timing phases at no cost otherwise
+  std::chrono::steady_clock::time_point Mark() const {
+    return span_ ? std::chrono::steady_clock::now()
+                 : std::chrono::steady_clock::time_point();
+  }
+
+  void set_result(int code, int64_t zxid = 0) {
+    if (!span_) return;
+    span_->code = code;
+    span_->zxid = zxid;
+  }
+
+  // id of the innermost span of the calling thread, zero if none
+  static uint64_t current();
+
+private:
+  void Begin(const char* name, PathView path);
+  void End();
+
+  std::shared_ptr<Tracer> tracer_;
+  std::unique_ptr<Span> span_;
+  uint64_t previous_ = 0;
+};
+
+// A span of an asynchronous operation, begun when issued and ended by its
+// completion, maybe on another thread.
+class AsyncSpan {
+public:
+  // null while not tracing
+  static std::shared_ptr<AsyncSpan> Begin(const char* name, PathView path);
+
+  // the request is about to be sent
+  void Sent();
+
+  // the request couldn't be sent
+  void Failed(int code);
+
+  // Called by the completion around the callback, which the spans it
+  // starts nest under.
+  void CallbackStarted(int code, int64_t zxid);
+  void CallbackDone();
+
+private:
+  void End();
+
+  std::shared_ptr<Tracer> tracer_;
+  Span span_;
+  std::chrono::steady_clock::time_point sent_;
+  std::chrono::steady_clock::time_point callback_started_;
+  uint64_t previous_ = 0;
+};
+
+// Writes the spans to a file in the Chrome trace event format, one
+// complete event per span, to be opened with chrome://tracing or Perfetto.
+// Ended spans are copied into a lock free ring buffer and written by the
+// exporter's thread, which flushes whole events at least every 100ms: the
+// file opens while still written, only missing the closing bracket the
+// viewers do without. Spans ended while the buffer is full are dropped
+// and counted.
+class TraceFileExporter : public Tracer {
+public:
+  // throws a system error ZooException if the file can't be created
+  explicit TraceFileExporter(const std::string& path);
+
+  ~TraceFileExporter();
+
+  // disable copy
+  TraceFileExporter(const TraceFileExporter&) = delete;
+  TraceFileExporter& operator=(const TraceFileExporter&) = delete;
+
+  void BeginSpan(const Span& span) override;
+  void EndSpan(const Span& span) override;
+
+  // Wait until every span ended before is written and flushed.
+  void Flush();
+
+  // spans dropped while the buffer was full
+  uint64_t dropped() const {
+    return dropped_.load();
+  }
+
+private:
+  void Run();
+  bool FormatNext();
+
+  detail::RingBuffer<Span> buffer_;
+  std::atomic<uint64_t> dropped_{0};
+  const std::chrono::steady_clock::time_point epoch_;
+  FILE* file_;
+
+  // of the writer thread only: events formatted since the last flush,
+  // and small numbers for the viewer's rows
+  std::string pending_;
+  bool first_ = true;
+  std::map<std::thread::id, int> thread_ids_;
+
+  std::mutex mutex_;
+  std::condition_variable wakeup_;
+  std::condition_variable flushed_;
+  std::atomic<bool> sleeping_{false};
+  // ring buffer position written and flushed
+  size_t flushed_pos_ = 0;
+  bool stopping_ = false;
+  std::thread writer_;
+};
+
+}
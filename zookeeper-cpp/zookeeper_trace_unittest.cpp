@@ -0,0 +1,217 @@
+#include "zookeeper.hpp"
+#include "zookeeper_trace.hpp"
+#include <gtest/gtest.h>
+#include <unistd.h>
+#include <condition_variable>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <vector>
+#include "zookeeper_unittest_helper.hpp"
+
+using namespace zookeeper;
+using namespace testing;
+
+namespace {
+
+class RecordingTracer : public Tracer {
+public:
+  void BeginSpan(const Span& span) override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++begun_;
+  }
+
+  void EndSpan(const Span& span) override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ended_.push_back(span);
+    ended_cv_.notify_all();
+  }
+
+  std::vector<Span> WaitForSpans(size_t count) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    ended_cv_.wait(lock, [&] { return ended_.size() >= count; });
+    return ended_;
+  }
+
+  int begun() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return begun_;
+  }
+
+private:
+  std::mutex mutex_;
+  std::condition_variable ended_cv_;
+  int begun_ = 0;
+  std::vector<Span> ended_;
+};
+
+const Span* FindSpan(const std::vector<Span>& spans, const char* name) {
+  for (auto& span : spans) {
+    if (strcmp(span.name, name) == 0) return &span;
+  }
+  return nullptr;
+}
+
+struct TracingTest : ZooKeeperTest {
+  std::shared_ptr<RecordingTracer> tracer = std::make_shared<RecordingTracer>();
+
+  TracingTest() {
+    zk.DeleteIfExists("/test");
+    SetTracer(tracer);
+  }
+
+  ~TracingTest() {
+    SetTracer(nullptr);
+    zk.DeleteIfExists("/test");
+  }
+};
+
+}
+
+TEST(ScopedSpan, InactiveWithoutTracer) {
+  ScopedSpan span("outer", "/test");
+  EXPECT_FALSE(span.active());
+  EXPECT_EQ(ScopedSpan::current(), 0u);
+}
+
+TEST(ScopedSpan, Nests) {
+  auto tracer = std::make_shared<RecordingTracer>();
+  SetTracer(tracer);
+  {
+    ScopedSpan outer("outer", "/a");
+    ASSERT_TRUE(outer.active());
+    EXPECT_EQ(ScopedSpan::current(), outer.span()->id);
+    {
+      ScopedSpan inner("inner", "/a/b");
+      EXPECT_EQ(inner.span()->parent, outer.span()->id);
+    }
+    EXPECT_EQ(ScopedSpan::current(), outer.span()->id);
+  }
+  SetTracer(nullptr);
+  EXPECT_EQ(ScopedSpan::current(), 0u);
+
+  auto spans = tracer->WaitForSpans(2);
+  ASSERT_EQ(spans.size(), 2u);
+  EXPECT_STREQ(spans[0].name, "inner");
+  EXPECT_STREQ(spans[1].name, "outer");
+  EXPECT_EQ(spans[1].parent, 0u);
+  EXPECT_GE(spans[1].end, spans[0].end);
+}
+
+TEST_F(TracingTest, OperationsNestUnderRecipeSpan) {
+  uint64_t outer_id;
+  {
+    ScopedSpan outer("recipe", "/test");
+    outer_id = outer.span()->id;
+    zk.Create("/test", "value");
+    EXPECT_EQ(zk.Get("/test"), "value");
+    EXPECT_EQ(zk.TryGet("/test/missing").code(), ZNONODE);
+  }
+
+  auto spans = tracer->WaitForSpans(4);
+  ASSERT_EQ(spans.size(), 4u);
+  EXPECT_EQ(tracer->begun(), 4);
+
+  auto& create = spans[0];
+  EXPECT_STREQ(create.name, "Create");
+  EXPECT_EQ(create.path, "/test");
+  EXPECT_EQ(create.parent, outer_id);
+  EXPECT_EQ(create.code, ZOK);
+
+  auto& get = spans[1];
+  EXPECT_STREQ(get.name, "Get");
+  EXPECT_EQ(get.parent, outer_id);
+  EXPECT_EQ(get.code, ZOK);
+  EXPECT_EQ(get.zxid, zk.Stat("/test").mzxid);
+  EXPECT_GT(get.wire.count(), 0);
+
+  auto& missing = spans[2];
+  EXPECT_EQ(missing.code, ZNONODE);
+  EXPECT_EQ(missing.zxid, 0);
+
+  EXPECT_STREQ(spans[3].name, "recipe");
+  EXPECT_EQ(spans[3].id, outer_id);
+}
+
+TEST_F(TracingTest, AsyncOperationSpansItsCallback) {
+  zk.Create("/test", "value");
+
+  uint64_t outer_id;
+  uint64_t callback_parent = 0;
+  {
+    ScopedSpan outer("recipe", "/test");
+    outer_id = outer.span()->id;
+    zk.AsyncGet("/test", [&](int, const char*, int, const NodeStat&) {
+      // spans of the callback nest under the operation
+      callback_parent = ScopedSpan::current();
+      usleep(1000);
+    });
+  }
+
+  // Create, recipe and AsyncGet
+  auto spans = tracer->WaitForSpans(3);
+  ASSERT_TRUE(FindSpan(spans, "AsyncGet"));
+  auto& get = *FindSpan(spans, "AsyncGet");
+  EXPECT_EQ(get.parent, outer_id);
+  EXPECT_EQ(get.code, ZOK);
+  EXPECT_EQ(callback_parent, get.id);
+  EXPECT_NE(get.zxid, 0);
+  EXPECT_GE(get.callback, std::chrono::milliseconds(1));
+  EXPECT_GE(get.end - get.start, get.queued + get.wire + get.callback);
+}
+
+TEST(TraceFileExporter, WritesTraceEvents) {
+  char path[] = "/tmp/zookeeper_trace_XXXXXX";
+  close(mkstemp(path));
+  {
+    auto exporter = std::make_shared<TraceFileExporter>(path);
+    SetTracer(exporter);
+    {
+      ScopedSpan outer("outer", "/a\"b");
+      ScopedSpan inner("inner", "/a");
+    }
+    SetTracer(nullptr);
+  }
+
+  std::ifstream file(path);
+  std::stringstream content;
+  content << file.rdbuf();
+  unlink(path);
+
+  auto trace = content.str();
+  EXPECT_EQ(trace.front(), '[');
+  EXPECT_EQ(trace.substr(trace.size() - 2), "]\n");
+  EXPECT_NE(trace.find("\"name\":\"inner\""), std::string::npos);
+  EXPECT_NE(trace.find("\"ph\":\"X\""), std::string::npos);
+  EXPECT_NE(trace.find("\"path\":\"/a\\\"b\""), std::string::npos);
+  EXPECT_NE(trace.find("},\n{"), std::string::npos);
+}
+
+TEST(TraceFileExporter, ReadableWhileWriting) {
+  char path[] = "/tmp/zookeeper_trace_XXXXXX";
+  close(mkstemp(path));
+  auto exporter = std::make_shared<TraceFileExporter>(path);
+  SetTracer(exporter);
+  for (int i = 0; i < 100; ++i) {
+    ScopedSpan span("span", "/a");
+  }
+  SetTracer(nullptr);
+  exporter->Flush();
+
+  std::ifstream file(path);
+  std::stringstream content;
+  content << file.rdbuf();
+  unlink(path);
+
+  // whole events so far, the array left open
+  auto trace = content.str();
+  EXPECT_EQ(trace.substr(0, 2), "[\n");
+  EXPECT_EQ(trace.back(), '}');
+  size_t events = 0;
+  for (auto pos = trace.find("\"ph\":\"X\""); pos != std::string::npos;
+       pos = trace.find("\"ph\":\"X\"", pos + 1)) {
+    ++events;
+  }
+  EXPECT_EQ(events + exporter->dropped(), 100u);
+}
@@ -1,7 +1,10 @@
 #include "zookeeper.hpp"
 #include "zookeeper_error.hpp"
+#include "zookeeper_ext.hpp"
 #include <gtest/gtest.h>
 #include <stdlib.h>
+#include <future>
+#include <thread>
 #include "zookeeper_mock.hpp"
 #include "zookeeper_unittest_helper.hpp"
 
@@ -102,6 +105,21 @@ TEST_F(ZooKeeperTest, SetThenGet) {
   zk.Delete("/test");
 }
 
+TEST_F(ZooKeeperTest, GetLargeValue) {
+  std::string value(100 * 1024, 'x');
+  zk.Create("/test", value);
+  EXPECT_EQ(zk.Get("/test"), value);
+
+  // read synchronously on the completion thread, past the first buffer
+  std::promise<std::string> got;
+  zk.AsyncExists("/test", [this, &got](int, const NodeStat&) {
+    got.set_value(zk.Get("/test"));
+  });
+  EXPECT_EQ(got.get_future().get(), value);
+
+  zk.Delete("/test");
+}
+
 TEST_F(ZooKeeperTest, GetNodeThatNotExists) {
   EXPECT_THROW(zk.Get("/node_that_not_exists"), ZooException);
 }
@@ -120,6 +138,316 @@ TEST_F(ZooKeeperTest, GetChildren) {
   zk.Delete("/parent");
 }
 
+TEST_F(ZooKeeperTest, Multi) {
+  MultiOps ops;
+  ops.Create("/test");
+  ops.Create("/test/a", "abc");
+  ops.Create("/test/seq_", "", ZOO_SEQUENCE);
+
+  std::vector<MultiResult> results;
+  zk.Multi(ops, &results);
+  ASSERT_EQ(results.size(), 3u);
+  EXPECT_EQ(results[1].path, "/test/a");
+  EXPECT_NE(results[2].path, "/test/seq_");
+  EXPECT_EQ(zk.Get("/test/a"), "abc");
+
+  ops.clear();
+  ops.Delete(results[2].path);
+  ops.Delete("/test/a");
+  ops.Delete("/test");
+  zk.Multi(ops);
+  EXPECT_FALSE(zk.Exists("/test"));
+}
+
+TEST_F(ZooKeeperTest, MultiIsAtomic) {
+  MultiOps ops;
+  ops.Create("/test");
+  ops.Delete("/node_that_not_exists");
+
+  std::vector<MultiResult> results;
+  try {
+    zk.Multi(ops, &results);
+    FAIL();
+  } catch (ZooException& e) {
+    EXPECT_EQ(e.code(), ZNONODE);
+  }
+  ASSERT_EQ(results.size(), 2u);
+  EXPECT_EQ(results[1].code, ZNONODE);
+  EXPECT_FALSE(zk.Exists("/test"));
+}
+
+TEST_F(ZooKeeperTest, AsyncGetThenDelete) {
+  zk.Create("/test", "abc");
+
+  std::promise<std::string> value;
+  std::promise<int> deleted;
+  zk.AsyncGet("/test", [&](int code, const char* data, int len, const NodeStat&) {
+    value.set_value(code == ZOK ? std::string(data, len) : std::string());
+  });
+  zk.AsyncDelete("/test", [&](int code) { deleted.set_value(code); });
+
+  EXPECT_EQ(value.get_future().get(), "abc");
+  EXPECT_EQ(deleted.get_future().get(), ZOK);
+  EXPECT_FALSE(zk.Exists("/test"));
+}
+
+TEST_F(ZooKeeperTest, OutstandingRequestLimit) {
+  zk.set_max_outstanding_requests(4);
+
+  std::vector<std::string> paths(200, "/");
+  for (auto& result : PipelinedGet(zk, paths)) {
+    EXPECT_EQ(result.code, ZOK);
+  }
+
+  auto stats = zk.request_limit_stats();
+  EXPECT_EQ(stats.limit, 4u);
+  EXPECT_EQ(stats.admitted, 200u);
+  EXPECT_EQ(stats.outstanding, 0u);
+  EXPECT_LE(stats.peak_outstanding, 4u);
+  EXPECT_EQ(stats.rejected, 0u);
+}
+
+TEST_F(ZooKeeperTest, RejectRequestsAtLimit) {
+  zk.set_max_outstanding_requests(1, ADMISSION_REJECT);
+
+  // the second reply is held up behind the first callback
+  std::promise<void> first, release;
+  auto released = release.get_future().share();
+  std::promise<int> second;
+  zk.AsyncExists("/", [&first, released](int, const NodeStat&) {
+    first.set_value();
+    released.wait();
+  });
+  first.get_future().wait();
+  zk.AsyncExists("/", [&second](int code, const NodeStat&) { second.set_value(code); });
+
+  try {
+    zk.AsyncExists("/", [](int, const NodeStat&) {});
+    FAIL() << "request admitted over the limit";
+  } catch (const ZooException& e) {
+    EXPECT_EQ(e.code(), ZOPERATIONTIMEOUT);
+  }
+
+  // the Try variant returns the code, its callback is never called
+  bool called = false;
+  auto rejected = zk.TryAsyncExists("/", [&called](int, const NodeStat&) { called = true; });
+  EXPECT_EQ(rejected.code(), ZOPERATIONTIMEOUT);
+
+  // blocking operations aren't held back
+  EXPECT_TRUE(zk.Exists("/"));
+
+  release.set_value();
+  EXPECT_EQ(second.get_future().get(), ZOK);
+  EXPECT_EQ(zk.request_limit_stats().rejected, 2u);
+  EXPECT_FALSE(called);
+}
+
+// Replies of bounded calls are delivered on the completion thread, which
+// is held by the callback until release() so reads stay in flight.
+struct CompletionBlocker {
+  std::promise<void> started, released;
+
+  explicit CompletionBlocker(ZooKeeper& zk) {
+    auto release = released.get_future().share();
+    zk.AsyncExists("/", [this, release](int, const NodeStat&) {
+      started.set_value();
+      release.wait();
+    });
+    started.get_future().wait();
+  }
+
+  void release() {
+    released.set_value();
+  }
+};
+
+static void WaitForCoalescedReads(ZooKeeper& zk, uint64_t count) {
+  while (zk.coalesced_reads() < count) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+}
+
+TEST_F(ZooKeeperTest, CoalesceConcurrentReads) {
+  zk.Create("/test", "value");
+  zk.set_operation_timeout(std::chrono::milliseconds(5000));
+
+  CompletionBlocker blocker(zk);
+  std::vector<std::future<std::string>> values;
+  for (int i = 0; i < 8; ++i) {
+    values.push_back(std::async(std::launch::async, [this] {
+      return zk.Get("/test");
+    }));
+  }
+  WaitForCoalescedReads(zk, 7);
+  blocker.release();
+
+  for (auto& value : values) {
+    EXPECT_EQ(value.get(), "value");
+  }
+  EXPECT_EQ(zk.coalesced_reads(), 7u);
+
+  zk.Delete("/test");
+}
+
+TEST_F(ZooKeeperTest, ReadsAfterWriteAreNotCoalesced) {
+  zk.Create("/test", "value");
+  zk.set_operation_timeout(std::chrono::milliseconds(5000));
+
+  CompletionBlocker blocker(zk);
+  auto before = std::async(std::launch::async, [this] {
+    return zk.Get("/test");
+  });
+  auto joined = std::async(std::launch::async, [this] {
+    return zk.Get("/test");
+  });
+  WaitForCoalescedReads(zk, 1);
+
+  // the read sent before the delete can't answer reads made after it
+  zk.AsyncDelete("/test", [](int) {});
+  auto after = std::async(std::launch::async, [this] {
+    return zk.Get("/test");
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  blocker.release();
+
+  EXPECT_EQ(before.get(), "value");
+  EXPECT_EQ(joined.get(), "value");
+  EXPECT_THROW(after.get(), ZooException);
+  EXPECT_EQ(zk.coalesced_reads(), 1u);
+}
+
+TEST_F(ZooKeeperTest, JoinedReadOutlivesSenderDeadline) {
+  zk.Create("/test", "value");
+  zk.set_operation_timeout(std::chrono::milliseconds(5000));
+
+  CompletionBlocker blocker(zk);
+  auto sender = std::async(std::launch::async, [this] {
+    ScopedDeadline deadline(std::chrono::milliseconds(50));
+    return zk.TryGet("/test").code();
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  auto joined = std::async(std::launch::async, [this] {
+    return zk.Get("/test");
+  });
+  WaitForCoalescedReads(zk, 1);
+
+  // the sender times out, the joined read sends its own request
+  EXPECT_EQ(sender.get(), ZOPERATIONTIMEOUT);
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  blocker.release();
+
+  EXPECT_EQ(joined.get(), "value");
+
+  zk.Delete("/test");
+}
+
+TEST_F(ZooKeeperTest, SyncReadsShareSyncs) {
+  zk.Create("/test", "value");
+  zk.set_operation_timeout(std::chrono::milliseconds(5000));
+  zk.set_sync_reads(true);
+
+  CompletionBlocker blocker(zk);
+  auto first = std::async(std::launch::async, [this] {
+    return zk.Get("/test");
+  });
+  while (zk.syncs() < 1) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  // all join the sync sent once the first one completes
+  std::vector<std::future<std::string>> values;
+  for (int i = 0; i < 8; ++i) {
+    values.push_back(std::async(std::launch::async, [this] {
+      return zk.Get("/test");
+    }));
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  blocker.release();
+
+  EXPECT_EQ(first.get(), "value");
+  for (auto& value : values) {
+    EXPECT_EQ(value.get(), "value");
+  }
+  EXPECT_EQ(zk.syncs(), 2u);
+
+  // not awaited on the completion thread
+  std::promise<int> synced;
+  zk.AsyncExists("/test", [this, &synced](int, const NodeStat&) {
+    synced.set_value(zk.TrySync("/test").code());
+  });
+  EXPECT_EQ(synced.get_future().get(), ZOK);
+  EXPECT_EQ(zk.syncs(), 3u);
+
+  std::promise<int> async_synced;
+  zk.AsyncSync("/test", [&async_synced](int code) {
+    async_synced.set_value(code);
+  });
+  EXPECT_EQ(async_synced.get_future().get(), ZOK);
+
+  zk.Sync("/test");
+  zk.set_sync_reads(false);
+  zk.Delete("/test");
+}
+
+TEST_F(ZooKeeperTest, TryOperations) {
+  auto missing = zk.TryGet("/test");
+  EXPECT_FALSE(missing.ok());
+  EXPECT_EQ(missing.code(), ZNONODE);
+  EXPECT_EQ(missing.value_or("none"), "none");
+  EXPECT_THROW(missing.value(), ZooException);
+  EXPECT_EQ(zk.TryStat("/test").code(), ZNONODE);
+  EXPECT_EQ(zk.TryDelete("/test").code(), ZNONODE);
+  EXPECT_EQ(zk.TrySet("/test", "value").code(), ZNONODE);
+
+  auto created = zk.TryCreate("/test", "value");
+  ASSERT_TRUE(created.ok());
+  EXPECT_EQ(*created, "/test");
+  EXPECT_EQ(zk.TryCreate("/test").code(), ZNODEEXISTS);
+
+  EXPECT_EQ(zk.TryGet("/test").value(), "value");
+  EXPECT_TRUE(zk.TrySet("/test", "new value", 0).ok());
+  EXPECT_EQ(zk.TrySet("/test", "stale", 0).code(), ZBADVERSION);
+  EXPECT_EQ(zk.TryStat("/test")->version, 1);
+  EXPECT_TRUE(zk.TryGetChildren("/test")->empty());
+
+  MultiOps ops;
+  ops.Check("/test", 0);
+  ops.Delete("/test");
+  EXPECT_EQ(zk.TryMulti(ops).code(), ZBADVERSION);
+
+  EXPECT_TRUE(zk.TryDelete("/test", 1).ok());
+  EXPECT_FALSE(zk.Exists("/test"));
+}
+
+TEST_F(ZooKeeperTest, MissHeavyGetBenchmark) {
+  const int count = 20000;
+
+  auto start = std::chrono::steady_clock::now();
+  int misses = 0;
+  for (int i = 0; i < count; ++i) {
+    try {
+      zk.Get("/test_missing");
+    } catch (const ZooException&) {
+      ++misses;
+    }
+  }
+  auto throwing = std::chrono::steady_clock::now() - start;
+
+  start = std::chrono::steady_clock::now();
+  for (int i = 0; i < count; ++i) {
+    if (!zk.TryGet("/test_missing")) ++misses;
+  }
+  auto non_throwing = std::chrono::steady_clock::now() - start;
+
+  EXPECT_EQ(misses, count * 2);
+
+  auto per_sec = [count](std::chrono::steady_clock::duration elapsed) {
+    return static_cast<int>(count / std::chrono::duration<double>(elapsed).count());
+  };
+  printf("%d missing gets: Get %d/sec, TryGet %d/sec\n",
+         count, per_sec(throwing), per_sec(non_throwing));
+}
+
 // test for watch change
 TEST(ZooKeeperWatch, WatchForConnected) {
   MockZooWatcher watcher;
@@ -0,0 +1,292 @@
+#include "zookeeper_watch.hpp"
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <set>
+#include "zookeeper_error.hpp"
+
+namespace zookeeper {
+
+class PersistentWatch::State
+  : public WatchListener,
+    public std::enable_shared_from_this<PersistentWatch::State> {
+public:
+  State(ZooKeeper& zk, PathView path, NodeEventHandler handler, bool recursive)
+  : zk_(zk),
+    root_(path.to_string()),
+    handler_(std::move(handler)),
+    recursive_(recursive) {
+  }
+
+  void Start() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    nodes_[root_];
+    ArmData(root_);
+  }
+
+  void Stop() {
+    zk_.RemoveWatchListener(shared_from_this());
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopped_ = true;
+  }
+
+  PersistentWatchStats stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto stats = stats_;
+    stats.watched_nodes = 0;
+    for (auto& node : nodes_) {
+      if (node.second.exists) ++stats.watched_nodes;
+    }
+    return stats;
+  }
+
+  void OnWatchEvent(int type, int state, const char* path) override {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (stopped_) return;
+
+    if (type == ZOO_SESSION_EVENT) {
+      if (state == ZOO_EXPIRED_SESSION_STATE) {
+        // watches are gone with the session
+        stopped_ = true;
+        NodeEvent event;
+        event.type = ZOO_SESSION_EVENT;
+        event.path = root_;
+        Emit(event);
+        Deliver(lock);
+      } else if (state == ZOO_CONNECTED_STATE) {
+        RearmFailed();
+      }
+      return;
+    }
+
+    if (!path || !nodes_.count(path)) return;
+    if (type == ZOO_CHILD_EVENT) {
+      ArmChildren(path);
+    } else {
+      ArmData(path);
+    }
+  }
+
+private:
+  struct Node {
+    bool exists = false;
+    bool children_watched = false;
+    NodeStat stat = NodeStat();
+  };
+
+  static bool IsConnectionError(int code) {
+    return code == ZCONNECTIONLOSS || code == ZOPERATIONTIMEOUT;
+  }
+
+  void ArmData(const std::string& path) {
+    ++stats_.rearms;
+    auto self = shared_from_this();
+    try {
+      zk_.AsyncGet(path, [self, path](int code, const char* value, int value_len,
+                                      const NodeStat& stat) {
+        self->OnData(path, code, value, value_len, stat);
+      }, true);
+    } catch (ZooException&) {
+      failed_data_.insert(path);
+    }
+  }
+
+  void ArmChildren(const std::string& path) {
+    ++stats_.rearms;
+    auto self = shared_from_this();
+    try {
+      zk_.AsyncGetChildren(path, [self, path](int code,
+                                              const std::vector<std::string>& children,
+                                              const NodeStat&) {
+        self->OnChildren(path, code, children);
+      }, true);
+    } catch (ZooException&) {
+      failed_children_.insert(path);
+    }
+  }
+
+  void WatchCreation(const std::string& path) {
+    auto self = shared_from_this();
+    try {
+      zk_.AsyncExists(path, [self, path](int code, const NodeStat&) {
+        self->OnExists(path, code);
+      }, true);
+    } catch (ZooException&) {
+      failed_data_.insert(path);
+    }
+  }
+
+  void RearmFailed() {
+    auto data = std::move(failed_data_);
+    auto children = std::move(failed_children_);
+    failed_data_.clear();
+    failed_children_.clear();
+    for (auto& path : data) {
+      if (nodes_.count(path)) ArmData(path);
+    }
+    for (auto& path : children) {
+      if (nodes_.count(path)) ArmChildren(path);
+    }
+  }
+
+  void OnData(const std::string& path, int code, const char* value,
+              int value_len, const NodeStat& stat) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (stopped_) return;
+    UpdateData(path, code, value, value_len, stat);
+    Deliver(lock);
+  }
+
+  void UpdateData(const std::string& path, int code, const char* value,
+                  int value_len, const NodeStat& stat) {
+    auto it = nodes_.find(path);
+    if (it == nodes_.end()) return;
+    auto& node = it->second;
+
+    if (code == ZOK) {
+      NodeEvent event;
+      event.path = path;
+      if (value) event.value.assign(value, value_len);
+      event.stat = stat;
+
+      if (node.exists && node.stat.czxid != stat.czxid) {
+        // deleted and created again before the watch was armed
+        ReportDeleted(path, &node);
+      }
+
+      if (!node.exists) {
+        event.type = ZOO_CREATED_EVENT;
+      } else if (stat.mzxid > node.stat.mzxid) {
+        event.type = ZOO_CHANGED_EVENT;
+        event.skipped = std::max(0, stat.version - node.stat.version - 1);
+      } else {
+        // armed again without a data change
+        return;
+      }
+
+      node.exists = true;
+      node.stat = stat;
+      auto watch_children = recursive_ && !node.children_watched;
+      node.children_watched = node.children_watched || watch_children;
+      Emit(event);
+      if (watch_children) ArmChildren(path);
+      return;
+    }
+
+    if (code == ZNONODE) {
+      if (node.exists) ReportDeleted(path, &node);
+      if (path == root_) {
+        WatchCreation(path);
+      } else {
+        // created again, it's found through the child watch of the parent
+        nodes_.erase(it);
+      }
+      return;
+    }
+
+    if (IsConnectionError(code)) {
+      failed_data_.insert(path);
+    }
+  }
+
+  void OnExists(const std::string& path, int code) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stopped_) return;
+
+    if (code == ZOK) {
+      // created before the exists request
+      ArmData(path);
+    } else if (IsConnectionError(code)) {
+      failed_data_.insert(path);
+    }
+  }
+
+  void OnChildren(const std::string& path, int code,
+                  const std::vector<std::string>& children) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stopped_) return;
+    auto it = nodes_.find(path);
+    if (it == nodes_.end() || !it->second.exists) return;
+
+    if (code == ZOK) {
+      auto prefix = path == "/" ? path : path + '/';
+      for (auto& child : children) {
+        auto child_path = prefix + child;
+        if (nodes_.emplace(child_path, Node()).second) {
+          ArmData(child_path);
+        }
+      }
+    } else if (IsConnectionError(code)) {
+      failed_children_.insert(path);
+    }
+    // deleted nodes are reported by their data watch
+  }
+
+  void ReportDeleted(const std::string& path, Node* node) {
+    NodeEvent event;
+    event.type = ZOO_DELETED_EVENT;
+    event.path = path;
+    event.stat = node->stat;
+    *node = Node();
+    Emit(event);
+  }
+
+  // queued under mutex_, handed to the handler by Deliver()
+  void Emit(const NodeEvent& event) {
+    ++stats_.events;
+    stats_.skipped += event.skipped;
+    pending_events_.push_back(event);
+  }
+
+  // Hand the queued events to the handler with mutex_, held by |lock|,
+  // unlocked meanwhile, so the handler may call stats() and a slow one
+  // doesn't hold up re-arming. One thread delivers at a time, in order.
+  void Deliver(std::unique_lock<std::mutex>& lock) {
+    if (delivering_) return;
+    delivering_ = true;
+    while (!pending_events_.empty()) {
+      auto event = std::move(pending_events_.front());
+      pending_events_.pop_front();
+      lock.unlock();
+      handler_(event);
+      lock.lock();
+    }
+    delivering_ = false;
+  }
+
+  ZooKeeper& zk_;
+  const std::string root_;
+  const NodeEventHandler handler_;
+  const bool recursive_;
+
+  mutable std::mutex mutex_;
+  bool stopped_ = false;
+  std::map<std::string, Node> nodes_;
+  // watches to arm again once connected
+  std::set<std::string> failed_data_;
+  std::set<std::string> failed_children_;
+  PersistentWatchStats stats_;
+  // events not handed to the handler yet
+  std::deque<NodeEvent> pending_events_;
+  bool delivering_ = false;
+};
+
+PersistentWatch::PersistentWatch(ZooKeeper& zk,
+                                 PathView path,
+                                 NodeEventHandler handler,
+                                 bool recursive)
+: state_(std::make_shared<State>(zk, path, std::move(handler), recursive)) {
+  zk.AddWatchListener(state_);
+  state_->Start();
+}
+
+PersistentWatch::~PersistentWatch() {
+  state_->Stop();
+}
+
+PersistentWatchStats PersistentWatch::stats() const {
+  return state_->stats();
+}
+
+}
@@ -0,0 +1,66 @@
+#pragma once
+#include <functional>
+#include <memory>
+#include <string>
+#include "zookeeper.hpp"
+
+namespace zookeeper {
+
+struct NodeEvent {
+  // ZOO_CREATED_EVENT, ZOO_CHANGED_EVENT or ZOO_DELETED_EVENT; once the
+  // session expires ZOO_SESSION_EVENT, after which nothing is watched
+  int type = 0;
+  std::string path;
+  // data and stat of the node, the last known stat for a deletion
+  std::string value;
+  NodeStat stat = NodeStat();
+  // updates merged into this one by the server, from the version gap
+  int64_t skipped = 0;
+};
+
+typedef std::function<void(const NodeEvent& event)> NodeEventHandler;
+
+struct PersistentWatchStats {
+  size_t watched_nodes = 0;
+  int64_t events = 0;
+  int64_t skipped = 0;
+  // watched requests issued to arm the watches again
+  int64_t rearms = 0;
+};
+
+// Watch of |path| which stays armed across events, like the persistent
+// watches of ZooKeeper 3.6. Watches of 3.4 are one shot, so each event arms
+// it again with a watched get which also fetches the new data in the same
+// round trip. Updates landing in between are merged by the server; the
+// version gap to the last reported stat tells how many were skipped.
+//
+// The node is first reported as created if it exists. With |recursive|
+// every descendant is watched as well, found through child watches.
+// Watches failed by a connection loss are armed again once reconnected.
+//
+// |handler| runs on the completion thread without the watch's lock, one
+// event at a time and in order; it may call stats() but must not destroy
+// the watch.
+// Events also reach the global watcher of |zk|, which must outlive the
+// watch.
+class PersistentWatch {
+public:
+  PersistentWatch(ZooKeeper& zk,
+                  PathView path,
+                  NodeEventHandler handler,
+                  bool recursive = false);
+
+  ~PersistentWatch();
+
+  // disable copy
+  PersistentWatch(const PersistentWatch&) = delete;
+  PersistentWatch& operator=(const PersistentWatch&) = delete;
+
+  PersistentWatchStats stats() const;
+
+private:
+  class State;
+  std::shared_ptr<State> state_;
+};
+
+}
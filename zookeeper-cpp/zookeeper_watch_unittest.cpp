@@ -0,0 +1,144 @@
+#include "zookeeper.hpp"
+#include "zookeeper_watch.hpp"
+#include "zookeeper_error.hpp"
+#include <gtest/gtest.h>
+#include <mutex>
+#include <thread>
+#include "zookeeper_unittest_helper.hpp"
+
+using namespace zookeeper;
+using namespace testing;
+
+struct EventLog {
+  std::mutex mutex;
+  std::vector<NodeEvent> events;
+
+  NodeEventHandler handler() {
+    return [this](const NodeEvent& event) {
+      std::lock_guard<std::mutex> lock(mutex);
+      events.push_back(event);
+    };
+  }
+
+  // events seen once |count| arrived
+  std::vector<NodeEvent> WaitFor(size_t count) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (std::chrono::steady_clock::now() < deadline) {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (events.size() >= count) return events;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    return events;
+  }
+};
+
+TEST_F(ZooKeeperTest, PersistentWatchStaysArmed) {
+  EventLog log;
+  PersistentWatch watch(zk, "/test", log.handler());
+
+  zk.Create("/test", "v0");
+  ASSERT_EQ(log.WaitFor(1).size(), 1u);
+  for (int i = 1; i <= 3; ++i) {
+    zk.Set("/test", "v" + std::to_string(i));
+    ASSERT_EQ(log.WaitFor(i + 1).size(), i + 1u);
+  }
+  zk.Delete("/test");
+  zk.Create("/test", "again");
+
+  auto events = log.WaitFor(6);
+  ASSERT_EQ(events.size(), 6u);
+  EXPECT_EQ(events[0].type, ZOO_CREATED_EVENT);
+  EXPECT_EQ(events[0].value, "v0");
+  for (int i = 1; i <= 3; ++i) {
+    EXPECT_EQ(events[i].type, ZOO_CHANGED_EVENT);
+    EXPECT_EQ(events[i].value, "v" + std::to_string(i));
+    EXPECT_EQ(events[i].skipped, 0);
+  }
+  EXPECT_EQ(events[4].type, ZOO_DELETED_EVENT);
+  EXPECT_EQ(events[5].type, ZOO_CREATED_EVENT);
+  EXPECT_EQ(events[5].value, "again");
+
+  zk.Delete("/test");
+}
+
+TEST_F(ZooKeeperTest, PersistentWatchReportsSkippedUpdates) {
+  zk.Create("/test", "v0");
+
+  EventLog log;
+  bool updated = false;
+  PersistentWatch watch(zk, "/test", [&](const NodeEvent& event) {
+    log.handler()(event);
+    if (event.type == ZOO_CHANGED_EVENT && !updated) {
+      // the first update fires the watch, the second merges into it
+      updated = true;
+      zk.Set("/test", "v2");
+      zk.Set("/test", "v3");
+    }
+  });
+  ASSERT_EQ(log.WaitFor(1).size(), 1u);
+
+  zk.Set("/test", "v1");
+  auto events = log.WaitFor(3);
+  ASSERT_EQ(events.size(), 3u);
+  EXPECT_EQ(events[1].value, "v1");
+  EXPECT_EQ(events[2].value, "v3");
+  EXPECT_EQ(events[2].skipped, 1);
+  EXPECT_EQ(watch.stats().skipped, 1);
+
+  zk.Delete("/test");
+}
+
+TEST_F(ZooKeeperTest, RecursivePersistentWatch) {
+  zk.Create("/test", "root");
+  zk.Create("/test/a", "a");
+
+  EventLog log;
+  PersistentWatch watch(zk, "/test", log.handler(), true);
+  ASSERT_EQ(log.WaitFor(2).size(), 2u);
+
+  zk.Create("/test/a/b", "b");
+  ASSERT_EQ(log.WaitFor(3).size(), 3u);
+  zk.Set("/test/a/b", "b1");
+  ASSERT_EQ(log.WaitFor(4).size(), 4u);
+  EXPECT_EQ(watch.stats().watched_nodes, 3u);
+
+  zk.Delete("/test/a/b");
+  zk.Delete("/test/a");
+  auto events = log.WaitFor(6);
+  ASSERT_EQ(events.size(), 6u);
+
+  EXPECT_EQ(events[2].type, ZOO_CREATED_EVENT);
+  EXPECT_EQ(events[2].path, "/test/a/b");
+  EXPECT_EQ(events[3].type, ZOO_CHANGED_EVENT);
+  EXPECT_EQ(events[3].value, "b1");
+  EXPECT_EQ(events[4].type, ZOO_DELETED_EVENT);
+  EXPECT_EQ(events[4].path, "/test/a/b");
+  EXPECT_EQ(events[5].type, ZOO_DELETED_EVENT);
+  EXPECT_EQ(events[5].path, "/test/a");
+  EXPECT_EQ(watch.stats().watched_nodes, 1u);
+
+  zk.Delete("/test");
+}
+
+TEST_F(ZooKeeperTest, PersistentWatchHandlerReadsStats) {
+  EventLog log;
+  std::vector<int64_t> seen;
+  PersistentWatch* watching = nullptr;
+  PersistentWatch watch(zk, "/test", [&](const NodeEvent& event) {
+    // the handler runs without the watch's lock
+    seen.push_back(watching->stats().events);
+    log.handler()(event);
+  });
+  watching = &watch;
+
+  zk.Create("/test", "v0");
+  ASSERT_EQ(log.WaitFor(1).size(), 1u);
+  zk.Set("/test", "v1");
+  ASSERT_EQ(log.WaitFor(2).size(), 2u);
+  EXPECT_EQ(seen, std::vector<int64_t>({1, 2}));
+
+  zk.Delete("/test");
+}